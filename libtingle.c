@@ -0,0 +1,5278 @@
+/*
+   Copyright (c) 2017, Alastair Poole <netstar@gmail.com>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <fnmatch.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/sysctl.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/statvfs.h>
+#include <net/if.h>
+#include <pthread.h>
+
+#if defined(__APPLE__) && defined(__MACH__)
+#define __MacOS__
+# include <mach/mach.h>
+# include <mach/vm_statistics.h>
+# include <mach/mach_types.h>
+# include <mach/mach_init.h>
+# include <mach/mach_host.h>
+# include <net/if_mib.h>
+# if !defined(NO_AUDIO)
+#  include <AudioToolBox/AudioServices.h>
+# endif
+#endif
+
+#if defined(__OpenBSD__) || defined(__NetBSD__)
+# include <sys/swap.h>
+# include <sys/sched.h>
+# include <sys/mount.h>
+# include <sys/sensors.h>
+# include <sys/audioio.h>
+# include <net/if_types.h>
+# include <ifaddrs.h>
+#endif
+
+#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__MacOS__)
+# include <sys/mount.h>
+#endif
+
+#if defined(__FreeBSD__) || defined(__DragonFly__)
+# include <net/if_mib.h>
+# include <vm/vm_param.h>
+# include <sys/soundcard.h>
+#endif
+
+#if defined(__linux__)
+# include <sys/soundcard.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  include <sys/mman.h>
+#  include <linux/io_uring.h>
+#  if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#   define READER_URING
+#  endif
+#  if !defined(IORING_FEAT_SINGLE_MMAP)
+#   define IORING_FEAT_SINGLE_MMAP (1U << 0)
+#  endif
+# endif
+#endif
+
+#if defined(__linux__) && defined(HAVE_ALSA) && !defined(NO_AUDIO)
+# include <dlfcn.h>
+#endif
+
+#include "tingle.h"
+
+#if defined(__OpenBSD__)
+# define CPU_STATES       6
+#else
+#define CPU_STATES        5
+#endif
+
+/* Collectors sample one subsystem into its own part of results_t.
+ * Rate collectors (CPU, network) compute their values against the
+ * previous sample, so the first call only takes a baseline. */
+typedef struct
+{
+   int    flag;
+   bool   rate;
+   void (*init)(results_t *results);
+   void (*sample)(results_t *results);
+   void (*shutdown)(results_t *results);
+} collector_t;
+
+#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__OpenBSD__)
+static void
+_memsize_bytes_to_kb(unsigned long *bytes)
+{
+   *bytes = (unsigned int)*bytes >> 10;
+}
+#endif
+
+/* Collector stamps are monotonic nanoseconds, zero before the first
+ * sample. */
+static uint64_t
+_stamp_now(void)
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static double
+_stamp_elapsed(uint64_t from, uint64_t to)
+{
+   return ((double) to - (double) from) / 1e9;
+}
+
+#if defined(__linux__)
+/* Files are NUL terminated and padded so the field scanner can load
+ * whole vectors without reading past the allocation. */
+#define FCONTENTS_PAD     32
+
+/* Read a whole file into *buf, growing it as needed, so callers that
+ * sample the same file repeatedly can reuse one allocation. */
+static ssize_t
+Fcontents_buf(const char *path, char **buf, size_t *size)
+{
+   char *tmp;
+   size_t bytes = 0;
+   ssize_t count;
+   int fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd == -1) return -1;
+
+   if (!*buf)
+     {
+        *size = 4096;
+        *buf = malloc(*size + FCONTENTS_PAD);
+        if (!*buf) goto error;
+     }
+
+   while ((count = read(fd, *buf + bytes, *size - bytes)) != 0)
+     {
+        if (count == -1)
+          {
+             if (errno == EINTR) continue;
+             goto error;
+          }
+        bytes += count;
+        if (bytes == *size)
+          {
+             tmp = realloc(*buf, *size * 2 + FCONTENTS_PAD);
+             if (!tmp) goto error;
+             *buf = tmp;
+             *size *= 2;
+          }
+     }
+
+   close(fd);
+
+   memset(*buf + bytes, 0, FCONTENTS_PAD);
+
+   return bytes;
+
+error:
+   close(fd);
+
+   return -1;
+}
+
+static char *
+Fcontents(const char *path)
+{
+   char *buf = NULL;
+   size_t size;
+
+   if (Fcontents_buf(path, &buf, &size) == -1)
+     {
+        free(buf);
+        return NULL;
+     }
+
+   return buf;
+}
+
+/* Read a number from a descriptor held open across samples. sysfs
+ * attributes are regenerated on every read from offset zero. */
+static bool
+_fd_read_long(int fd, long *value)
+{
+   char buf[32];
+   ssize_t len;
+
+   len = pread(fd, buf, sizeof(buf) - 1, 0);
+   if (len <= 0) return false;
+   buf[len] = '\0';
+
+   *value = strtol(buf, NULL, 10);
+
+   return true;
+}
+
+/* Read a small file held open into buf, NUL terminated and padded for
+ * the field scanner. */
+static ssize_t
+_fd_contents(int fd, char *buf, size_t size)
+{
+   ssize_t len;
+
+   if (fd == -1) return -1;
+
+   len = pread(fd, buf, size - FCONTENTS_PAD, 0);
+   if (len < 0) return -1;
+
+   memset(buf + len, 0, FCONTENTS_PAD);
+
+   return len;
+}
+
+static long
+_file_read_long(const char *path, long fallback)
+{
+   long value;
+   int fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd == -1) return fallback;
+
+   if (!_fd_read_long(fd, &value))
+     value = fallback;
+   close(fd);
+
+   return value;
+}
+
+/* Pseudo files read on every sample are opened once by their collector
+ * and registered with the handle's reader. Before the collectors run,
+ * reader_fill() reads all of them at offset zero: as one io_uring
+ * submission where the kernel allows it, which takes a sample's reads
+ * down to a single system call, and with one pread() each otherwise.
+ * /proc files are then read on to the end, as they may come a page at
+ * a time. The ring is driven with raw system calls, no liburing needed. */
+#define READER_RING_ENTRIES  32
+
+struct reader_file_t
+{
+   int           fd;
+   char         *buf;
+   size_t        size;
+   ssize_t       len;
+   bool          whole;
+   struct iovec  iov;
+};
+
+struct reader_t
+{
+   reader_file_t       **files;
+   int                   count;
+   int                   size;
+#if defined(READER_URING)
+   int                   ring_fd;
+   unsigned int          entries;
+   void                 *sq_ring;
+   size_t                sq_ring_size;
+   void                 *cq_ring;
+   size_t                cq_ring_size;
+   struct io_uring_sqe  *sqes;
+   unsigned int         *sq_tail;
+   unsigned int         *sq_mask;
+   unsigned int         *sq_array;
+   unsigned int         *cq_head;
+   unsigned int         *cq_tail;
+   unsigned int         *cq_mask;
+   struct io_uring_cqe  *cqes;
+#endif
+};
+
+#if defined(READER_URING)
+static void
+_reader_uring_shutdown(reader_t *reader)
+{
+   if (reader->sqes)
+     munmap(reader->sqes, reader->entries * sizeof(struct io_uring_sqe));
+   if (reader->cq_ring && reader->cq_ring != reader->sq_ring)
+     munmap(reader->cq_ring, reader->cq_ring_size);
+   if (reader->sq_ring)
+     munmap(reader->sq_ring, reader->sq_ring_size);
+   if (reader->ring_fd != -1)
+     close(reader->ring_fd);
+
+   reader->ring_fd = -1;
+   reader->sqes = NULL;
+   reader->sq_ring = reader->cq_ring = NULL;
+}
+
+/* Fails on kernels without io_uring, or where it's turned off. */
+static bool
+_reader_uring_init(reader_t *reader)
+{
+   struct io_uring_params params;
+   char *sq, *cq;
+   void *map;
+
+   memset(&params, 0, sizeof(params));
+   reader->ring_fd = syscall(__NR_io_uring_setup, READER_RING_ENTRIES, &params);
+   if (reader->ring_fd == -1)
+     return false;
+
+   reader->entries = params.sq_entries;
+   reader->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+   reader->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+   if (params.features & IORING_FEAT_SINGLE_MMAP)
+     {
+        if (reader->cq_ring_size > reader->sq_ring_size)
+          reader->sq_ring_size = reader->cq_ring_size;
+        reader->cq_ring_size = reader->sq_ring_size;
+     }
+
+   map = mmap(NULL, reader->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+              reader->ring_fd, IORING_OFF_SQ_RING);
+   if (map == MAP_FAILED) goto error;
+   reader->sq_ring = map;
+
+   if (params.features & IORING_FEAT_SINGLE_MMAP)
+     reader->cq_ring = reader->sq_ring;
+   else
+     {
+        map = mmap(NULL, reader->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   reader->ring_fd, IORING_OFF_CQ_RING);
+        if (map == MAP_FAILED) goto error;
+        reader->cq_ring = map;
+     }
+
+   map = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+              MAP_SHARED, reader->ring_fd, IORING_OFF_SQES);
+   if (map == MAP_FAILED) goto error;
+   reader->sqes = map;
+
+   sq = reader->sq_ring;
+   cq = reader->cq_ring;
+   reader->sq_tail = (unsigned int *) (sq + params.sq_off.tail);
+   reader->sq_mask = (unsigned int *) (sq + params.sq_off.ring_mask);
+   reader->sq_array = (unsigned int *) (sq + params.sq_off.array);
+   reader->cq_head = (unsigned int *) (cq + params.cq_off.head);
+   reader->cq_tail = (unsigned int *) (cq + params.cq_off.tail);
+   reader->cq_mask = (unsigned int *) (cq + params.cq_off.ring_mask);
+   reader->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+   return true;
+
+error:
+   _reader_uring_shutdown(reader);
+
+   return false;
+}
+
+/* Queue reads of files [first, first + count) and wait for them all. */
+static bool
+_reader_uring_batch(reader_t *reader, int first, int count)
+{
+   struct io_uring_sqe *sqe;
+   struct io_uring_cqe *cqe;
+   reader_file_t *file;
+   unsigned int tail, head, index, mask = *reader->sq_mask;
+   int i, ret, reaped = 0, submit = count;
+
+   tail = *reader->sq_tail;
+   for (i = 0; i < count; i++)
+     {
+        file = reader->files[first + i];
+        index = tail & mask;
+        sqe = &reader->sqes[index];
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = file->fd;
+        sqe->addr = (uintptr_t) &file->iov;
+        sqe->len = 1;
+        sqe->off = 0;
+        sqe->user_data = first + i;
+        reader->sq_array[index] = index;
+        tail++;
+     }
+   __atomic_store_n(reader->sq_tail, tail, __ATOMIC_RELEASE);
+
+   while (reaped < count)
+     {
+        ret = syscall(__NR_io_uring_enter, reader->ring_fd, submit, count - reaped,
+                      IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret == -1)
+          {
+             if (errno == EINTR) continue;
+             return false;
+          }
+        submit -= ret < submit ? ret : submit;
+
+        head = *reader->cq_head;
+        while (head != __atomic_load_n(reader->cq_tail, __ATOMIC_ACQUIRE))
+          {
+             cqe = &reader->cqes[head & *reader->cq_mask];
+             if (cqe->user_data < (uint64_t) reader->count)
+               reader->files[cqe->user_data]->len = cqe->res < 0 ? -1 : cqe->res;
+             head++;
+             reaped++;
+          }
+        __atomic_store_n(reader->cq_head, head, __ATOMIC_RELEASE);
+     }
+
+   return true;
+}
+#endif
+
+static reader_t *
+reader_new(void)
+{
+   reader_t *reader = calloc(1, sizeof(reader_t));
+   if (!reader) return NULL;
+
+#if defined(READER_URING)
+   if (!_reader_uring_init(reader))
+     reader->ring_fd = -1;
+#endif
+
+   return reader;
+}
+
+static void
+reader_free(reader_t *reader)
+{
+   if (!reader) return;
+
+   /* Collectors close their files when they shut down. */
+#if defined(READER_URING)
+   _reader_uring_shutdown(reader);
+#endif
+   free(reader->files);
+   free(reader);
+}
+
+static reader_file_t *
+reader_open(reader_t *reader, const char *path, size_t size)
+{
+   reader_file_t *file, **tmp;
+
+   if (!reader) return NULL;
+
+   file = calloc(1, sizeof(reader_file_t));
+   if (!file) return NULL;
+
+   file->fd = open(path, O_RDONLY | O_CLOEXEC);
+   /* sysfs attributes come whole from a single read. */
+   file->whole = !strncmp(path, "/sys/", 5);
+   file->size = size;
+   file->buf = malloc(size + FCONTENTS_PAD);
+   file->len = -1;
+   if (file->fd == -1 || !file->buf)
+     goto error;
+
+   if (reader->count == reader->size)
+     {
+        tmp = realloc(reader->files, (reader->size ? reader->size * 2 : 16) * sizeof(reader_file_t *));
+        if (!tmp) goto error;
+        reader->files = tmp;
+        reader->size = reader->size ? reader->size * 2 : 16;
+     }
+
+   file->iov.iov_base = file->buf;
+   file->iov.iov_len = file->size;
+   reader->files[reader->count++] = file;
+
+   return file;
+
+error:
+   if (file->fd != -1) close(file->fd);
+   free(file->buf);
+   free(file);
+
+   return NULL;
+}
+
+static void
+reader_close(reader_t *reader, reader_file_t *file)
+{
+   int i;
+
+   if (!file) return;
+
+   for (i = 0; i < reader->count; i++)
+     {
+        if (reader->files[i] != file) continue;
+        reader->files[i] = reader->files[--reader->count];
+        break;
+     }
+
+   close(file->fd);
+   free(file->buf);
+   free(file);
+}
+
+/* /proc files built by seq_file hand out about a page per read
+ * whatever the buffer size, so a short read isn't the end: read on
+ * until a read returns nothing, growing the buffer when it fills. */
+static void
+_reader_file_rest(reader_file_t *file)
+{
+   char *tmp;
+   ssize_t count;
+
+   while (file->len > 0)
+     {
+        if (file->len == (ssize_t) file->size)
+          {
+             tmp = realloc(file->buf, file->size * 2 + FCONTENTS_PAD);
+             if (!tmp) return;
+             file->buf = tmp;
+             file->size *= 2;
+             file->iov.iov_base = file->buf;
+             file->iov.iov_len = file->size;
+          }
+
+        count = pread(file->fd, file->buf + file->len, file->size - file->len, file->len);
+        if (count <= 0) return;
+        file->len += count;
+     }
+}
+
+static void
+reader_fill(reader_t *reader)
+{
+   reader_file_t *file;
+   bool done = false;
+   int i, batch;
+
+   if (!reader || !reader->count) return;
+
+#if defined(READER_URING)
+   if (reader->ring_fd != -1)
+     {
+        done = true;
+        for (i = 0; done && i < reader->count; i += batch)
+          {
+             batch = reader->count - i;
+             if (batch > (int) reader->entries) batch = reader->entries;
+             done = _reader_uring_batch(reader, i, batch);
+          }
+        /* Refused (seccomp, io_uring_disabled): stop trying. */
+        if (!done)
+          _reader_uring_shutdown(reader);
+     }
+#else
+   (void) batch;
+#endif
+
+   for (i = 0; i < reader->count; i++)
+     {
+        file = reader->files[i];
+        if (!done || file->len == -1)
+          file->len = pread(file->fd, file->buf, file->size, 0);
+        if (!file->whole || file->len == (ssize_t) file->size)
+          _reader_file_rest(file);
+        memset(file->buf + (file->len > 0 ? file->len : 0), 0, FCONTENTS_PAD);
+     }
+}
+
+/* The contents from the last reader_fill(), NUL terminated and padded
+ * for the field scanner. */
+static ssize_t
+reader_contents(const reader_file_t *file, char **buf)
+{
+   if (!file || file->len < 0) return -1;
+
+   *buf = file->buf;
+
+   return file->len;
+}
+
+static bool
+reader_long(const reader_file_t *file, long *value)
+{
+   char *buf;
+
+   if (reader_contents(file, &buf) <= 0) return false;
+
+   *value = strtol(buf, NULL, 10);
+
+   return true;
+}
+
+/* Numeric field scanner for /proc text files.
+ *
+ * fields_parse() collects every run of decimal digits from p up to the
+ * end of the line (callers skip any label first), stores up to max
+ * values in out and returns how many it found. *next is set to the start
+ * of the following line. The SSE2 and AVX2 versions classify a whole
+ * vector of bytes at a time and only visit the edges of digit runs;
+ * runs of up to 16 digits are then converted eight digits at a time
+ * with SWAR arithmetic. The implementation is picked once at runtime. */
+typedef struct
+{
+   const char *lo;
+   uint64_t   *out;
+   int         max;
+   int         count;
+   const char *start;
+} fields_t;
+
+typedef int (*fields_parse_fn)(const char *p, const char *end, uint64_t *out, int max, const char **next);
+
+static inline uint64_t
+_fields_swar8(const char *end, int len)
+{
+   uint64_t v, keep;
+
+   /* Load the 8 bytes ending at the run and replace the ones before it
+    * with '0' so the run reads as a zero-padded 8 digit number. */
+   memcpy(&v, end - 8, sizeof(v));
+   keep = len >= 8 ? ~0ULL : ~0ULL << (8 * (8 - len));
+   v = (v & keep) | (0x3030303030303030ULL & ~keep);
+   v -= 0x3030303030303030ULL;
+   v = (v * 10) + (v >> 8);
+   v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+        (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+
+   return v;
+}
+
+static inline void
+_fields_emit(fields_t *f, const char *end)
+{
+   const char *p = f->start;
+   int len = end - p;
+   uint64_t v = 0;
+
+   f->start = NULL;
+   if (f->count >= f->max)
+     return;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+   if (len <= 16 && end - (len > 8 ? 16 : 8) >= f->lo)
+     {
+        if (len <= 8)
+          v = _fields_swar8(end, len);
+        else
+          v = _fields_swar8(end - 8, len - 8) * 100000000ULL + _fields_swar8(end, 8);
+        f->out[f->count++] = v;
+        return;
+     }
+#endif
+   while (p < end)
+     v = v * 10 + (*p++ - '0');
+
+   f->out[f->count++] = v;
+}
+
+static inline const char *
+_fields_scalar(fields_t *f, const char *p, const char *end)
+{
+   for (; p < end; p++)
+     {
+        if (*p == '\n')
+          break;
+        if (*p >= '0' && *p <= '9')
+          {
+             if (!f->start) f->start = p;
+          }
+        else if (f->start)
+          _fields_emit(f, p);
+     }
+
+   if (f->start)
+     _fields_emit(f, p);
+
+   return p < end ? p + 1 : end;
+}
+
+/* Walk the digit run edges of one block given its digit and newline
+ * bitmasks. Returns true once the end of the line has been reached. */
+static inline bool
+_fields_block(fields_t *f, const char *p, uint64_t digits, uint64_t newlines, int width)
+{
+   uint64_t edges, bits = width == 64 ? ~0ULL : (1ULL << width) - 1;
+   bool eol = newlines != 0;
+   int pos;
+
+   if (eol)
+     {
+        bits = (newlines & -newlines) - 1;
+        digits &= bits;
+     }
+
+   edges = (digits ^ ((digits << 1) | (f->start != NULL))) & bits;
+   while (edges)
+     {
+        pos = __builtin_ctzll(edges);
+        edges &= edges - 1;
+        if (f->start)
+          _fields_emit(f, p + pos);
+        else
+          f->start = p + pos;
+     }
+
+   if (eol && f->start)
+     _fields_emit(f, p + __builtin_ctzll(newlines));
+
+   return eol;
+}
+
+static int
+_fields_parse_scalar(const char *p, const char *end, uint64_t *out, int max, const char **next)
+{
+   fields_t f = { p, out, max, 0, NULL };
+
+   *next = _fields_scalar(&f, p, end);
+
+   return f.count;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+
+__attribute__((target("sse2")))
+static int
+_fields_parse_sse2(const char *p, const char *end, uint64_t *out, int max, const char **next)
+{
+   fields_t f = { p, out, max, 0, NULL };
+   const __m128i lo = _mm_set1_epi8('0' - 1), hi = _mm_set1_epi8('9' + 1);
+   const __m128i nl = _mm_set1_epi8('\n');
+   __m128i v;
+   uint64_t digits, newlines;
+
+   for (; p + 16 <= end; p += 16)
+     {
+        v = _mm_loadu_si128((const __m128i *) p);
+        digits = (uint16_t) _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi)));
+        newlines = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (_fields_block(&f, p, digits, newlines, 16))
+          {
+             *next = p + __builtin_ctzll(newlines) + 1;
+             return f.count;
+          }
+     }
+
+   *next = _fields_scalar(&f, p, end);
+
+   return f.count;
+}
+
+__attribute__((target("avx2")))
+static int
+_fields_parse_avx2(const char *p, const char *end, uint64_t *out, int max, const char **next)
+{
+   fields_t f = { p, out, max, 0, NULL };
+   const __m256i lo = _mm256_set1_epi8('0' - 1), hi = _mm256_set1_epi8('9' + 1);
+   const __m256i nl = _mm256_set1_epi8('\n');
+   __m256i v;
+   uint64_t digits, newlines;
+
+   for (; p + 32 <= end; p += 32)
+     {
+        v = _mm256_loadu_si256((const __m256i *) p);
+        digits = (uint32_t) _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v)));
+        newlines = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (_fields_block(&f, p, digits, newlines, 32))
+          {
+             *next = p + __builtin_ctzll(newlines) + 1;
+             return f.count;
+          }
+     }
+
+   *next = _fields_scalar(&f, p, end);
+
+   return f.count;
+}
+
+#endif
+
+static fields_parse_fn _fields_parse = _fields_parse_scalar;
+static pthread_once_t _fields_once = PTHREAD_ONCE_INIT;
+
+static void
+_fields_parse_select(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2"))
+     _fields_parse = _fields_parse_avx2;
+   else if (__builtin_cpu_supports("sse2"))
+     _fields_parse = _fields_parse_sse2;
+#endif
+}
+
+static int
+fields_parse(const char *p, const char *end, uint64_t *out, int max, const char **next)
+{
+   pthread_once(&_fields_once, _fields_parse_select);
+
+   return _fields_parse(p, end, out, max, next);
+}
+
+#endif
+
+#if defined(__FreeBSD__) || defined(__DragonFly__)
+static long int
+_sysctlfromname(const char *name, void *mib, int depth, size_t *len)
+{
+   long int result;
+
+   if (sysctlnametomib(name, mib, len) < 0)
+     return -1;
+
+   *len = sizeof(result);
+   if (sysctl(mib, depth, &result, len, NULL, 0) < 0)
+     return -1;
+
+   return result;
+}
+
+#endif
+
+static int
+cpu_count(void)
+{
+   int cores = 0;
+#if defined(__linux__)
+   char buf[4096];
+   FILE *f;
+   int line = 0;
+
+   f = fopen("/proc/stat", "r");
+   if (!f) return 0;
+
+   while (fgets(buf, sizeof(buf), f))
+     {
+        if (line)
+          {
+             if (!strncmp(buf, "cpu", 3))
+               cores++;
+             else
+               break;
+          }
+        line++;
+     }
+
+   fclose(f);
+#elif defined(__MacOS__) || defined(__FreeBSD__) || defined(__DragonFly__) || defined(__OpenBSD__) || defined(__NetBSD__)
+   size_t len;
+   int mib[2] = { CTL_HW, HW_NCPU };
+
+   len = sizeof(cores);
+   if (sysctl(mib, 2, &cores, &len, NULL, 0) < 0)
+     return 0;
+#endif
+   return cores;
+}
+
+static void
+_sched_state_get(sched_t *sched, unsigned long ctxt, unsigned long intr, unsigned long forks)
+{
+   uint64_t now;
+   double elapsed;
+#if defined(__linux__)
+   char *buf, *p;
+   int i;
+#endif
+
+   now = _stamp_now();
+   if (sched->stamp)
+     {
+        elapsed = _stamp_elapsed(sched->stamp, now);
+        if (elapsed > 0)
+          {
+             sched->ctxt_rate = ctxt >= sched->ctxt ? (ctxt - sched->ctxt) / elapsed : 0;
+             sched->intr_rate = intr >= sched->intr ? (intr - sched->intr) / elapsed : 0;
+             sched->fork_rate = forks >= sched->forks ? (forks - sched->forks) / elapsed : 0;
+          }
+     }
+   sched->stamp = now;
+   sched->ctxt = ctxt;
+   sched->intr = intr;
+   sched->forks = forks;
+
+#if defined(__linux__)
+   /* "0.52 0.40 0.31 2/345 12345" */
+   if (reader_contents(sched->loadavg, &buf) <= 0) return;
+
+   p = buf;
+   for (i = 0; i < 3; i++)
+     sched->load[i] = strtod(p, &p);
+   sched->runnable = strtoul(p, &p, 10);
+   if (*p == '/')
+     sched->tasks = strtoul(p + 1, NULL, 10);
+#else
+   getloadavg(sched->load, 3);
+#endif
+}
+
+static void
+_cpu_state_get(cpu_cores_t *cores, int ncpu, sched_t *sched)
+{
+   int diff_total, diff_idle;
+   double ratio, percent;
+   unsigned long total, idle, used;
+#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__OpenBSD__) || defined(__NetBSD__)
+   size_t size;
+   int i, j;
+#endif
+#if defined(__FreeBSD__) || defined(__DragonFly__)
+   if (!ncpu)
+     return;
+   size = sizeof(unsigned long) * (CPU_STATES * ncpu);
+   unsigned long cpu_times[ncpu][CPU_STATES];
+
+   if (sysctlbyname("kern.cp_times", cpu_times, &size, NULL, 0) < 0)
+     return;
+
+   for (i = 0; i < ncpu; i++) {
+        unsigned long *cpu = cpu_times[i];
+
+        total = 0;
+        for (j = 0; j < CPU_STATES; j++)
+          total += cpu[j];
+
+        idle = cpu[4];
+
+        diff_total = total - cores->total[i];
+        diff_idle = idle - cores->idle[i];
+        if (diff_total == 0) diff_total = 1;
+
+        ratio = diff_total / 100.0;
+        used = diff_total - diff_idle;
+        percent = used / ratio;
+
+        if (percent > 100) percent = 100;
+        else if (percent < 0)
+          percent = 0;
+
+        cores->percent[i] = percent;
+        cores->total[i] = total;
+        cores->idle[i] = idle;
+     }
+
+   if (sched->enabled)
+     {
+        unsigned int swtch = 0, intr = 0, forks = 0;
+
+        size = sizeof(swtch);
+        sysctlbyname("vm.stats.sys.v_swtch", &swtch, &size, NULL, 0);
+        size = sizeof(intr);
+        sysctlbyname("vm.stats.sys.v_intr", &intr, &size, NULL, 0);
+        size = sizeof(forks);
+        sysctlbyname("vm.stats.vm.v_forks", &forks, &size, NULL, 0);
+
+        _sched_state_get(sched, swtch, intr, forks);
+     }
+#elif defined(__OpenBSD__)
+   static struct cpustats cpu_times[CPU_STATES];
+   static int cpu_time_mib[] = { CTL_KERN, KERN_CPUSTATS, 0 };
+
+   memset(&cpu_times, 0, CPU_STATES * sizeof(struct cpustats));
+   if (!ncpu)
+     return;
+
+   for (i = 0; i < ncpu; i++)
+     {
+        size = sizeof(struct cpustats);
+        cpu_time_mib[2] = i;
+        if (sysctl(cpu_time_mib, 3, &cpu_times[i], &size, NULL, 0) < 0)
+          return;
+
+        total = 0;
+        for (j = 0; j < CPU_STATES; j++)
+          total += cpu_times[i].cs_time[j];
+
+        idle = cpu_times[i].cs_time[CP_IDLE];
+
+        diff_total = total - cores->total[i];
+        if (diff_total == 0) diff_total = 1;
+
+        diff_idle = idle - cores->idle[i];
+        ratio = diff_total / 100.0;
+        used = diff_total - diff_idle;
+        percent = used / ratio;
+
+        if (percent > 100) percent = 100;
+        else if (percent < 0)
+          percent = 0;
+
+        cores->percent[i] = percent;
+        cores->total[i] = total;
+        cores->idle[i] = idle;
+     }
+#elif defined(__linux__)
+   char *buf, *end;
+   const char *line, *next;
+   uint64_t cpu_times[4];
+   ssize_t len;
+   int i;
+
+   len = reader_contents(cores->stat, &buf);
+   if (len <= 0) return;
+
+   end = buf + len;
+
+   /* Skip the aggregate line and walk the per-core lines in one pass. */
+   line = strchr(buf, '\n');
+   if (!line) return;
+
+   for (line++; line < end && !strncmp(line, "cpu", 3); line = next)
+     {
+        i = atoi(line + 3);
+        line = strchr(line, ' ');
+        if (!line) break;
+
+        if (4 != fields_parse(line, end, cpu_times, 4, &next))
+          break;
+        if (i < 0 || i >= ncpu)
+          continue;
+
+        total = cpu_times[0] + cpu_times[1] + cpu_times[2] + cpu_times[3];
+        idle = cpu_times[3];
+        diff_total = total - cores->total[i];
+        if (diff_total == 0) diff_total = 1;
+
+        diff_idle = idle - cores->idle[i];
+        ratio = diff_total / 100.0;
+        used = diff_total - diff_idle;
+        percent = used / ratio;
+
+        if (percent > 100) percent = 100;
+        else if (percent < 0)
+          percent = 0;
+
+        cores->percent[i] = percent;
+        cores->total[i] = total;
+        cores->idle[i] = idle;
+     }
+
+   if (sched->enabled)
+     {
+        unsigned long ctxt = 0, intr = 0, forks = 0;
+        uint64_t value;
+
+        for (; line < end; line = next)
+          {
+             next = strchr(line, '\n');
+             next = next ? next + 1 : end;
+
+             /* The intr line is long, the scanner only skips over it. */
+             if (!strncmp(line, "intr ", 5) && fields_parse(line + 5, end, &value, 1, &next))
+               intr = value;
+             else if (!strncmp(line, "ctxt ", 5) && fields_parse(line + 5, end, &value, 1, &next))
+               ctxt = value;
+             else if (!strncmp(line, "processes ", 10) && fields_parse(line + 10, end, &value, 1, &next))
+               forks = value;
+             else if (!strncmp(line, "procs_running ", 14) && fields_parse(line + 14, end, &value, 1, &next))
+               sched->running = value;
+             else if (!strncmp(line, "procs_blocked ", 14) && fields_parse(line + 14, end, &value, 1, &next))
+               sched->blocked = value;
+          }
+
+        _sched_state_get(sched, ctxt, intr, forks);
+     }
+#elif defined(__MacOS__)
+   mach_msg_type_number_t count;
+   processor_cpu_load_info_t load;
+   mach_port_t mach_port;
+   unsigned int cpu_count;
+   int i;
+
+   cpu_count = ncpu;
+
+   count = HOST_CPU_LOAD_INFO_COUNT;
+   mach_port = mach_host_self();
+   if (host_processor_info(mach_port, PROCESSOR_CPU_LOAD_INFO, &cpu_count, (processor_info_array_t *)&load, &count) != KERN_SUCCESS)
+     exit(4 << 1);
+
+   for (i = 0; i < ncpu; i++) {
+        total = load[i].cpu_ticks[CPU_STATE_USER] + load[i].cpu_ticks[CPU_STATE_SYSTEM] + load[i].cpu_ticks[CPU_STATE_IDLE] + load[i].cpu_ticks[CPU_STATE_NICE];
+        idle = load[i].cpu_ticks[CPU_STATE_IDLE];
+
+        diff_total = total - cores->total[i];
+        if (diff_total == 0) diff_total = 1;
+        diff_idle = idle - cores->idle[i];
+        ratio = diff_total / 100.0;
+        used = diff_total - diff_idle;
+        percent = used / ratio;
+
+        if (percent > 100) percent = 100;
+        else if (percent < 0)
+          percent = 0;
+
+        cores->percent[i] = percent;
+        cores->total[i] = total;
+        cores->idle[i] = idle;
+     }
+#endif
+#if defined(__OpenBSD__) || defined(__NetBSD__) || defined(__MacOS__)
+   /* Load averages only. */
+   if (sched->enabled)
+     _sched_state_get(sched, 0, 0, 0);
+#endif
+}
+
+static void
+_cpu_cores_init(results_t *results)
+{
+   cpu_cores_t *cores = &results->cores;
+   int ncpu;
+
+   ncpu = cpu_count();
+   if (ncpu <= 0) return;
+
+   cores->arena = calloc(ncpu, 2 * sizeof(unsigned long) + sizeof(float));
+   if (!cores->arena) return;
+
+   cores->total = cores->arena;
+   cores->idle = cores->total + ncpu;
+   cores->percent = (float *) (cores->idle + ncpu);
+
+   results->cpu_count = ncpu;
+#if defined(__linux__)
+   cores->stat = reader_open(results->reader, "/proc/stat", 4096);
+#endif
+}
+
+static void
+_cpu_cores_state_get(results_t *results)
+{
+   if (results->cpu_count)
+     _cpu_state_get(&results->cores, results->cpu_count, &results->sched);
+}
+
+static void
+_cpu_cores_shutdown(results_t *results)
+{
+   free(results->cores.arena);
+#if defined(__linux__)
+   reader_close(results->reader, results->cores.stat);
+#endif
+
+   memset(&results->cores, 0, sizeof(cpu_cores_t));
+   results->cpu_count = 0;
+}
+
+#if defined(__linux__)
+static unsigned long
+_meminfo_parse_line(const char *line, const char *end, const char **next)
+{
+   uint64_t value = 0;
+
+   fields_parse(strchr(line, ':') + 1, end, &value, 1, next);
+
+   return value;
+}
+
+#endif
+
+static void
+_memory_usage_get(meminfo_t *memory, reader_file_t *file)
+{
+#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__OpenBSD__)
+   size_t len = 0;
+   int i = 0;
+#endif
+   memset(memory, 0, sizeof(meminfo_t));
+#if defined(__linux__)
+   char *buf, *end;
+   const char *line, *next;
+   unsigned long swap_free = 0, tmp_free = 0, tmp_slab = 0;
+   ssize_t len;
+   int fields = 0;
+
+   len = reader_contents(file, &buf);
+   if (len <= 0) return;
+
+   end = buf + len;
+
+   for (line = buf; line < end && fields < 8; line = next)
+     {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : end;
+
+        if (!strncmp("MemTotal:", line, 9))
+          {
+             memory->total = _meminfo_parse_line(line, end, &next);
+             fields++;
+          }
+        else if (!strncmp("MemFree:", line, 8))
+          {
+             tmp_free = _meminfo_parse_line(line, end, &next);
+             fields++;
+          }
+        else if (!strncmp("Cached:", line, 7))
+          {
+             memory->cached = _meminfo_parse_line(line, end, &next);
+             fields++;
+          }
+        else if (!strncmp("Slab:", line, 5))
+          {
+             tmp_slab = _meminfo_parse_line(line, end, &next);
+             fields++;
+          }
+        else if (!strncmp("Buffers:", line, 8))
+          {
+             memory->buffered = _meminfo_parse_line(line, end, &next);
+             fields++;
+          }
+        else if (!strncmp("Shmem:", line, 6))
+          {
+             memory->shared = _meminfo_parse_line(line, end, &next);
+             fields++;
+          }
+        else if (!strncmp("SwapTotal:", line, 10))
+          {
+             memory->swap_total = _meminfo_parse_line(line, end, &next);
+             fields++;
+          }
+        else if (!strncmp("SwapFree:", line, 9))
+          {
+             swap_free = _meminfo_parse_line(line, end, &next);
+             fields++;
+          }
+     }
+
+   memory->cached += tmp_slab;
+   memory->used = memory->total - tmp_free - memory->cached - memory->buffered;
+   memory->swap_used = memory->swap_total > swap_free ? memory->swap_total - swap_free : 0;
+#elif defined(__FreeBSD__) || defined(__DragonFly__)
+   int total_pages = 0, free_pages = 0, inactive_pages = 0;
+   long int result = 0;
+   int page_size = getpagesize();
+   int mib[4] = { CTL_HW, HW_PHYSMEM, 0, 0 };
+
+   len = sizeof(memory->total);
+   if (sysctl(mib, 2, &memory->total, &len, NULL, 0) == -1)
+     return;
+   memory->total /= 1024;
+
+   total_pages =
+     _sysctlfromname("vm.stats.vm.v_page_count", mib, 4, &len);
+   if (total_pages < 0)
+     return;
+
+   free_pages = _sysctlfromname("vm.stats.vm.v_free_count", mib, 4, &len);
+   if (free_pages < 0)
+     return;
+
+   inactive_pages =
+     _sysctlfromname("vm.stats.vm.v_inactive_count", mib, 4, &len);
+   if (inactive_pages < 0)
+     return;
+
+   memory->used = (total_pages - free_pages - inactive_pages) * page_size;
+   _memsize_bytes_to_kb(&memory->used);
+
+   result = _sysctlfromname("vfs.bufspace", mib, 2, &len);
+   if (result < 0)
+     return;
+   memory->buffered = (result);
+   _memsize_bytes_to_kb(&memory->buffered);
+
+   result = _sysctlfromname("vm.stats.vm.v_active_count", mib, 4, &len);
+   if (result < 0)
+     return;
+   memory->cached = (result * page_size);
+   _memsize_bytes_to_kb(&memory->cached);
+
+   result = _sysctlfromname("vm.stats.vm.v_cache_count", mib, 4, &len);
+   if (result < 0)
+     return;
+   memory->shared = (result * page_size);
+   _memsize_bytes_to_kb(&memory->shared);
+
+   result = _sysctlfromname("vm.swap_total", mib, 2, &len);
+   if (result < 0)
+     return;
+   memory->swap_total = (result / 1024);
+
+   struct xswdev xsw;
+   /* previous mib is important for this one... */
+
+   while (i++)
+     {
+        mib[2] = i;
+        len = sizeof(xsw);
+        if (sysctl(mib, 3, &xsw, &len, NULL, 0) == -1)
+          break;
+
+        memory->swap_used += xsw.xsw_used * page_size;
+     }
+
+   memory->swap_used >>= 10;
+
+#elif defined(__OpenBSD__)
+   static int mib[] = { CTL_HW, HW_PHYSMEM64 };
+   static int bcstats_mib[] = { CTL_VFS, VFS_GENERIC, VFS_BCACHESTAT };
+   struct bcachestats bcstats;
+   static int uvmexp_mib[] = { CTL_VM, VM_UVMEXP };
+   struct uvmexp uvmexp;
+   int nswap, rnswap;
+   struct swapent *swdev = NULL;
+
+   len = sizeof(memory->total);
+   if (sysctl(mib, 2, &memory->total, &len, NULL, 0) == -1)
+     return;
+
+   len = sizeof(uvmexp);
+   if (sysctl(uvmexp_mib, 2, &uvmexp, &len, NULL, 0) == -1)
+     return;
+
+   len = sizeof(bcstats);
+   if (sysctl(bcstats_mib, 3, &bcstats, &len, NULL, 0) == -1)
+     return;
+
+   /* Don't fail if there's not swap! */
+   nswap = swapctl(SWAP_NSWAP, 0, 0);
+   if (nswap == 0)
+     goto swap_out;
+
+   swdev = calloc(nswap, sizeof(*swdev));
+   if (swdev == NULL)
+     goto swap_out;
+
+   rnswap = swapctl(SWAP_STATS, swdev, nswap);
+   if (rnswap == -1)
+     goto swap_out;
+
+   for (i = 0; i < nswap; i++) {
+        if (swdev[i].se_flags & SWF_ENABLE)
+          {
+             memory->swap_used += (swdev[i].se_inuse / (1024 / DEV_BSIZE));
+             memory->swap_total += (swdev[i].se_nblks / (1024 / DEV_BSIZE));
+          }
+     }
+swap_out:
+   if (swdev)
+     free(swdev);
+
+   memory->total /= 1024;
+
+   memory->cached = (uvmexp.pagesize * bcstats.numbufpages);
+   _memsize_bytes_to_kb(&memory->cached);
+
+   memory->used = (uvmexp.active * uvmexp.pagesize);
+   _memsize_bytes_to_kb(&memory->used);
+
+   memory->buffered = (uvmexp.pagesize * (uvmexp.npages - uvmexp.free));
+   _memsize_bytes_to_kb(&memory->buffered);
+
+   memory->shared = (uvmexp.pagesize * uvmexp.wired);
+   _memsize_bytes_to_kb(&memory->shared);
+#elif defined(__MacOS__)
+   int mib[2] = { CTL_HW, HW_MEMSIZE };
+   size_t total;
+   vm_size_t page_size;
+   mach_port_t mach_port;
+   mach_msg_type_number_t count;
+   vm_statistics64_data_t vm_stats;
+   struct xsw_usage xsu;
+
+   size_t len = sizeof(size_t);
+   if (sysctl(mib, 2, &total, &len, NULL, 0) == -1)
+     return;
+   mach_port = mach_host_self();
+   count = sizeof(vm_stats) / sizeof(natural_t);
+
+   total >>= 10;
+   memory->total = total;
+
+   if (host_page_size(mach_port, &page_size) == KERN_SUCCESS &&
+       host_statistics64(mach_port, HOST_VM_INFO, (host_info64_t)&vm_stats, &count) == KERN_SUCCESS)
+     {
+        memory->used = vm_stats.active_count + vm_stats.inactive_count + vm_stats.wire_count * page_size;
+        memory->used >>= 10;
+        memory->cached = vm_stats.active_count * page_size;
+        memory->cached >>= 10;
+        memory->shared = vm_stats.wire_count * page_size;
+        memory->shared >>= 10;
+        memory->buffered = vm_stats.inactive_count * page_size;
+        memory->buffered >>= 10;
+     }
+
+   total = sizeof(xsu);
+   if (sysctlbyname("vm.swapusage", &xsu, &total, NULL, 0) != -1)
+     {
+        memory->swap_total = xsu.xsu_total;
+        memory->swap_used = xsu.xsu_used;
+     }
+#endif
+}
+
+#if defined(__linux__)
+static int
+_numa_node_cmp(const void *a, const void *b)
+{
+   return ((const numa_node_t *) a)->id - ((const numa_node_t *) b)->id;
+}
+
+/* Parse a cpulist such as "0-3,8-11". */
+static int
+_numa_cpulist_parse(const char *list, int **cpus)
+{
+   const char *p = list;
+   char *end;
+   int *tmp, count = 0, first, last;
+
+   *cpus = NULL;
+
+   while (*p >= '0' && *p <= '9')
+     {
+        first = last = strtol(p, &end, 10);
+        p = end;
+        if (*p == '-')
+          {
+             last = strtol(p + 1, &end, 10);
+             p = end;
+          }
+        if (last < first) break;
+
+        tmp = realloc(*cpus, (count + last - first + 1) * sizeof(int));
+        if (!tmp) break;
+        *cpus = tmp;
+        while (first <= last)
+          (*cpus)[count++] = first++;
+
+        if (*p == ',') p++;
+     }
+
+   return count;
+}
+
+#endif
+
+static void
+_numa_init(results_t *results)
+{
+#if defined(__linux__)
+   numa_t *numa = &results->numa;
+   numa_node_t *nodes;
+   struct dirent *dh;
+   DIR *dir;
+   char path[PATH_MAX], *buf;
+
+   dir = opendir("/sys/devices/system/node");
+   if (!dir) return;
+
+   while ((dh = readdir(dir)) != NULL)
+     {
+        if (strncmp(dh->d_name, "node", 4) || !isdigit(dh->d_name[4]))
+          continue;
+
+        nodes = realloc(numa->nodes, (numa->node_count + 1) * sizeof(numa_node_t));
+        if (!nodes) break;
+        numa->nodes = nodes;
+
+        numa_node_t *node = &numa->nodes[numa->node_count++];
+        memset(node, 0, sizeof(numa_node_t));
+        node->id = atoi(dh->d_name + 4);
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", dh->d_name);
+        buf = Fcontents(path);
+        if (buf)
+          {
+             node->cpu_count = _numa_cpulist_parse(buf, &node->cpus);
+             free(buf);
+          }
+     }
+
+   closedir(dir);
+
+   qsort(numa->nodes, numa->node_count, sizeof(numa_node_t), _numa_node_cmp);
+#else
+   (void) results;
+#endif
+}
+
+static void
+_numa_state_get(results_t *results)
+{
+#if defined(__linux__)
+   numa_t *numa = &results->numa;
+   numa_node_t *node;
+   char path[PATH_MAX], *end;
+   const char *line, *next, *colon;
+   unsigned long free_kb, file_kb, slab_kb;
+   uint64_t value;
+   uint64_t now;
+   double elapsed = 0;
+   ssize_t len;
+   int i;
+
+   now = _stamp_now();
+   if (numa->stamp)
+     elapsed = _stamp_elapsed(numa->stamp, now);
+   numa->stamp = now;
+
+   for (i = 0; i < numa->node_count; i++)
+     {
+        node = &numa->nodes[i];
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/meminfo", node->id);
+        len = Fcontents_buf(path, &numa->buf, &numa->buf_size);
+        if (len != -1)
+          {
+             free_kb = file_kb = slab_kb = 0;
+             end = numa->buf + len;
+             for (line = numa->buf; line < end; line = next)
+               {
+                  next = strchr(line, '\n');
+                  next = next ? next + 1 : end;
+
+                  /* "Node 0 MemTotal:     16384 kB" */
+                  colon = memchr(line, ':', next - line);
+                  if (!colon || !fields_parse(colon + 1, end, &value, 1, &next))
+                    continue;
+
+                  if (!strncmp(colon - 9, " MemTotal", 9))
+                    node->mem_total = value;
+                  else if (!strncmp(colon - 8, " MemFree", 8))
+                    free_kb = value;
+                  else if (!strncmp(colon - 10, " FilePages", 10))
+                    file_kb = value;
+                  else if (!strncmp(colon - 5, " Slab", 5))
+                    slab_kb = value;
+               }
+             node->mem_free = free_kb;
+             node->mem_used = node->mem_total - free_kb - file_kb - slab_kb;
+          }
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/numastat", node->id);
+        len = Fcontents_buf(path, &numa->buf, &numa->buf_size);
+        if (len != -1)
+          {
+             unsigned long hit = node->numa_hit, miss = node->numa_miss, foreign = node->numa_foreign;
+
+             end = numa->buf + len;
+             for (line = numa->buf; line < end; line = next)
+               {
+                  if (!fields_parse(line, end, &value, 1, &next))
+                    continue;
+                  if (!strncmp(line, "numa_hit ", 9))
+                    node->numa_hit = value;
+                  else if (!strncmp(line, "numa_miss ", 10))
+                    node->numa_miss = value;
+                  else if (!strncmp(line, "numa_foreign ", 13))
+                    node->numa_foreign = value;
+               }
+
+             if (elapsed > 0)
+               {
+                  node->hit = (node->numa_hit - hit) / elapsed;
+                  node->miss = (node->numa_miss - miss) / elapsed;
+                  node->foreign = (node->numa_foreign - foreign) / elapsed;
+               }
+          }
+     }
+#else
+   (void) results;
+#endif
+}
+
+static void
+_numa_shutdown(results_t *results)
+{
+   numa_t *numa = &results->numa;
+   int i;
+
+   for (i = 0; i < numa->node_count; i++)
+     free(numa->nodes[i].cpus);
+   free(numa->nodes);
+   free(numa->buf);
+
+   memset(numa, 0, sizeof(numa_t));
+}
+
+static void
+_cpufreq_init(results_t *results)
+{
+   cpufreq_t *cpufreq = &results->cpufreq;
+   cpu_freq_t *core;
+   int i, ncpu = cpu_count();
+
+   cpufreq->cores = calloc(ncpu, sizeof(cpu_freq_t));
+   if (!cpufreq->cores) return;
+   cpufreq->count = ncpu;
+   cpufreq->packages = 1;
+
+   for (i = 0; i < ncpu; i++)
+     {
+        core = &cpufreq->cores[i];
+#if defined(__linux__)
+        char path[PATH_MAX];
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", i);
+        core->cur_file = reader_open(results->reader, path, 32);
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_min_freq", i);
+        core->min = _file_read_long(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_max_freq", i);
+        core->max = _file_read_long(path, 0);
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+        core->package = _file_read_long(path, 0);
+        if (core->package < 0) core->package = 0;
+        if (core->package >= cpufreq->packages)
+          cpufreq->packages = core->package + 1;
+#endif
+     }
+}
+
+#if defined(__linux__)
+/* Without cpufreq (most virtual machines) fall back to the "cpu MHz"
+ * lines of /proc/cpuinfo, which are read in one go. */
+static void
+_cpufreq_cpuinfo_get(cpufreq_t *cpufreq)
+{
+   const char *line, *next, *colon;
+   char *end;
+   uint64_t value;
+   ssize_t len;
+   int i = 0;
+
+   len = Fcontents_buf("/proc/cpuinfo", &cpufreq->buf, &cpufreq->buf_size);
+   if (len == -1) return;
+
+   end = cpufreq->buf + len;
+   for (line = cpufreq->buf; line < end && i < cpufreq->count; line = next)
+     {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : end;
+        if (strncmp(line, "cpu MHz", 7)) continue;
+
+        colon = memchr(line, ':', next - line);
+        if (colon && fields_parse(colon + 1, end, &value, 1, &next))
+          cpufreq->cores[i++].cur = value * 1000;
+     }
+}
+
+#endif
+
+static void
+_cpufreq_state_get(results_t *results)
+{
+   cpufreq_t *cpufreq = &results->cpufreq;
+   int i;
+#if defined(__linux__)
+   long value;
+
+   if (cpufreq->count && !cpufreq->cores[0].cur_file)
+     {
+        _cpufreq_cpuinfo_get(cpufreq);
+        return;
+     }
+
+   for (i = 0; i < cpufreq->count; i++)
+     {
+        if (reader_long(cpufreq->cores[i].cur_file, &value))
+          cpufreq->cores[i].cur = value;
+     }
+#elif defined(__FreeBSD__) || defined(__DragonFly__)
+   char name[64];
+   int value;
+   size_t len;
+
+   for (i = 0; i < cpufreq->count; i++)
+     {
+        snprintf(name, sizeof(name), "dev.cpu.%d.freq", i);
+        len = sizeof(value);
+        if (sysctlbyname(name, &value, &len, NULL, 0) != -1)
+          cpufreq->cores[i].cur = value * 1000UL;
+     }
+#elif defined(__OpenBSD__)
+   int mib[2] = { CTL_HW, HW_CPUSPEED }, value;
+   size_t len = sizeof(value);
+
+   if (sysctl(mib, 2, &value, &len, NULL, 0) != -1)
+     {
+        for (i = 0; i < cpufreq->count; i++)
+          cpufreq->cores[i].cur = value * 1000UL;
+     }
+#else
+   (void) i;
+#endif
+}
+
+static void
+_cpufreq_shutdown(results_t *results)
+{
+   cpufreq_t *cpufreq = &results->cpufreq;
+#if defined(__linux__)
+   int i;
+
+   for (i = 0; i < cpufreq->count; i++)
+     reader_close(results->reader, cpufreq->cores[i].cur_file);
+#endif
+   free(cpufreq->cores);
+   free(cpufreq->buf);
+
+   memset(cpufreq, 0, sizeof(cpufreq_t));
+}
+
+#define IRQS_THRESHOLD_DEFAULT 90
+#define IRQS_FLAG_MIN_RATE     100
+
+#if !defined(NO_IRQS)
+static irq_type_t *
+_irqs_type_add(irqs_t *irqs, const char *name, size_t len)
+{
+   irq_type_t *types, *type;
+
+   types = realloc(irqs->types, (irqs->type_count + 1) * sizeof(irq_type_t));
+   if (!types) return NULL;
+   irqs->types = types;
+
+   type = &irqs->types[irqs->type_count];
+   memset(type, 0, sizeof(irq_type_t));
+   if (len >= sizeof(type->name)) len = sizeof(type->name) - 1;
+   memcpy(type->name, name, len);
+
+   type->prev = calloc(irqs->columns, sizeof(uint64_t));
+   type->rates = calloc(irqs->columns, sizeof(unsigned long));
+   if (!type->prev || !type->rates)
+     {
+        free(type->prev);
+        free(type->rates);
+        return NULL;
+     }
+
+   irqs->type_count++;
+
+   return type;
+}
+
+static void
+_irqs_type_update(irqs_t *irqs, irq_type_t *type, uint64_t *values, int count, double elapsed)
+{
+   unsigned long max = 0;
+   int i;
+
+   type->total = 0;
+   type->busiest = 0;
+
+   for (i = 0; i < count && i < irqs->columns; i++)
+     {
+        if (elapsed > 0)
+          type->rates[i] = values[i] >= type->prev[i] ? (values[i] - type->prev[i]) / elapsed : 0;
+        type->prev[i] = values[i];
+        type->total += type->rates[i];
+        if (type->rates[i] > max)
+          {
+             max = type->rates[i];
+             type->busiest = i;
+          }
+     }
+
+   type->share = type->total ? (max * 100) / type->total : 0;
+
+   /* One CPU taking more than threshold percent of a busy type. */
+   type->imbalanced = irqs->columns > 1 && type->total >= IRQS_FLAG_MIN_RATE &&
+                      type->share > irqs->threshold;
+}
+
+static void
+_irqs_init(results_t *results)
+{
+#if defined(__linux__)
+   irqs_t *irqs = &results->irqs;
+   const char *next;
+   char *end;
+   uint64_t *ids;
+   ssize_t len;
+   int i;
+
+   if (!irqs->threshold)
+     irqs->threshold = IRQS_THRESHOLD_DEFAULT;
+
+   len = Fcontents_buf("/proc/softirqs", &irqs->buf, &irqs->buf_size);
+   if (len == -1) return;
+   end = irqs->buf + len;
+
+   /* The header names the online CPUs: "CPU0 CPU1 CPU4 ..." */
+   ids = malloc(len * sizeof(uint64_t));
+   if (!ids) return;
+   irqs->columns = fields_parse(irqs->buf, end, ids, len, &next);
+   irqs->cpus = malloc(irqs->columns * sizeof(int));
+   irqs->row = malloc(irqs->columns * sizeof(uint64_t));
+   irqs->sum = malloc(irqs->columns * sizeof(uint64_t));
+   if (!irqs->cpus || !irqs->row || !irqs->sum)
+     irqs->columns = 0;
+   for (i = 0; i < irqs->columns; i++)
+     irqs->cpus[i] = ids[i];
+   free(ids);
+
+   irqs->softirqs = reader_open(results->reader, "/proc/softirqs", 4096);
+   irqs->interrupts = reader_open(results->reader, "/proc/interrupts", 8192);
+#else
+   (void) results;
+#endif
+}
+
+#if defined(__linux__)
+/* Walk the rows of /proc/softirqs or /proc/interrupts, reading each
+ * row's per-CPU counters straight out of the file buffer. Softirq rows
+ * update their type, interrupt rows are summed per CPU. */
+static void
+_irqs_rows_walk(irqs_t *irqs, const reader_file_t *file, double elapsed, bool softirqs)
+{
+   const char *line, *next, *colon, *name;
+   irq_type_t *type;
+   char *buf, *end;
+   ssize_t len;
+   int i, count, row = 0;
+
+   len = reader_contents(file, &buf);
+   if (len == -1) return;
+   end = buf + len;
+
+   if (!softirqs)
+     memset(irqs->sum, 0, irqs->columns * sizeof(uint64_t));
+
+   next = strchr(buf, '\n');
+   for (line = next ? next + 1 : end; line < end; line = next)
+     {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : end;
+
+        colon = memchr(line, ':', next - line);
+        if (!colon) continue;
+
+        count = fields_parse(colon + 1, end, irqs->row, irqs->columns, &next);
+
+        if (!softirqs)
+          {
+             /* ERR:, MIS: and the like hold one system-wide count. */
+             if (count < irqs->columns) continue;
+             for (i = 0; i < count; i++)
+               irqs->sum[i] += irqs->row[i];
+             continue;
+          }
+
+        for (name = line; *name == ' '; name++);
+
+        /* Rows keep their order, so look at the expected one first. */
+        type = NULL;
+        if (row < irqs->type_count && !strncmp(irqs->types[row].name, name, colon - name) &&
+            irqs->types[row].name[colon - name] == '\0')
+          type = &irqs->types[row];
+        for (i = 0; !type && i < irqs->type_count; i++)
+          {
+             if (!strncmp(irqs->types[i].name, name, colon - name) && irqs->types[i].name[colon - name] == '\0')
+               type = &irqs->types[i];
+          }
+        if (!type && !(type = _irqs_type_add(irqs, name, colon - name)))
+          continue;
+
+        _irqs_type_update(irqs, type, irqs->row, count, elapsed);
+        row++;
+     }
+}
+
+#endif
+
+static void
+_irqs_state_get(results_t *results)
+{
+#if defined(__linux__)
+   irqs_t *irqs = &results->irqs;
+   irq_type_t *type;
+   uint64_t now;
+   double elapsed = 0;
+   int i;
+
+   if (!irqs->columns) return;
+
+   now = _stamp_now();
+   if (irqs->stamp)
+     elapsed = _stamp_elapsed(irqs->stamp, now);
+   irqs->stamp = now;
+
+   _irqs_rows_walk(irqs, irqs->softirqs, elapsed, true);
+   _irqs_rows_walk(irqs, irqs->interrupts, elapsed, false);
+
+   for (i = 0; i < irqs->type_count; i++)
+     {
+        if (!strcmp(irqs->types[i].name, "IRQ"))
+          break;
+     }
+   type = i < irqs->type_count ? &irqs->types[i] : _irqs_type_add(irqs, "IRQ", 3);
+   if (type)
+     _irqs_type_update(irqs, type, irqs->sum, irqs->columns, elapsed);
+#else
+   (void) results;
+#endif
+}
+
+static void
+_irqs_shutdown(results_t *results)
+{
+   irqs_t *irqs = &results->irqs;
+   int i, threshold = irqs->threshold;
+
+   for (i = 0; i < irqs->type_count; i++)
+     {
+        free(irqs->types[i].prev);
+        free(irqs->types[i].rates);
+     }
+   free(irqs->types);
+   free(irqs->cpus);
+   free(irqs->row);
+   free(irqs->sum);
+   free(irqs->buf);
+#if defined(__linux__)
+   reader_close(results->reader, irqs->softirqs);
+   reader_close(results->reader, irqs->interrupts);
+#endif
+
+   memset(irqs, 0, sizeof(irqs_t));
+   irqs->threshold = threshold;
+}
+
+#endif
+
+const netstat_counter_t tingle_netstat_counters[NETSTAT_COUNTERS] = {
+   [NETSTAT_TCP_ACTIVE_OPENS]     = { "Tcp",    "ActiveOpens",     false },
+   [NETSTAT_TCP_PASSIVE_OPENS]    = { "Tcp",    "PassiveOpens",    false },
+   [NETSTAT_TCP_ATTEMPT_FAILS]    = { "Tcp",    "AttemptFails",    false },
+   [NETSTAT_TCP_ESTAB_RESETS]     = { "Tcp",    "EstabResets",     false },
+   [NETSTAT_TCP_CURR_ESTAB]       = { "Tcp",    "CurrEstab",       true  },
+   [NETSTAT_TCP_IN_SEGS]          = { "Tcp",    "InSegs",          false },
+   [NETSTAT_TCP_OUT_SEGS]         = { "Tcp",    "OutSegs",         false },
+   [NETSTAT_TCP_RETRANS_SEGS]     = { "Tcp",    "RetransSegs",     false },
+   [NETSTAT_TCP_IN_ERRS]          = { "Tcp",    "InErrs",          false },
+   [NETSTAT_TCP_OUT_RSTS]         = { "Tcp",    "OutRsts",         false },
+   [NETSTAT_TCP_LISTEN_OVERFLOWS] = { "TcpExt", "ListenOverflows", false },
+   [NETSTAT_TCP_LISTEN_DROPS]     = { "TcpExt", "ListenDrops",     false },
+   [NETSTAT_TCP_TIMEOUTS]         = { "TcpExt", "TCPTimeouts",     false },
+   [NETSTAT_TCP_BACKLOG_DROP]     = { "TcpExt", "TCPBacklogDrop",  false },
+   [NETSTAT_UDP_IN_DATAGRAMS]     = { "Udp",    "InDatagrams",     false },
+   [NETSTAT_UDP_OUT_DATAGRAMS]    = { "Udp",    "OutDatagrams",    false },
+   [NETSTAT_UDP_NO_PORTS]         = { "Udp",    "NoPorts",         false },
+   [NETSTAT_UDP_IN_ERRORS]        = { "Udp",    "InErrors",        false },
+   [NETSTAT_UDP_RCVBUF_ERRORS]    = { "Udp",    "RcvbufErrors",    false },
+   [NETSTAT_UDP_SNDBUF_ERRORS]    = { "Udp",    "SndbufErrors",    false },
+};
+
+#if !defined(NO_NETSTAT)
+#if defined(__linux__)
+static const char *netstat_files[] = { "/proc/net/snmp", "/proc/net/netstat" };
+
+/* Sections come in pairs of lines, "Section: Name Name ..." then
+ * "Section: value value ...". Which sections are present varies
+ * (IcmpMsg: appears once ICMP has been seen), so pairs are matched by
+ * section name, never by position. */
+static bool
+_netstat_section(int counter, const char *line, size_t len)
+{
+   const char *section = tingle_netstat_counters[counter].section;
+
+   return strlen(section) == len && !strncmp(section, line, len);
+}
+
+/* Find the column of every counter of one file from its headers. */
+static void
+_netstat_index_build(netstat_t *netstat, int file)
+{
+   const char *line, *next, *colon, *p, *word;
+   char *end;
+   size_t section_len, len;
+   ssize_t bytes;
+   int i, column;
+
+   bytes = Fcontents_buf(netstat_files[file], &netstat->buf, &netstat->buf_size);
+   if (bytes == -1) return;
+   end = netstat->buf + bytes;
+
+   for (line = netstat->buf; line < end; line = next)
+     {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : end;
+
+        colon = memchr(line, ':', next - line);
+        if (!colon) continue;
+        section_len = colon - line;
+
+        /* A header is followed by the values of its section. */
+        if (next >= end || strncmp(next, line, section_len + 1)) continue;
+
+        for (p = colon + 1, column = 0; p < next; column++)
+          {
+             while (p < next && isspace(*p)) p++;
+             if (p >= next) break;
+             for (word = p; p < next && !isspace(*p); p++);
+             len = p - word;
+
+             for (i = 0; i < NETSTAT_COUNTERS; i++)
+               {
+                  if (!_netstat_section(i, line, section_len) ||
+                      strlen(tingle_netstat_counters[i].name) != len ||
+                      strncmp(tingle_netstat_counters[i].name, word, len))
+                    continue;
+
+                  netstat->index[i].file = file;
+                  netstat->index[i].column = column;
+                  if (column >= netstat->row_size)
+                    netstat->row_size = column + 1;
+               }
+          }
+
+        next = strchr(next, '\n');
+        next = next ? next + 1 : end;
+     }
+}
+
+static void
+_netstat_values_get(netstat_t *netstat, int file)
+{
+   const char *line, *next, *colon;
+   char *buf, *end;
+   size_t section_len;
+   ssize_t bytes;
+   int i, count;
+   bool wanted;
+
+   bytes = reader_contents(netstat->files[file], &buf);
+   if (bytes == -1) return;
+   end = buf + bytes;
+
+   for (line = buf; line < end; line = next)
+     {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : end;
+
+        colon = memchr(line, ':', next - line);
+        if (!colon) continue;
+        section_len = colon - line;
+
+        /* Skip the header to the values line of the same section. */
+        if (next >= end || strncmp(next, line, section_len + 1)) continue;
+        line = next;
+        colon = line + section_len;
+        next = strchr(line, '\n');
+        next = next ? next + 1 : end;
+
+        wanted = false;
+        for (i = 0; i < NETSTAT_COUNTERS && !wanted; i++)
+          wanted = netstat->index[i].file == file && _netstat_section(i, line, section_len);
+        if (!wanted) continue;
+
+        count = fields_parse(colon + 1, end, netstat->row, netstat->row_size, &next);
+        for (i = 0; i < NETSTAT_COUNTERS; i++)
+          {
+             if (netstat->index[i].file == file && _netstat_section(i, line, section_len) &&
+                 netstat->index[i].column < count)
+               netstat->values[i] = netstat->row[netstat->index[i].column];
+          }
+     }
+}
+
+static void
+_netstat_sockstat_get(netstat_t *netstat)
+{
+   const char *line, *next, *colon;
+   char *buf, *end;
+   uint64_t values[4];
+   ssize_t bytes;
+   int count;
+
+   bytes = reader_contents(netstat->sockstat, &buf);
+   if (bytes == -1) return;
+   end = buf + bytes;
+
+   for (line = buf; line < end; line = next)
+     {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : end;
+
+        colon = memchr(line, ':', next - line);
+        if (!colon) continue;
+
+        /* "TCP: inuse 4 orphan 0 tw 0 alloc 4 mem 0" */
+        count = fields_parse(colon + 1, end, values, 4, &next);
+        if (!strncmp(line, "sockets:", 8) && count >= 1)
+          netstat->sockets = values[0];
+        else if (!strncmp(line, "TCP:", 4) && count == 4)
+          {
+             netstat->tcp_inuse = values[0];
+             netstat->tcp_orphan = values[1];
+             netstat->tcp_tw = values[2];
+             netstat->tcp_alloc = values[3];
+          }
+        else if (!strncmp(line, "UDP:", 4) && count >= 1)
+          netstat->udp_inuse = values[0];
+     }
+}
+
+#endif
+
+static void
+_netstat_init(results_t *results)
+{
+   netstat_t *netstat = &results->netstat;
+   int i;
+
+   for (i = 0; i < NETSTAT_COUNTERS; i++)
+     netstat->index[i].file = -1;
+#if defined(__linux__)
+   _netstat_index_build(netstat, 0);
+   _netstat_index_build(netstat, 1);
+
+   netstat->files[0] = reader_open(results->reader, netstat_files[0], 4096);
+   netstat->files[1] = reader_open(results->reader, netstat_files[1], 8192);
+   netstat->sockstat = reader_open(results->reader, "/proc/net/sockstat", 512);
+
+   netstat->row = calloc(netstat->row_size ? netstat->row_size : 1, sizeof(uint64_t));
+#endif
+}
+
+static void
+_netstat_state_get(results_t *results)
+{
+#if defined(__linux__)
+   netstat_t *netstat = &results->netstat;
+   uint64_t prev[NETSTAT_COUNTERS];
+   uint64_t now;
+   double elapsed = 0;
+   int i;
+
+   if (!netstat->row) return;
+
+   now = _stamp_now();
+   if (netstat->stamp)
+     elapsed = _stamp_elapsed(netstat->stamp, now);
+   netstat->stamp = now;
+
+   memcpy(prev, netstat->values, sizeof(prev));
+
+   _netstat_values_get(netstat, 0);
+   _netstat_values_get(netstat, 1);
+   _netstat_sockstat_get(netstat);
+
+   for (i = 0; elapsed > 0 && i < NETSTAT_COUNTERS; i++)
+     {
+        if (tingle_netstat_counters[i].gauge)
+          netstat->rates[i] = netstat->values[i];
+        else
+          netstat->rates[i] = netstat->values[i] >= prev[i] ? (netstat->values[i] - prev[i]) / elapsed : 0;
+     }
+#else
+   (void) results;
+#endif
+}
+
+static void
+_netstat_shutdown(results_t *results)
+{
+   netstat_t *netstat = &results->netstat;
+
+   free(netstat->row);
+   free(netstat->buf);
+#if defined(__linux__)
+   reader_close(results->reader, netstat->files[0]);
+   reader_close(results->reader, netstat->files[1]);
+   reader_close(results->reader, netstat->sockstat);
+#endif
+
+   memset(netstat, 0, sizeof(netstat_t));
+}
+
+#endif
+
+#if defined(__linux__)
+static int
+_proc_open(pid_t pid, const char *name)
+{
+   char path[PATH_MAX];
+
+   snprintf(path, sizeof(path), "/proc/%d/%s", (int) pid, name);
+
+   return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static void
+_proc_close(proc_t *proc)
+{
+   if (proc->pidfd != -1) close(proc->pidfd);
+   if (proc->stat_fd != -1) close(proc->stat_fd);
+   if (proc->status_fd != -1) close(proc->status_fd);
+   if (proc->smaps_fd != -1) close(proc->smaps_fd);
+   if (proc->io_fd != -1) close(proc->io_fd);
+
+   proc->pidfd = proc->stat_fd = proc->status_fd = proc->smaps_fd = proc->io_fd = -1;
+   proc->alive = false;
+}
+
+static bool
+_proc_exited(proc_t *proc)
+{
+   struct pollfd pfd;
+
+   if (proc->pidfd == -1)
+     return false;
+
+   /* A pidfd becomes readable once the process has exited. */
+   pfd.fd = proc->pidfd;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   return poll(&pfd, 1, 0) == 1;
+}
+
+/* Value of a "Name:   1234 kB" line. */
+static bool
+_proc_status_value(const char *line, const char *name, size_t len, const char *end,
+                   uint64_t *value, const char **next)
+{
+   if (strncmp(line, name, len))
+     return false;
+
+   return fields_parse(line + len, end, value, 1, next) == 1;
+}
+
+static void
+_proc_state_get(procs_t *procs, proc_t *proc, double elapsed)
+{
+   char buf[4096];
+   const char *line, *next, *p;
+   unsigned long ticks;
+   uint64_t fields[17], value, voluntary = 0, involuntary = 0;
+   uint64_t read_bytes = 0, write_bytes = 0;
+   ssize_t len;
+
+   if (!proc->alive) return;
+
+   if (_proc_exited(proc) || (len = _fd_contents(proc->stat_fd, buf, sizeof(buf))) <= 0)
+     {
+        _proc_close(proc);
+        return;
+     }
+
+   /* "pid (comm) S ppid ...": comm may hold spaces and parentheses, and
+    * every field after the state is a single number. */
+   p = strrchr(buf, ')');
+   if (!p || fields_parse(p + 2, buf + len, fields, 17, &next) != 17)
+     return;
+
+   ticks = fields[10] + fields[11];
+   proc->threads = fields[16];
+   if (elapsed > 0)
+     proc->percent = ((ticks - proc->ticks) * 100.0) / (elapsed * procs->hz);
+   proc->ticks = ticks;
+
+   len = _fd_contents(proc->status_fd, buf, sizeof(buf));
+   for (line = buf; len > 0 && line < buf + len; line = next)
+     {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : buf + len;
+
+        if (_proc_status_value(line, "VmRSS:", 6, buf + len, &value, &next))
+          proc->rss = value;
+        else if (_proc_status_value(line, "voluntary_ctxt_switches:", 24, buf + len, &value, &next))
+          voluntary = value;
+        else if (_proc_status_value(line, "nonvoluntary_ctxt_switches:", 27, buf + len, &value, &next))
+          involuntary = value;
+     }
+
+   len = _fd_contents(proc->smaps_fd, buf, sizeof(buf));
+   for (line = buf; len > 0 && line < buf + len; line = next)
+     {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : buf + len;
+
+        if (_proc_status_value(line, "Pss:", 4, buf + len, &value, &next))
+          {
+             proc->pss = value;
+             break;
+          }
+     }
+
+   len = _fd_contents(proc->io_fd, buf, sizeof(buf));
+   for (line = buf; len > 0 && line < buf + len; line = next)
+     {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : buf + len;
+
+        if (_proc_status_value(line, "read_bytes:", 11, buf + len, &value, &next))
+          read_bytes = value;
+        else if (_proc_status_value(line, "write_bytes:", 12, buf + len, &value, &next))
+          write_bytes = value;
+     }
+
+   if (elapsed > 0)
+     {
+        proc->voluntary_rate = voluntary >= proc->voluntary ? (voluntary - proc->voluntary) / elapsed : 0;
+        proc->involuntary_rate = involuntary >= proc->involuntary ? (involuntary - proc->involuntary) / elapsed : 0;
+        proc->read_rate = read_bytes >= proc->read_bytes ? (read_bytes - proc->read_bytes) / elapsed : 0;
+        proc->write_rate = write_bytes >= proc->write_bytes ? (write_bytes - proc->write_bytes) / elapsed : 0;
+     }
+   proc->voluntary = voluntary;
+   proc->involuntary = involuntary;
+   proc->read_bytes = read_bytes;
+   proc->write_bytes = write_bytes;
+}
+
+#endif
+
+static void
+_procs_init(results_t *results)
+{
+#if defined(__linux__)
+   procs_t *procs = &results->procs;
+   proc_t *proc, *tmp;
+   const char *p;
+   char *end;
+   long pid;
+   int fd;
+   ssize_t len;
+
+   procs->hz = sysconf(_SC_CLK_TCK);
+   if (procs->hz <= 0) procs->hz = 100;
+
+   for (p = procs->pids; p && *p; p = *end ? end + 1 : end)
+     {
+        pid = strtol(p, &end, 10);
+        if (end == p) break;
+        if (pid <= 0) continue;
+
+        tmp = realloc(procs->procs, (procs->count + 1) * sizeof(proc_t));
+        if (!tmp) break;
+        procs->procs = tmp;
+
+        proc = &procs->procs[procs->count++];
+        memset(proc, 0, sizeof(proc_t));
+        proc->pid = pid;
+# if defined(SYS_pidfd_open)
+        proc->pidfd = syscall(SYS_pidfd_open, proc->pid, 0);
+# else
+        proc->pidfd = -1;
+# endif
+        proc->stat_fd = _proc_open(proc->pid, "stat");
+        proc->status_fd = _proc_open(proc->pid, "status");
+        proc->smaps_fd = _proc_open(proc->pid, "smaps_rollup");
+        proc->io_fd = _proc_open(proc->pid, "io");
+        proc->alive = proc->stat_fd != -1;
+
+        fd = _proc_open(proc->pid, "comm");
+        if (fd != -1)
+          {
+             len = read(fd, proc->comm, sizeof(proc->comm) - 1);
+             if (len > 0)
+               proc->comm[strcspn(proc->comm, "\n")] = '\0';
+             close(fd);
+          }
+
+        if (!proc->alive)
+          _proc_close(proc);
+     }
+#else
+   (void) results;
+#endif
+}
+
+static void
+_procs_state_get(results_t *results)
+{
+#if defined(__linux__)
+   procs_t *procs = &results->procs;
+   uint64_t now;
+   double elapsed = 0;
+   int i;
+
+   now = _stamp_now();
+   if (procs->stamp)
+     elapsed = _stamp_elapsed(procs->stamp, now);
+   procs->stamp = now;
+
+   for (i = 0; i < procs->count; i++)
+     _proc_state_get(procs, &procs->procs[i], elapsed);
+#else
+   (void) results;
+#endif
+}
+
+static void
+_procs_shutdown(results_t *results)
+{
+   procs_t *procs = &results->procs;
+   const char *pids = procs->pids;
+#if defined(__linux__)
+   int i;
+
+   for (i = 0; i < procs->count; i++)
+     _proc_close(&procs->procs[i]);
+#endif
+   free(procs->procs);
+
+   memset(procs, 0, sizeof(procs_t));
+   procs->pids = pids;
+}
+
+/* Filters are comma separated glob patterns, those starting with !
+ * exclude, e.g. 'eth*,wl*,!veth*'. */
+static void
+_filter_compile(const char *filter, char ***patterns, int *count)
+{
+   char *copy, *pattern, *save = NULL;
+   char **tmp;
+
+   if (!filter) return;
+
+   copy = strdup(filter);
+   if (!copy) return;
+
+   for (pattern = strtok_r(copy, ",", &save); pattern; pattern = strtok_r(NULL, ",", &save))
+     {
+        tmp = realloc(*patterns, (*count + 1) * sizeof(char *));
+        if (!tmp) break;
+        *patterns = tmp;
+        (*patterns)[(*count)++] = strdup(pattern);
+     }
+
+   free(copy);
+}
+
+static bool
+_filter_match(char **patterns, int count, const char *name)
+{
+   bool include = true;
+   int i;
+
+   /* Any plain pattern makes the filter an allow list. */
+   for (i = 0; i < count; i++)
+     {
+        if (patterns[i][0] != '!')
+          {
+             include = false;
+             break;
+          }
+     }
+
+   for (i = 0; i < count; i++)
+     {
+        const char *pattern = patterns[i];
+
+        if (pattern[0] == '!')
+          {
+             if (!fnmatch(pattern + 1, name, 0))
+               return false;
+          }
+        else if (!fnmatch(pattern, name, 0))
+          include = true;
+     }
+
+   return include;
+}
+
+static void
+_filter_free(char **patterns, int count)
+{
+   int i;
+
+   for (i = 0; i < count; i++)
+     free(patterns[i]);
+   free(patterns);
+}
+
+/* Filesystems that can't fill up in a way worth reporting, or mirror
+ * another mount. statvfs() reporting no blocks catches the rest of the
+ * pseudo filesystems (proc, sysfs, cgroup and friends). */
+static const char *filesystems_pseudo[] = {
+   "tmpfs", "devtmpfs", "ramfs", "squashfs", "iso9660", "devfs", "fdescfs",
+   "procfs", "linprocfs", "linsysfs", "nullfs", "kernfs", "ptyfs", "autofs",
+};
+
+static bool
+_filesystems_pseudo(const char *type)
+{
+   size_t i;
+
+   for (i = 0; i < sizeof(filesystems_pseudo) / sizeof(filesystems_pseudo[0]); i++)
+     {
+        if (!strcmp(type, filesystems_pseudo[i]))
+          return true;
+     }
+
+   return false;
+}
+
+/* Bind mounts share a device with the mount they were taken from; the
+ * one that shows the whole filesystem wins. */
+static void
+_filesystems_add(filesystems_t *fs, const char *mount, const char *source,
+                 const char *type, uint64_t dev, bool bind)
+{
+   fs_mount_t *m = NULL, *tmp;
+   int i;
+
+   for (i = 0; dev && i < fs->count; i++)
+     {
+        if (fs->mounts[i].dev != dev) continue;
+        if (!fs->mounts[i].bind || bind) return;
+        m = &fs->mounts[i];
+        break;
+     }
+
+   if (!m)
+     {
+        if (fs->count == fs->size)
+          {
+             tmp = realloc(fs->mounts, (fs->size ? fs->size * 2 : 16) * sizeof(fs_mount_t));
+             if (!tmp) return;
+             fs->mounts = tmp;
+             fs->size = fs->size ? fs->size * 2 : 16;
+          }
+        m = &fs->mounts[fs->count++];
+     }
+
+   memset(m, 0, sizeof(fs_mount_t));
+   snprintf(m->mount, sizeof(m->mount), "%s", mount);
+   snprintf(m->source, sizeof(m->source), "%s", source);
+   snprintf(m->type, sizeof(m->type), "%s", type);
+   m->dev = dev;
+   m->bind = bind;
+}
+
+#if defined(__linux__)
+/* Spaces and the like are octal escaped in mountinfo. */
+static void
+_filesystems_unescape(char *s)
+{
+   char *w = s;
+
+   while (*s)
+     {
+        if (s[0] == '\\' && s[1] >= '0' && s[1] <= '3' && s[2] >= '0' && s[2] <= '7' &&
+            s[3] >= '0' && s[3] <= '7')
+          {
+             *w++ = ((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0');
+             s += 4;
+          }
+        else
+          *w++ = *s++;
+     }
+   *w = '\0';
+}
+
+/* id parent major:minor root mount options [optional...] - type source super */
+static void
+_filesystems_mounts_get(filesystems_t *fs)
+{
+   char *line, *next, *tok, *save, *tokens[32];
+   unsigned int major, minor;
+   int count, sep;
+
+   fs->count = 0;
+
+   if (Fcontents_buf("/proc/self/mountinfo", &fs->buf, &fs->buf_size) <= 0)
+     return;
+
+   for (line = fs->buf; line && *line; line = next)
+     {
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+
+        count = 0;
+        save = NULL;
+        for (tok = strtok_r(line, " ", &save); tok && count < 32; tok = strtok_r(NULL, " ", &save))
+          tokens[count++] = tok;
+
+        for (sep = 6; sep < count && strcmp(tokens[sep], "-"); sep++);
+        if (sep + 2 >= count) continue;
+        if (sscanf(tokens[2], "%u:%u", &major, &minor) != 2) continue;
+        if (_filesystems_pseudo(tokens[sep + 1])) continue;
+
+        _filesystems_unescape(tokens[4]);
+        if (!_filter_match(fs->patterns, fs->pattern_count, tokens[4])) continue;
+
+        _filesystems_add(fs, tokens[4], tokens[sep + 2], tokens[sep + 1],
+                         ((uint64_t) major << 32) | minor, strcmp(tokens[3], "/") != 0);
+     }
+}
+
+#elif defined(__FreeBSD__) || defined(__DragonFly__) || defined(__OpenBSD__) || defined(__NetBSD__) || defined(__MacOS__)
+static void
+_filesystems_mounts_get(filesystems_t *fs)
+{
+# if defined(__NetBSD__)
+   struct statvfs *list;
+# else
+   struct statfs *list;
+# endif
+   int i, count;
+
+   fs->count = 0;
+
+   /* Cached figures only, the mount list is all we want. */
+   count = getmntinfo(&list, MNT_NOWAIT);
+   for (i = 0; i < count; i++)
+     {
+        if (_filesystems_pseudo(list[i].f_fstypename)) continue;
+        if (!_filter_match(fs->patterns, fs->pattern_count, list[i].f_mntonname)) continue;
+        _filesystems_add(fs, list[i].f_mntonname, list[i].f_mntfromname,
+                         list[i].f_fstypename, 0, false);
+     }
+}
+#endif
+
+static void
+_filesystems_init(results_t *results)
+{
+   filesystems_t *fs = &results->filesystems;
+
+   _filter_compile(fs->filter, &fs->patterns, &fs->pattern_count);
+   fs->changed = true;
+#if defined(__linux__)
+   /* The kernel raises POLLPRI on an open mountinfo when the mount
+    * table changes. */
+   fs->fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+#else
+   fs->fd = -1;
+#endif
+}
+
+static void
+_filesystems_state_get(results_t *results)
+{
+   filesystems_t *fs = &results->filesystems;
+   fs_mount_t *m;
+   struct statvfs st;
+   struct pollfd pfd;
+   uint64_t size, used;
+   int i;
+
+   /* Without a descriptor to watch the table is read every time. */
+   pfd.fd = fs->fd;
+   pfd.events = POLLPRI;
+   pfd.revents = 0;
+   if (fs->fd == -1 || (poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLPRI | POLLERR))))
+     fs->changed = true;
+
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__DragonFly__) || defined(__OpenBSD__) || defined(__NetBSD__) || defined(__MacOS__)
+   if (fs->changed)
+     _filesystems_mounts_get(fs);
+#endif
+   fs->changed = false;
+
+   for (i = 0; i < fs->count; i++)
+     {
+        m = &fs->mounts[i];
+        m->valid = statvfs(m->mount, &st) == 0 && st.f_blocks;
+        if (!m->valid) continue;
+
+        size = st.f_frsize ? st.f_frsize : st.f_bsize;
+        m->total = st.f_blocks * size;
+        m->used = (st.f_blocks - st.f_bfree) * size;
+        m->avail = st.f_bavail * size;
+        m->inodes = st.f_files;
+        m->inodes_used = st.f_files - st.f_ffree;
+        m->inodes_free = st.f_favail;
+
+        /* Like df, against what unprivileged users can reach. */
+        used = m->used + m->avail;
+        m->percent = used ? (m->used * 100.0) / used : 0;
+        m->inodes_percent = m->inodes ? (m->inodes_used * 100.0) / m->inodes : 0;
+     }
+}
+
+static void
+_filesystems_shutdown(results_t *results)
+{
+   filesystems_t *fs = &results->filesystems;
+   const char *filter = fs->filter;
+
+   if (fs->fd != -1)
+     close(fs->fd);
+   _filter_free(fs->patterns, fs->pattern_count);
+   free(fs->mounts);
+   free(fs->buf);
+
+   memset(fs, 0, sizeof(filesystems_t));
+   fs->filter = filter;
+}
+
+#if !defined(NO_AUDIO)
+#if defined(__linux__) && defined(HAVE_ALSA)
+/* libasound is opened on the first mixer sample rather than linked, so
+ * only runs asking for -a pay for loading it and its dependencies. The
+ * handful of calls used are declared here against its stable ABI. */
+typedef struct snd_mixer snd_mixer_t;
+typedef struct snd_mixer_elem snd_mixer_elem_t;
+typedef struct snd_mixer_selem_id snd_mixer_selem_id_t;
+
+static struct
+{
+   void              *handle;
+   int              (*open)(snd_mixer_t **mixer, int mode);
+   int              (*attach)(snd_mixer_t *mixer, const char *name);
+   int              (*selem_register)(snd_mixer_t *mixer, void *options, void **classp);
+   int              (*load)(snd_mixer_t *mixer);
+   snd_mixer_elem_t *(*find_selem)(snd_mixer_t *mixer, const snd_mixer_selem_id_t *id);
+   int              (*volume_range)(snd_mixer_elem_t *elem, long *min, long *max);
+   int              (*volume)(snd_mixer_elem_t *elem, int channel, long *value);
+   int              (*close)(snd_mixer_t *mixer);
+   int              (*id_malloc)(snd_mixer_selem_id_t **id);
+   void             (*id_free)(snd_mixer_selem_id_t *id);
+   void             (*id_set_index)(snd_mixer_selem_id_t *id, unsigned int index);
+   void             (*id_set_name)(snd_mixer_selem_id_t *id, const char *name);
+} alsa;
+
+static pthread_once_t alsa_once = PTHREAD_ONCE_INIT;
+
+/* ISO C has no cast from dlsym's object pointer to a function pointer;
+ * POSIX guarantees they are the same size, so copy the bits. */
+#define ALSA_SYM(member, name) \
+   ((sym = dlsym(handle, name)) && memcpy(&alsa.member, &sym, sizeof(sym)))
+
+static void
+_alsa_load(void)
+{
+   void *handle, *sym;
+
+   handle = dlopen("libasound.so.2", RTLD_NOW | RTLD_LOCAL);
+   if (!handle) return;
+
+   if (!ALSA_SYM(open, "snd_mixer_open") ||
+       !ALSA_SYM(attach, "snd_mixer_attach") ||
+       !ALSA_SYM(selem_register, "snd_mixer_selem_register") ||
+       !ALSA_SYM(load, "snd_mixer_load") ||
+       !ALSA_SYM(find_selem, "snd_mixer_find_selem") ||
+       !ALSA_SYM(volume_range, "snd_mixer_selem_get_playback_volume_range") ||
+       !ALSA_SYM(volume, "snd_mixer_selem_get_playback_volume") ||
+       !ALSA_SYM(close, "snd_mixer_close") ||
+       !ALSA_SYM(id_malloc, "snd_mixer_selem_id_malloc") ||
+       !ALSA_SYM(id_free, "snd_mixer_selem_id_free") ||
+       !ALSA_SYM(id_set_index, "snd_mixer_selem_id_set_index") ||
+       !ALSA_SYM(id_set_name, "snd_mixer_selem_id_set_name"))
+     {
+        dlclose(handle);
+        return;
+     }
+
+   alsa.handle = handle;
+}
+#endif
+
+#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__linux__)
+static int
+_mixer_oss_volume_get(mixer_t *mixer)
+{
+   int bar;
+   int fd = open("/dev/mixer", O_RDONLY);
+   if (fd == -1)
+     return 0;
+
+   if ((ioctl(fd, MIXER_READ(0), &bar)) == -1)
+     {
+        close(fd);
+        return 0;
+     }
+
+   mixer->enabled = true;
+   mixer->volume_left = bar & 0x7f;
+   mixer->volume_right = (bar >> 8) & 0x7f;
+   close(fd);
+
+   return mixer->enabled;
+}
+#endif
+
+static int
+_mixer_master_volume_get(mixer_t *mixer)
+{
+#if defined(__OpenBSD__) || defined(__NetBSD__)
+   int i, fd, devn;
+   char name[64];
+   mixer_devinfo_t dinfo;
+   mixer_ctrl_t *values = NULL;
+   mixer_devinfo_t *info = NULL;
+
+   fd = open("/dev/mixer", O_RDONLY);
+   if (fd < 0)
+     return 0;
+
+   for (devn = 0;; devn++) {
+        dinfo.index = devn;
+        if (ioctl(fd, AUDIO_MIXER_DEVINFO, &dinfo))
+          break;
+     }
+
+   info = calloc(devn, sizeof(*info));
+   if (!info)
+     return 0;
+
+   for (i = 0; i < devn; i++) {
+        info[i].index = i;
+        if (ioctl(fd, AUDIO_MIXER_DEVINFO, &info[i]) == -1)
+          {
+             --devn;
+             --i;
+             mixer->enabled = true;
+             continue;
+          }
+     }
+
+   values = calloc(devn, sizeof(*values));
+   if (!values)
+     return 0;
+
+   for (i = 0; i < devn; i++) {
+        values[i].dev = i;
+        values[i].type = info[i].type;
+        if (info[i].type != AUDIO_MIXER_CLASS)
+          {
+             values[i].un.value.num_channels = 2;
+             if (ioctl(fd, AUDIO_MIXER_READ, &values[i]) == -1)
+               {
+                  values[i].un.value.num_channels = 1;
+                  if (ioctl(fd, AUDIO_MIXER_READ, &values[i])
+                      == -1)
+                    return 0;
+               }
+          }
+     }
+
+   for (i = 0; i < devn; i++) {
+        strlcpy(name, info[i].label.name, sizeof(name));
+        if (!strcmp("master", name))
+          {
+             mixer->volume_left = values[i].un.value.level[0];
+             mixer->volume_right = values[i].un.value.level[1];
+             mixer->enabled = true;
+             break;
+          }
+     }
+
+   close(fd);
+
+   if (values)
+     free(values);
+   if (info)
+     free(info);
+
+#elif defined(__FreeBSD__) || defined(__DragonFly__) || defined(__linux__) && !defined(HAVE_ALSA)
+   return _mixer_oss_volume_get(mixer);
+#elif defined(__linux__) && defined(HAVE_ALSA)
+   snd_mixer_t *h;
+   snd_mixer_elem_t *elem;
+   snd_mixer_selem_id_t *id;
+   long int value;
+   double volume;
+
+   /* Without libasound, OSS emulation may still be there. */
+   pthread_once(&alsa_once, _alsa_load);
+   if (!alsa.handle) return _mixer_oss_volume_get(mixer);
+
+   if ((alsa.id_malloc(&id)) < 0) return (0);
+   alsa.id_set_index(id, 0);
+   alsa.id_set_name(id, "Master");
+
+   if ((alsa.open(&h, 0)) < 0) goto out_id;
+   if ((alsa.attach(h, "default")) < 0) goto out;
+   if ((alsa.selem_register(h, NULL, NULL)) < 0) goto out;
+   if ((alsa.load(h)) < 0) goto out;
+
+   if (!(elem = alsa.find_selem(h, id))) goto out;
+
+   long int max, min;
+
+   alsa.volume_range(elem, &min, &max);
+   alsa.volume(elem, 0, &value);
+   double ratio = max - min / 100;
+   volume = value / ratio;
+
+   mixer->enabled = true;
+   mixer->volume_left = mixer->volume_right = volume * 100;
+out:
+   alsa.close(h);
+out_id:
+   alsa.id_free(id);
+#elif defined(__MacOS__)
+   AudioDeviceID id;
+   AudioObjectPropertyAddress prop;
+   float volume;
+   unsigned int id_size = sizeof(id);
+   unsigned int vol_size = sizeof(volume);
+
+   prop.mSelector = kAudioHardwarePropertyDefaultOutputDevice;
+   prop.mScope = kAudioObjectPropertyScopeGlobal;
+   prop.mElement = kAudioObjectPropertyElementMaster;
+
+   if (AudioObjectGetPropertyData(kAudioObjectSystemObject, &prop, 0, NULL, &id_size, &id))
+     return (0);
+
+   prop.mSelector = kAudioDevicePropertyVolumeScalar;
+   prop.mScope = kAudioDevicePropertyScopeOutput;
+   prop.mElement = 0;
+
+   if (AudioObjectGetPropertyData(id, &prop, 0, NULL, &vol_size, &volume))
+     return (0);
+
+   mixer->volume_left = mixer->volume_right = volume * 100;
+
+   mixer->enabled = true;
+#endif
+   return mixer->enabled;
+}
+
+#endif
+
+#if !defined(NO_THERMAL)
+static void
+_temperature_cpu_get(int *temperature, const reader_file_t *file)
+{
+#if !defined(__linux__)
+   (void) file;
+#endif
+#if defined(__OpenBSD__) || defined(__NetBSD__)
+   int mibs[5] = { CTL_HW, HW_SENSORS, 0, 0, 0 };
+   int devn, numt;
+   struct sensor snsr;
+   size_t slen = sizeof(struct sensor);
+   struct sensordev snsrdev;
+   size_t sdlen = sizeof(struct sensordev);
+
+   for (devn = 0;; devn++) {
+        mibs[2] = devn;
+
+        if (sysctl(mibs, 3, &snsrdev, &sdlen, NULL, 0) == -1)
+          {
+             if (errno == ENOENT)
+               break;
+             else
+               continue;
+          }
+        if (!strcmp("cpu0", snsrdev.xname))
+          break;
+        else if (!strcmp("km0", snsrdev.xname))
+          break;
+     }
+
+   for (numt = 0; numt < snsrdev.maxnumt[SENSOR_TEMP]; numt++) {
+        mibs[4] = numt;
+
+        if (sysctl(mibs, 5, &snsr, &slen, NULL, 0) == -1)
+          continue;
+
+        if (slen > 0 && (snsr.flags & SENSOR_FINVALID) == 0)
+          break;
+     }
+
+   if (sysctl(mibs, 5, &snsr, &slen, NULL, 0)
+       != -1)
+     {
+        *temperature = (snsr.value - 273150000) / 1000000.0;
+     }
+   else
+     *temperature = INVALID_TEMP;
+#elif defined(__FreeBSD__) || defined(__DragonFly__)
+   unsigned int value;
+   size_t len = sizeof(value);
+   if ((sysctlbyname
+          ("hw.acpi.thermal.tz0.temperature", &value, &len, NULL,
+          0)) != -1)
+     {
+        *temperature = (value - 2732) / 10;
+     }
+   else
+     *temperature = INVALID_TEMP;
+#elif defined(__linux__)
+   long value;
+
+   if (reader_long(file, &value))
+     *temperature = value / 1000;
+   else
+     *temperature = INVALID_TEMP;
+#elif defined(__MacOS__)
+   *temperature = INVALID_TEMP;
+#endif
+}
+
+#endif
+
+#if !defined(NO_POWER)
+static int
+_power_battery_count_get(power_t *power)
+{
+#if defined(__OpenBSD__) || defined(__NetBSD__)
+   struct sensordev snsrdev;
+   size_t sdlen = sizeof(struct sensordev);
+   int mib[5] = { CTL_HW, HW_SENSORS, 0, 0, 0 };
+   int i, devn;
+   for (devn = 0;; devn++) {
+        mib[2] = devn;
+        if (sysctl(mib, 3, &snsrdev, &sdlen, NULL, 0) == -1)
+          {
+             if (errno == ENXIO)
+               continue;
+             if (errno == ENOENT)
+               break;
+          }
+
+        for (i = 0; i < MAX_BATTERIES; i++) {
+             char buf[64];
+             snprintf(buf, sizeof(buf), "acpibat%d", i);
+             if (!strcmp(buf, snsrdev.xname))
+               {
+                  power->bat_mibs[power->battery_count] =
+                    malloc(sizeof(int) * 5);
+                  int *tmp = power->bat_mibs[power->battery_count++];
+                  tmp[0] = mib[0];
+                  tmp[1] = mib[1];
+                  tmp[2] = mib[2];
+               }
+          }
+
+        if (!strcmp("acpiac0", snsrdev.xname))
+          {
+             power->ac_mibs[0] = mib[0];
+             power->ac_mibs[1] = mib[1];
+             power->ac_mibs[2] = mib[2];
+          }
+     }
+#elif defined(__FreeBSD__) || defined(__DragonFly__)
+   size_t len;
+   if ((sysctlbyname("hw.acpi.battery.life", NULL, &len, NULL, 0)) != -1)
+     {
+        power->bat_mibs[power->battery_count] = malloc(sizeof(int) * 5);
+        sysctlnametomib("hw.acpi.battery.life",
+                        power->bat_mibs[power->battery_count], &len);
+        power->battery_count = 1;
+     }
+
+   if ((sysctlbyname("hw.acpi.acline", NULL, &len, NULL, 0)) != -1)
+     {
+        sysctlnametomib("hw.acpi.acline", power->ac_mibs, &len);
+     }
+#elif defined(__linux__)
+   struct dirent *dh;
+   DIR *dir;
+
+   dir = opendir("/sys/class/power_supply");
+   if (!dir) return 0;
+
+   while ((dh = readdir(dir)) != NULL)
+     {
+        if (dh->d_name[0] == '.') continue;
+        if (!strncmp(dh->d_name, "BAT", 3))
+          {
+             power->battery_names[power->battery_count++] = (char)dh->d_name[3];
+          }
+     }
+
+   closedir(dir);
+#endif
+
+   if (!power->battery_count) return 0;
+
+   power->arena = calloc(power->battery_count,
+                         2 * sizeof(double) + sizeof(char *) + 2 * sizeof(reader_file_t *) +
+                         sizeof(uint8_t));
+   if (!power->arena)
+     {
+        power->battery_count = 0;
+        return 0;
+     }
+
+   power->charge_full = power->arena;
+   power->charge_current = power->charge_full + power->battery_count;
+   power->naming = (const char **) (power->charge_current + power->battery_count);
+   power->files = (reader_file_t **) (power->naming + power->battery_count);
+   power->percent = (uint8_t *) (power->files + 2 * power->battery_count);
+
+#if defined(__linux__)
+   /* Batteries report either energy_* or capacity_* files. */
+   for (int i = 0; i < power->battery_count; i++)
+     {
+        char path[PATH_MAX];
+
+        snprintf(path, sizeof(path), "/sys/class/power_supply/BAT%c/energy_full", power->battery_names[i]);
+        if (!access(path, R_OK))
+          power->naming[i] = "energy";
+        else
+          {
+             snprintf(path, sizeof(path), "/sys/class/power_supply/BAT%c/capacity_full", power->battery_names[i]);
+             if (!access(path, R_OK))
+               power->naming[i] = "capacity";
+          }
+     }
+#endif
+
+   return power->battery_count;
+}
+
+static void
+_battery_state_get(power_t *power, int index)
+{
+   int *mib = power->bat_mibs[index];
+#if defined(__OpenBSD__) || defined(__NetBSD__)
+   double charge_full = 0;
+   double charge_current = 0;
+   size_t slen = sizeof(struct sensor);
+   struct sensor snsr;
+
+   mib[3] = 7;
+   mib[4] = 0;
+
+   if (sysctl(mib, 5, &snsr, &slen, NULL, 0) != -1)
+     charge_full = (double)snsr.value;
+
+   mib[3] = 7;
+   mib[4] = 3;
+
+   if (sysctl(mib, 5, &snsr, &slen, NULL, 0) != -1)
+     charge_current = (double)snsr.value;
+
+   /* ACPI bug workaround... */
+   if (charge_current == 0 || charge_full == 0)
+     {
+        mib[3] = 8;
+        mib[4] = 0;
+
+        if (sysctl(mib, 5, &snsr, &slen, NULL, 0) != -1)
+          charge_full = (double)snsr.value;
+
+        mib[3] = 8;
+        mib[4] = 3;
+
+        if (sysctl(mib, 5, &snsr, &slen, NULL, 0) != -1)
+          charge_current = (double)snsr.value;
+     }
+
+   power->charge_full[index] = charge_full;
+   power->charge_current[index] = charge_current;
+#elif defined(__FreeBSD__) || defined(__DragonFly__)
+   unsigned int value;
+   size_t len = sizeof(value);
+   if ((sysctl(mib, 4, &value, &len, NULL, 0)) != -1)
+     power->percent[index] = value;
+#elif defined(__linux__)
+   long charge_full = 0;
+   long charge_current = 0;
+
+   (void) mib;
+
+   if (!power->naming[index]) return;
+
+   reader_long(power->files[2 * index], &charge_full);
+   reader_long(power->files[2 * index + 1], &charge_current);
+   power->charge_full[index] = charge_full;
+   power->charge_current[index] = charge_current;
+#endif
+}
+
+static void
+_power_state_get(power_t *power)
+{
+   int i;
+#if defined(__OpenBSD__) || defined(__NetBSD__)
+   struct sensor snsr;
+   int have_ac = 0;
+   size_t slen = sizeof(struct sensor);
+#elif defined(__FreeBSD__) || defined(__DragonFly__)
+   unsigned int value;
+   size_t len;
+#elif defined(__linux__)
+   int have_ac = 0;
+#endif
+
+#if defined(__OpenBSD__) || defined(__NetBSD__)
+   power->ac_mibs[3] = 9;
+   power->ac_mibs[4] = 0;
+
+   if (sysctl(power->ac_mibs, 5, &snsr, &slen, NULL, 0) != -1)
+     have_ac = (int)snsr.value;
+#elif defined(__FreeBSD__) || defined(__DragonFly__)
+   len = sizeof(value);
+   if ((sysctl(power->ac_mibs, 3, &value, &len, NULL, 0)) == -1)
+     {
+        return;
+     }
+   power->have_ac = value;
+#elif defined(__linux__)
+   long value;
+
+   if (reader_long(power->ac_file, &value))
+     have_ac = value;
+#endif
+
+   for (i = 0; i < power->battery_count; i++)
+     _battery_state_get(power, i);
+
+#if defined(__OpenBSD__) || defined(__NetBSD__) || defined(__linux__)
+   for (i = 0; i < power->battery_count; i++)
+     {
+        double percent =
+           100 * (power->charge_current[i] / power->charge_full[i]);
+        power->percent[i] = percent;
+     }
+   power->have_ac = have_ac;
+#elif defined(__FreeBSD__) || defined(__DragonFly__)
+   len = sizeof(value);
+   if ((sysctl(power->bat_mibs[0], 4, &value, &len, NULL, 0)) == -1)
+     {
+        return;
+     }
+
+   power->percent[0] = value;
+#endif
+}
+
+static void
+_power_init(results_t *results)
+{
+   power_t *power = &results->power;
+#if defined(__linux__)
+   char path[PATH_MAX];
+   int i;
+#endif
+
+   if (!_power_battery_count_get(power))
+     return;
+
+#if defined(__linux__)
+   for (i = 0; i < power->battery_count; i++)
+     {
+        if (!power->naming[i]) continue;
+        snprintf(path, sizeof(path), "/sys/class/power_supply/BAT%c/%s_full",
+                 power->battery_names[i], power->naming[i]);
+        power->files[2 * i] = reader_open(results->reader, path, 32);
+        snprintf(path, sizeof(path), "/sys/class/power_supply/BAT%c/%s_now",
+                 power->battery_names[i], power->naming[i]);
+        power->files[2 * i + 1] = reader_open(results->reader, path, 32);
+     }
+   power->ac_file = reader_open(results->reader, "/sys/class/power_supply/AC/online", 32);
+#endif
+}
+
+static void
+_power_sample(results_t *results)
+{
+   if (results->power.battery_count)
+     _power_state_get(&results->power);
+}
+
+static void
+_power_shutdown(results_t *results)
+{
+   power_t *power = &results->power;
+   int i;
+
+   for (i = 0; i < power->battery_count; i++)
+     {
+        if (power->bat_mibs[i]) free(power->bat_mibs[i]);
+#if defined(__linux__)
+        reader_close(results->reader, power->files[2 * i]);
+        reader_close(results->reader, power->files[2 * i + 1]);
+#endif
+     }
+#if defined(__linux__)
+   reader_close(results->reader, power->ac_file);
+#endif
+   free(power->arena);
+
+   memset(power, 0, sizeof(power_t));
+}
+
+/* RAPL energy counters (-E) from /sys/class/powercap. Zones are found
+ * once; each sample the energy_uj counters are read with the rest and
+ * turned into watts over the measured window, allowing for a counter
+ * wrapping at max_energy_range_uj. The MMIO interface repeats the
+ * package zones, so only the MSR one is used. */
+#if defined(__linux__)
+static int
+_rapl_cmp(const void *a, const void *b)
+{
+   const rapl_zone_t *x = a, *y = b;
+
+   if (x->type != y->type) return x->type - y->type;
+
+   return strcmp(x->name, y->name);
+}
+#endif
+
+static void
+_rapl_init(results_t *results)
+{
+#if defined(__linux__)
+   static const char *types[] = { "package", "core", "uncore", "dram", "psys" };
+   rapl_t *rapl = &results->rapl;
+   rapl_zone_t *zone, *zones;
+   struct dirent *dh;
+   DIR *dir;
+   char path[PATH_MAX], *name;
+   int package, sub, n;
+   size_t i;
+
+   dir = opendir("/sys/class/powercap");
+   if (!dir) return;
+
+   while ((dh = readdir(dir)) != NULL)
+     {
+        n = sscanf(dh->d_name, "intel-rapl:%d:%d", &package, &sub);
+        if (n < 1) continue;
+
+        snprintf(path, sizeof(path), "/sys/class/powercap/%s/name", dh->d_name);
+        name = Fcontents(path);
+        if (!name) continue;
+        name[strcspn(name, "\n")] = '\0';
+
+        zones = realloc(rapl->zones, (rapl->count + 1) * sizeof(rapl_zone_t));
+        if (!zones)
+          {
+             free(name);
+             break;
+          }
+        rapl->zones = zones;
+        zone = &rapl->zones[rapl->count];
+        memset(zone, 0, sizeof(rapl_zone_t));
+
+        /* Subzones are named after their package's index. */
+        if (n == 2)
+          snprintf(zone->name, sizeof(zone->name), "%s-%d", name, package);
+        else
+          snprintf(zone->name, sizeof(zone->name), "%s", name);
+
+        zone->type = RAPL_OTHER;
+        for (i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+          {
+             if (!strncmp(name, types[i], strlen(types[i])))
+               zone->type = i;
+          }
+        free(name);
+
+        snprintf(path, sizeof(path), "/sys/class/powercap/%s/max_energy_range_uj", dh->d_name);
+        name = Fcontents(path);
+        zone->range = name ? strtoull(name, NULL, 10) : 0;
+        free(name);
+
+        /* energy_uj is root only on most kernels now. */
+        snprintf(path, sizeof(path), "/sys/class/powercap/%s/energy_uj", dh->d_name);
+        zone->file = reader_open(results->reader, path, 32);
+        if (zone->file)
+          rapl->count++;
+     }
+
+   closedir(dir);
+
+   qsort(rapl->zones, rapl->count, sizeof(rapl_zone_t), _rapl_cmp);
+#else
+   (void) results;
+#endif
+}
+
+static void
+_rapl_state_get(results_t *results)
+{
+   rapl_t *rapl = &results->rapl;
+   rapl_zone_t *zone;
+   uint64_t now;
+   uint64_t energy, delta;
+   double elapsed = 0;
+   char *buf;
+   int i;
+
+   if (!rapl->count) return;
+
+   now = _stamp_now();
+   if (rapl->stamp)
+     elapsed = _stamp_elapsed(rapl->stamp, now);
+   rapl->stamp = now;
+
+   for (i = 0; i < rapl->count; i++)
+     {
+        zone = &rapl->zones[i];
+        if (reader_contents(zone->file, &buf) <= 0)
+          {
+             zone->valid = false;
+             continue;
+          }
+        energy = strtoull(buf, NULL, 10);
+
+        if (zone->valid && elapsed > 0)
+          {
+             if (energy >= zone->energy)
+               delta = energy - zone->energy;
+             else
+               delta = zone->range > zone->energy ? zone->range - zone->energy + energy : energy;
+             zone->watts = delta / 1e6 / elapsed;
+          }
+        zone->energy = energy;
+        zone->valid = true;
+     }
+}
+
+static void
+_rapl_shutdown(results_t *results)
+{
+   rapl_t *rapl = &results->rapl;
+   int i;
+
+   for (i = 0; i < rapl->count; i++)
+     reader_close(results->reader, rapl->zones[i].file);
+
+   free(rapl->zones);
+   memset(rapl, 0, sizeof(rapl_t));
+}
+
+#endif
+
+static unsigned long
+_network_iface_speed_get(const char *name)
+{
+   unsigned long speed = 0;
+#if defined(__linux__)
+   char path[PATH_MAX], *buf;
+   long value;
+
+   snprintf(path, sizeof(path), "/sys/class/net/%s/speed", name);
+   buf = Fcontents(path);
+   if (buf)
+     {
+        value = atol(buf);
+        if (value > 0) speed = value;
+        free(buf);
+     }
+#else
+   (void) name;
+#endif
+   return speed;
+}
+
+static unsigned int
+_network_slot(network_t *network, unsigned int ifindex)
+{
+   return (ifindex * 2654435761u) & (network->slot_size - 1);
+}
+
+static int
+_network_iface_find(network_t *network, unsigned int ifindex)
+{
+   unsigned int slot = _network_slot(network, ifindex);
+   int idx;
+
+   while ((idx = network->slots[slot]) != 0)
+     {
+        if (network->ifaces[idx - 1].ifindex == ifindex)
+          return idx - 1;
+        slot = (slot + 1) & (network->slot_size - 1);
+     }
+
+   return -1;
+}
+
+static void
+_network_slot_insert(network_t *network, int idx)
+{
+   unsigned int slot = _network_slot(network, network->ifaces[idx].ifindex);
+
+   while (network->slots[slot])
+     slot = (slot + 1) & (network->slot_size - 1);
+
+   network->slots[slot] = idx + 1;
+}
+
+static void
+_network_slot_remove(network_t *network, unsigned int ifindex)
+{
+   unsigned int mask = network->slot_size - 1;
+   unsigned int slot = _network_slot(network, ifindex);
+   unsigned int next, home;
+   int idx;
+
+   while ((idx = network->slots[slot]) != 0)
+     {
+        if (network->ifaces[idx - 1].ifindex == ifindex)
+          break;
+        slot = (slot + 1) & mask;
+     }
+   if (!idx) return;
+
+   /* Backward shift deletion keeps probe chains intact. */
+   network->slots[slot] = 0;
+   for (next = (slot + 1) & mask; (idx = network->slots[next]) != 0; next = (next + 1) & mask)
+     {
+        home = _network_slot(network, network->ifaces[idx - 1].ifindex);
+        if (((next - home) & mask) >= ((next - slot) & mask))
+          {
+             network->slots[slot] = idx;
+             network->slots[next] = 0;
+             slot = next;
+          }
+     }
+}
+
+static bool
+_network_grow(network_t *network)
+{
+   net_iface_t *ifaces;
+   int *unused, *order, *prev, *slots;
+   int i, size = network->iface_size ? network->iface_size * 2 : 16;
+
+   ifaces = realloc(network->ifaces, size * sizeof(net_iface_t));
+   if (!ifaces) return false;
+   network->ifaces = ifaces;
+
+   unused = realloc(network->unused, size * sizeof(int));
+   order = realloc(network->order, size * sizeof(int));
+   prev = realloc(network->prev, size * sizeof(int));
+   slots = calloc(size * 2, sizeof(int));
+   if (unused) network->unused = unused;
+   if (order) network->order = order;
+   if (prev) network->prev = prev;
+   if (!unused || !order || !prev || !slots)
+     {
+        free(slots);
+        return false;
+     }
+
+   for (i = size - 1; i >= network->iface_size; i--)
+     {
+        network->ifaces[i].ifindex = 0;
+        network->unused[network->unused_count++] = i;
+     }
+
+   free(network->slots);
+   network->slots = slots;
+   network->slot_size = size * 2;
+   for (i = 0; i < network->iface_size; i++)
+     {
+        if (network->ifaces[i].ifindex)
+          _network_slot_insert(network, i);
+     }
+   network->iface_size = size;
+
+   return true;
+}
+
+static int
+_network_iface_add(network_t *network, const char *name, unsigned int ifindex)
+{
+   net_iface_t *iface;
+   int idx;
+
+   if (!network->unused_count && !_network_grow(network))
+     return -1;
+
+   idx = network->unused[--network->unused_count];
+   iface = &network->ifaces[idx];
+   memset(iface, 0, sizeof(net_iface_t));
+   iface->ifindex = ifindex;
+   snprintf(iface->name, sizeof(iface->name), "%s", name);
+   iface->included = _filter_match(network->patterns, network->pattern_count, iface->name);
+   iface->speed = _network_iface_speed_get(iface->name);
+
+   _network_slot_insert(network, idx);
+
+   return idx;
+}
+
+static int
+_network_iface_lookup(network_t *network, const char *name, size_t len)
+{
+   char ifname[IF_NAMESIZE];
+   unsigned int ifindex;
+   net_iface_t *iface;
+   int i, idx;
+
+   /* Interfaces are usually listed in the same order as last time, and
+    * a removed one only shifts the rest by one place. */
+   for (i = network->hint; i < network->prev_count && i <= network->hint + 1; i++)
+     {
+        iface = &network->ifaces[network->prev[i]];
+        if (!strncmp(iface->name, name, len) && iface->name[len] == '\0')
+          {
+             network->hint = i + 1;
+             return network->prev[i];
+          }
+     }
+
+   if (len >= sizeof(ifname)) return -1;
+   memcpy(ifname, name, len);
+   ifname[len] = '\0';
+
+   ifindex = if_nametoindex(ifname);
+   if (!ifindex) return -1;
+
+   idx = network->slot_size ? _network_iface_find(network, ifindex) : -1;
+   if (idx == -1)
+     return _network_iface_add(network, ifname, ifindex);
+
+   iface = &network->ifaces[idx];
+   if (strcmp(iface->name, ifname))
+     {
+        /* Renamed, the counters carry on. */
+        memcpy(iface->name, ifname, len + 1);
+        iface->included = _filter_match(network->patterns, network->pattern_count, iface->name);
+        iface->speed = _network_iface_speed_get(iface->name);
+     }
+
+   return idx;
+}
+
+static void
+_network_iface_update(network_t *network, const char *name, size_t len,
+                      unsigned long in, unsigned long out, double elapsed)
+{
+   net_iface_t *iface;
+   int idx;
+
+   idx = _network_iface_lookup(network, name, len);
+   if (idx == -1 || network->ifaces[idx].seen == network->generation)
+     return;
+
+   iface = &network->ifaces[idx];
+   iface->seen = network->generation;
+   network->order[network->order_count++] = idx;
+
+   if (!iface->included)
+     return;
+
+   if (iface->valid && elapsed > 0)
+     {
+        /* Counters reset when interfaces are recreated. */
+        iface->incoming = in >= iface->in ? (in - iface->in) / elapsed : 0;
+        iface->outgoing = out >= iface->out ? (out - iface->out) / elapsed : 0;
+     }
+
+   iface->in = in;
+   iface->out = out;
+   iface->valid = true;
+}
+
+#if defined(__MacOS__) || defined(__FreeBSD__) || defined(__DragonFly__)
+static void
+_freebsd_generic_network_status(network_t *network, double elapsed)
+{
+   struct ifmibdata *ifmd;
+   size_t len;
+   int i, count;
+   len = sizeof(count);
+
+   if (sysctlbyname
+         ("net.link.generic.system.ifcount", &count, &len, NULL, 0) < 0)
+     return;
+
+   ifmd = malloc(sizeof(struct ifmibdata));
+   if (!ifmd)
+     return;
+
+   for (i = 1; i <= count; i++) {
+        int mib[] = { CTL_NET, PF_LINK, NETLINK_GENERIC, IFMIB_IFDATA, i, IFDATA_GENERAL };
+        len = sizeof(*ifmd);
+        if (sysctl(mib, 6, ifmd, &len, NULL, 0) < 0) continue;
+        if (!strcmp(ifmd->ifmd_name, "lo0"))
+          continue;
+        _network_iface_update(network, ifmd->ifmd_name, strlen(ifmd->ifmd_name),
+                              ifmd->ifmd_data.ifi_ibytes, ifmd->ifmd_data.ifi_obytes, elapsed);
+     }
+   free(ifmd);
+}
+
+#endif
+
+#if defined(__OpenBSD__)
+static void
+_openbsd_generic_network_status(network_t *network, double elapsed)
+{
+   struct ifaddrs *interfaces, *ifa;
+
+   if (getifaddrs(&interfaces) < 0)
+     return;
+
+   int sock = socket(AF_INET, SOCK_STREAM, 0);
+   if (sock < 0)
+     {
+        freeifaddrs(interfaces);
+        return;
+     }
+
+   for (ifa = interfaces; ifa; ifa = ifa->ifa_next) {
+        struct ifreq ifreq;
+        struct if_data if_data;
+
+        ifreq.ifr_data = (void *)&if_data;
+        strncpy(ifreq.ifr_name, ifa->ifa_name, IFNAMSIZ - 1);
+        if (ioctl(sock, SIOCGIFDATA, &ifreq) < 0)
+          break;
+
+        struct if_data *const ifi = &if_data;
+        if (ifi->ifi_type == IFT_ETHER ||
+            ifi->ifi_type == IFT_FASTETHER ||
+            ifi->ifi_type == IFT_GIGABITETHERNET ||
+            ifi->ifi_type == IFT_IEEE80211)
+          {
+             _network_iface_update(network, ifa->ifa_name, strlen(ifa->ifa_name),
+                                   ifi->ifi_ibytes, ifi->ifi_obytes, elapsed);
+          }
+     }
+   close(sock);
+   freeifaddrs(interfaces);
+}
+
+#endif
+
+#if defined(__linux__)
+static void
+_linux_generic_network_status(network_t *network, double elapsed)
+{
+   char *buf, *end;
+   const char *line, *next, *name, *colon;
+   uint64_t fields[16];
+   ssize_t len;
+
+   len = reader_contents(network->dev, &buf);
+   if (len == -1) return;
+
+   end = buf + len;
+
+   for (line = buf; line < end; line = next)
+     {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : end;
+
+        /* Skip the two header lines. */
+        colon = memchr(line, ':', next - line);
+        if (!colon) continue;
+
+        if (16 == fields_parse(colon + 1, end, fields, 16, &next))
+          {
+             for (name = line; *name == ' '; name++);
+             _network_iface_update(network, name, colon - name, fields[0], fields[8], elapsed);
+          }
+     }
+}
+
+#endif
+
+static void
+_network_init(results_t *results)
+{
+   network_t *network = &results->network;
+
+   network->generation = 1;
+#if defined(__linux__)
+   network->dev = reader_open(results->reader, "/proc/net/dev", 4096);
+#endif
+
+   _filter_compile(network->filter, &network->patterns, &network->pattern_count);
+}
+
+static void
+_network_transfer_get(results_t *results)
+{
+   network_t *network = &results->network;
+   net_iface_t *iface;
+   uint64_t now;
+   double elapsed = 0;
+   int i, *tmp;
+
+   now = _stamp_now();
+   if (network->stamp)
+     elapsed = _stamp_elapsed(network->stamp, now);
+   network->stamp = now;
+
+   tmp = network->prev;
+   network->prev = network->order;
+   network->order = tmp;
+   network->prev_count = network->order_count;
+   network->order_count = 0;
+   network->hint = 0;
+   network->generation++;
+
+#if defined(__linux__)
+   _linux_generic_network_status(network, elapsed);
+#elif defined(__OpenBSD__)
+   _openbsd_generic_network_status(network, elapsed);
+#elif defined(__MacOS__) || defined(__FreeBSD__) || defined(__DragonFly__)
+   _freebsd_generic_network_status(network, elapsed);
+#endif
+
+   for (i = 0; i < network->prev_count; i++)
+     {
+        iface = &network->ifaces[network->prev[i]];
+        if (iface->ifindex && iface->seen != network->generation)
+          {
+             _network_slot_remove(network, iface->ifindex);
+             iface->ifindex = 0;
+             network->unused[network->unused_count++] = network->prev[i];
+          }
+     }
+
+   results->incoming = results->outgoing = 0;
+   for (i = 0; i < network->order_count; i++)
+     {
+        iface = &network->ifaces[network->order[i]];
+        if (!iface->included) continue;
+        results->incoming += iface->incoming;
+        results->outgoing += iface->outgoing;
+     }
+}
+
+static void
+_network_shutdown(results_t *results)
+{
+   network_t *network = &results->network;
+   const char *filter = network->filter;
+
+   _filter_free(network->patterns, network->pattern_count);
+   free(network->ifaces);
+   free(network->unused);
+   free(network->slots);
+   free(network->order);
+   free(network->prev);
+#if defined(__linux__)
+   reader_close(results->reader, network->dev);
+#endif
+
+   memset(network, 0, sizeof(network_t));
+   network->filter = filter;
+}
+
+static void
+_memory_init(results_t *results)
+{
+#if defined(__linux__)
+   results->memory_file = reader_open(results->reader, "/proc/meminfo", 4096);
+#else
+   (void) results;
+#endif
+}
+
+static void
+_memory_sample(results_t *results)
+{
+   _memory_usage_get(&results->memory, results->memory_file);
+}
+
+static void
+_memory_shutdown(results_t *results)
+{
+#if defined(__linux__)
+   reader_close(results->reader, results->memory_file);
+#endif
+   results->memory_file = NULL;
+}
+
+#if !defined(NO_THERMAL)
+/* hwmon sensors (-H). Every chip under /sys/class/hwmon is scanned once
+ * for temperature, fan and voltage inputs; labels and thresholds are
+ * read then, the inputs are held open and read with the rest each
+ * sample. coretemp's "Core N" sensors are mapped onto CPUs through the
+ * topology so -C can show them. */
+#if defined(__linux__)
+static const char *hwmon_prefixes[HWMON_TYPES] = { "temp", "fan", "in" };
+
+static bool
+_file_read_line(const char *path, char *buf, size_t size)
+{
+   ssize_t len;
+   int fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd == -1) return false;
+
+   len = read(fd, buf, size - 1);
+   close(fd);
+   if (len <= 0) return false;
+
+   buf[len] = '\0';
+   buf[strcspn(buf, "\n")] = '\0';
+
+   return true;
+}
+
+/* "temp3_input" is HWMON_TEMP 3. */
+static bool
+_hwmon_input_parse(const char *name, int *type, int *index)
+{
+   size_t len;
+   int i, n;
+
+   for (i = 0; i < HWMON_TYPES; i++)
+     {
+        len = strlen(hwmon_prefixes[i]);
+        if (strncmp(name, hwmon_prefixes[i], len) || !isdigit(name[len])) continue;
+
+        n = 0;
+        if (sscanf(name + len, "%d_input%n", index, &n) == 1 && n && !name[len + n])
+          {
+             *type = i;
+             return true;
+          }
+     }
+
+   return false;
+}
+
+static void
+_hwmon_chip_scan(results_t *results, int hwmon, const char *dir, const char *chip)
+{
+   hwmon_t *hw = &results->hwmon;
+   hwmon_sensor_t *sensor, *sensors;
+   struct dirent *dh;
+   DIR *d;
+   char path[PATH_MAX];
+   const char *prefix;
+   int type, index;
+
+   d = opendir(dir);
+   if (!d) return;
+
+   while ((dh = readdir(d)) != NULL)
+     {
+        if (!_hwmon_input_parse(dh->d_name, &type, &index)) continue;
+
+        sensors = realloc(hw->sensors, (hw->count + 1) * sizeof(hwmon_sensor_t));
+        if (!sensors) break;
+        hw->sensors = sensors;
+
+        sensor = &hw->sensors[hw->count];
+        memset(sensor, 0, sizeof(hwmon_sensor_t));
+        snprintf(sensor->chip, sizeof(sensor->chip), "%s", chip);
+        sensor->hwmon = hwmon;
+        sensor->type = type;
+        sensor->index = index;
+        sensor->package = sensor->core = -1;
+
+        prefix = hwmon_prefixes[type];
+        snprintf(path, sizeof(path), "%s/%s%d_label", dir, prefix, index);
+        if (!_file_read_line(path, sensor->label, sizeof(sensor->label)))
+          snprintf(sensor->label, sizeof(sensor->label), "%s%d", prefix, index);
+        snprintf(path, sizeof(path), "%s/%s%d_max", dir, prefix, index);
+        sensor->max = _file_read_long(path, 0);
+        snprintf(path, sizeof(path), "%s/%s%d_crit", dir, prefix, index);
+        sensor->crit = _file_read_long(path, 0);
+
+        if (type == HWMON_TEMP && !strcmp(chip, "coretemp"))
+          sscanf(sensor->label, "Core %d", &sensor->core);
+
+        snprintf(path, sizeof(path), "%s/%s", dir, dh->d_name);
+        sensor->input = reader_open(results->reader, path, 32);
+        if (sensor->input)
+          hw->count++;
+     }
+
+   closedir(d);
+}
+
+/* A coretemp chip covers one package, named by its "Package id N". */
+static void
+_hwmon_chip_package(hwmon_t *hw, int start)
+{
+   int i, package = -1;
+
+   for (i = start; i < hw->count; i++)
+     {
+        if (sscanf(hw->sensors[i].label, "Package id %d", &package) == 1)
+          break;
+     }
+
+   for (i = start; i < hw->count; i++)
+     hw->sensors[i].package = package;
+}
+
+static int
+_hwmon_cmp(const void *a, const void *b)
+{
+   const hwmon_sensor_t *x = a, *y = b;
+
+   if (x->hwmon != y->hwmon) return x->hwmon - y->hwmon;
+   if (x->type != y->type) return x->type - y->type;
+
+   return x->index - y->index;
+}
+
+static void
+_hwmon_cpus_map(hwmon_t *hw)
+{
+   char path[PATH_MAX];
+   long package, core;
+   int i, j, ncpu = cpu_count();
+   bool found = false;
+
+   for (i = 0; i < hw->count && !found; i++)
+     found = hw->sensors[i].core != -1;
+   if (!found) return;
+
+   hw->cpus = malloc(ncpu * sizeof(int));
+   if (!hw->cpus) return;
+   hw->cpu_count = ncpu;
+
+   for (i = 0; i < ncpu; i++)
+     {
+        hw->cpus[i] = -1;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+        package = _file_read_long(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", i);
+        core = _file_read_long(path, -1);
+        if (core == -1) continue;
+
+        for (j = 0; j < hw->count; j++)
+          {
+             if (hw->sensors[j].core != core) continue;
+             if (hw->sensors[j].package != -1 && hw->sensors[j].package != package) continue;
+             hw->cpus[i] = j;
+             break;
+          }
+     }
+}
+
+/* Without a package thermal zone, the CPU's own chip: Tctl on k10temp,
+ * the package sensor on coretemp. */
+static bool
+_hwmon_cpu_temp_path(char *path, size_t size)
+{
+   static const char *chips[] = { "k10temp", "zenpower", "coretemp", "cpu_thermal" };
+   struct dirent *dh;
+   DIR *dir;
+   char name[32];
+   size_t i;
+   bool found = false;
+
+   dir = opendir("/sys/class/hwmon");
+   if (!dir) return false;
+
+   while (!found && (dh = readdir(dir)) != NULL)
+     {
+        if (strncmp(dh->d_name, "hwmon", 5)) continue;
+
+        snprintf(path, size, "/sys/class/hwmon/%s/name", dh->d_name);
+        if (!_file_read_line(path, name, sizeof(name))) continue;
+
+        for (i = 0; i < sizeof(chips) / sizeof(chips[0]) && !found; i++)
+          {
+             if (strcmp(name, chips[i])) continue;
+             snprintf(path, size, "/sys/class/hwmon/%s/temp1_input", dh->d_name);
+             found = access(path, R_OK) == 0;
+          }
+     }
+
+   closedir(dir);
+
+   return found;
+}
+#endif
+
+static void
+_hwmon_init(results_t *results)
+{
+#if defined(__linux__)
+   hwmon_t *hw = &results->hwmon;
+   struct dirent *dh;
+   DIR *dir;
+   char path[PATH_MAX], chip[32];
+   int hwmon, start;
+
+   dir = opendir("/sys/class/hwmon");
+   if (!dir) return;
+
+   while ((dh = readdir(dir)) != NULL)
+     {
+        if (sscanf(dh->d_name, "hwmon%d", &hwmon) != 1) continue;
+
+        snprintf(path, sizeof(path), "/sys/class/hwmon/%s/name", dh->d_name);
+        if (!_file_read_line(path, chip, sizeof(chip))) continue;
+
+        start = hw->count;
+        snprintf(path, sizeof(path), "/sys/class/hwmon/%s", dh->d_name);
+        _hwmon_chip_scan(results, hwmon, path, chip);
+
+        /* Older drivers keep their attributes on the device. */
+        if (hw->count == start)
+          {
+             snprintf(path, sizeof(path), "/sys/class/hwmon/%s/device", dh->d_name);
+             _hwmon_chip_scan(results, hwmon, path, chip);
+          }
+        _hwmon_chip_package(hw, start);
+     }
+
+   closedir(dir);
+
+   qsort(hw->sensors, hw->count, sizeof(hwmon_sensor_t), _hwmon_cmp);
+   _hwmon_cpus_map(hw);
+#else
+   (void) results;
+#endif
+}
+
+static void
+_hwmon_sample(results_t *results)
+{
+   hwmon_t *hw = &results->hwmon;
+   hwmon_sensor_t *sensor;
+   int i;
+
+   for (i = 0; i < hw->count; i++)
+     {
+        sensor = &hw->sensors[i];
+        sensor->valid = reader_long(sensor->input, &sensor->value);
+     }
+}
+
+static void
+_hwmon_shutdown(results_t *results)
+{
+   hwmon_t *hw = &results->hwmon;
+   int i;
+
+   for (i = 0; i < hw->count; i++)
+     reader_close(results->reader, hw->sensors[i].input);
+
+   free(hw->sensors);
+   free(hw->cpus);
+   memset(hw, 0, sizeof(hwmon_t));
+}
+
+/* The package zone is looked up once; its temp file is read with the
+ * rest each sample. */
+static void
+_temperature_init(results_t *results)
+{
+#if defined(__linux__)
+   struct dirent *dh;
+   DIR *dir;
+   char path[PATH_MAX], *type;
+
+   dir = opendir("/sys/class/thermal");
+
+   while (dir && (dh = readdir(dir)) != NULL)
+     {
+        if (strncmp(dh->d_name, "thermal_zone", 12)) continue;
+
+        snprintf(path, sizeof(path), "/sys/class/thermal/%s/type", dh->d_name);
+        type = Fcontents(path);
+        if (!type) continue;
+
+        /* This should ensure we get the highest available core temperature */
+        if (strstr(type, "_pkg_temp"))
+          {
+             snprintf(path, sizeof(path), "/sys/class/thermal/%s/temp", dh->d_name);
+             results->temperature_file = reader_open(results->reader, path, 32);
+          }
+        free(type);
+        if (results->temperature_file) break;
+     }
+
+   if (dir)
+     closedir(dir);
+
+   if (!results->temperature_file && _hwmon_cpu_temp_path(path, sizeof(path)))
+     results->temperature_file = reader_open(results->reader, path, 32);
+#else
+   (void) results;
+#endif
+}
+
+static void
+_temperature_sample(results_t *results)
+{
+   _temperature_cpu_get(&results->temperature, results->temperature_file);
+}
+
+static void
+_temperature_shutdown(results_t *results)
+{
+#if defined(__linux__)
+   reader_close(results->reader, results->temperature_file);
+#endif
+   results->temperature_file = NULL;
+}
+
+#endif
+
+#if !defined(NO_AUDIO)
+static void
+_mixer_sample(results_t *results)
+{
+   _mixer_master_volume_get(&results->mixer);
+}
+
+#endif
+
+static void
+_sched_init(results_t *results)
+{
+   results->sched.enabled = true;
+#if defined(__linux__)
+   results->sched.loadavg = reader_open(results->reader, "/proc/loadavg", 128);
+#endif
+}
+
+static void
+_sched_shutdown(results_t *results)
+{
+#if defined(__linux__)
+   reader_close(results->reader, results->sched.loadavg);
+#endif
+   memset(&results->sched, 0, sizeof(sched_t));
+}
+
+#if !defined(NO_RUNQ)
+/* Run queue latency (-q). Each cpuN line of /proc/schedstat carries,
+ * from its seventh counter on, the time spent running and waiting on
+ * the run queue in nanoseconds and the number of timeslices run. Their
+ * differences over the window give the wait per second and per slice,
+ * for each CPU and for the machine. Needs CONFIG_SCHEDSTATS. */
+static void
+_runq_init(results_t *results)
+{
+#if defined(__linux__)
+   results->runq.file = reader_open(results->reader, "/proc/schedstat", 16384);
+#else
+   (void) results;
+#endif
+}
+
+static void
+_runq_state_get(results_t *results)
+{
+   runq_t *runq = &results->runq;
+   runq_cpu_t *cpu, *cpus;
+   uint64_t now;
+   uint64_t values[10], wait = 0, slices = 0;
+   double elapsed = 0;
+   const char *line, *end, *next;
+   char *buf;
+   ssize_t len;
+   int n = 0;
+   bool delta;
+
+   len = reader_contents(runq->file, &buf);
+   if (len <= 0) return;
+
+   now = _stamp_now();
+   if (runq->stamp)
+     elapsed = _stamp_elapsed(runq->stamp, now);
+   runq->stamp = now;
+
+   end = buf + len;
+   for (line = buf; line < end; line = next)
+     {
+        if (strncmp(line, "cpu", 3))
+          {
+             next = memchr(line, '\n', end - line);
+             next = next ? next + 1 : end;
+             continue;
+          }
+
+        /* cpuN yld_count 0 schedule idle ttwu ttwu_local run wait slices */
+        if (fields_parse(line + 3, end, values, 10, &next) != 10)
+          continue;
+
+        if (n == runq->size)
+          {
+             cpus = realloc(runq->cpus, (runq->size + 16) * sizeof(runq_cpu_t));
+             if (!cpus) break;
+             runq->cpus = cpus;
+             runq->size += 16;
+          }
+
+        /* A CPU that came or went since the last sample starts over. */
+        cpu = &runq->cpus[n];
+        delta = n < runq->count && cpu->cpu == (int) values[0] && elapsed > 0 &&
+                values[8] >= cpu->wait_ns && values[9] >= cpu->slices;
+        if (delta)
+          {
+             cpu->wait = (values[8] - cpu->wait_ns) / 1e6 / elapsed;
+             cpu->delay = values[9] > cpu->slices ?
+                (values[8] - cpu->wait_ns) / 1e3 / (values[9] - cpu->slices) : 0;
+             wait += values[8] - cpu->wait_ns;
+             slices += values[9] - cpu->slices;
+          }
+        else
+          cpu->wait = cpu->delay = 0;
+
+        cpu->cpu = values[0];
+        cpu->run_ns = values[7];
+        cpu->wait_ns = values[8];
+        cpu->slices = values[9];
+        n++;
+     }
+
+   runq->count = n;
+   runq->valid = n && elapsed > 0;
+   runq->wait = elapsed > 0 ? wait / 1e6 / elapsed : 0;
+   runq->delay = slices ? wait / 1e3 / slices : 0;
+}
+
+static void
+_runq_shutdown(results_t *results)
+{
+#if defined(__linux__)
+   reader_close(results->reader, results->runq.file);
+#endif
+   free(results->runq.cpus);
+   memset(&results->runq, 0, sizeof(runq_t));
+}
+
+#endif
+
+static const collector_t collectors[] = {
+   { RESULTS_CPU, true,  _cpu_cores_init, _cpu_cores_state_get, _cpu_cores_shutdown },
+   { RESULTS_NET, true,  _network_init,   _network_transfer_get, _network_shutdown },
+   { RESULTS_MEM, false, _memory_init,    _memory_sample,        _memory_shutdown },
+#if !defined(NO_POWER)
+   { RESULTS_PWR, false, _power_init,     _power_sample,         _power_shutdown },
+#endif
+#if !defined(NO_THERMAL)
+   { RESULTS_TMP, false, _temperature_init, _temperature_sample, _temperature_shutdown },
+#endif
+#if !defined(NO_AUDIO)
+   { RESULTS_AUD, false, NULL,            _mixer_sample,         NULL },
+#endif
+   { RESULTS_NUMA, true, _numa_init,      _numa_state_get,       _numa_shutdown },
+   { RESULTS_FREQ, false, _cpufreq_init,  _cpufreq_state_get,    _cpufreq_shutdown },
+   { RESULTS_SCHED, true, _sched_init,    NULL,                  _sched_shutdown },
+#if !defined(NO_IRQS)
+   { RESULTS_IRQS, true,  _irqs_init,     _irqs_state_get,       _irqs_shutdown },
+#endif
+#if !defined(NO_NETSTAT)
+   { RESULTS_NETSTAT, true, _netstat_init, _netstat_state_get,    _netstat_shutdown },
+#endif
+   { RESULTS_PROCS, true, _procs_init,    _procs_state_get,      _procs_shutdown },
+   { RESULTS_FS, false,   _filesystems_init, _filesystems_state_get, _filesystems_shutdown },
+#if !defined(NO_THERMAL)
+   { RESULTS_HWMON, false, _hwmon_init,   _hwmon_sample,         _hwmon_shutdown },
+#endif
+#if !defined(NO_POWER)
+   { RESULTS_ENERGY, true, _rapl_init,    _rapl_state_get,       _rapl_shutdown },
+#endif
+#if !defined(NO_RUNQ)
+   { RESULTS_RUNQ, true,  _runq_init,     _runq_state_get,       _runq_shutdown },
+#endif
+};
+
+#define COLLECTORS_COUNT (sizeof(collectors) / sizeof(collector_t))
+
+static void
+results_init(results_t *results, int flags)
+{
+   size_t i;
+
+   for (i = 0; i < COLLECTORS_COUNT; i++)
+     {
+        if ((flags & collectors[i].flag) && collectors[i].init)
+          collectors[i].init(results);
+     }
+}
+
+/* Collectors are dispatched to a small fixed pool of workers so slow
+ * ones (ALSA, sysfs walks, large /proc files) overlap. Every collector
+ * only writes its own part of results_t, so no locking is needed around
+ * the results themselves; the caller takes jobs too and returns once
+ * every job has finished. */
+#define POOL_WORKERS_MAX  4
+
+typedef struct
+{
+   pthread_t          threads[POOL_WORKERS_MAX];
+   int                count;
+   pthread_mutex_t    lock;
+   pthread_cond_t     work;
+   pthread_cond_t     done;
+   const collector_t *jobs[COLLECTORS_COUNT];
+   int                job_count;
+   int                next;
+   int                pending;
+   results_t         *results;
+   bool               exit;
+} pool_t;
+
+static bool
+_pool_job_run(pool_t *pool)
+{
+   const collector_t *job;
+
+   if (pool->next >= pool->job_count)
+     return false;
+
+   job = pool->jobs[pool->next++];
+   pthread_mutex_unlock(&pool->lock);
+
+   job->sample(pool->results);
+
+   pthread_mutex_lock(&pool->lock);
+   if (--pool->pending == 0)
+     pthread_cond_signal(&pool->done);
+
+   return true;
+}
+
+static void *
+_pool_worker_cb(void *arg)
+{
+   pool_t *pool = arg;
+
+   pthread_mutex_lock(&pool->lock);
+   while (!pool->exit)
+     {
+        if (!_pool_job_run(pool))
+          pthread_cond_wait(&pool->work, &pool->lock);
+     }
+   pthread_mutex_unlock(&pool->lock);
+
+   return NULL;
+}
+
+static void
+pool_init(pool_t *pool, int flags)
+{
+   sigset_t mask, saved;
+   size_t i;
+   int wanted = -1;
+
+   memset(pool, 0, sizeof(pool_t));
+   pthread_mutex_init(&pool->lock, NULL);
+   pthread_cond_init(&pool->work, NULL);
+   pthread_cond_init(&pool->done, NULL);
+
+   /* The caller runs jobs as well. */
+   for (i = 0; i < COLLECTORS_COUNT; i++)
+     {
+        if (flags & collectors[i].flag)
+          wanted++;
+     }
+
+   if (wanted > POOL_WORKERS_MAX)
+     wanted = POOL_WORKERS_MAX;
+
+   /* Workers never take signals meant for the application. */
+   sigfillset(&mask);
+   pthread_sigmask(SIG_BLOCK, &mask, &saved);
+
+   for (i = 0; (int) i < wanted; i++)
+     {
+        if (pthread_create(&pool->threads[pool->count], NULL, _pool_worker_cb, pool))
+          break;
+        pool->count++;
+     }
+
+   pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
+
+static void
+pool_shutdown(pool_t *pool)
+{
+   int i;
+
+   pthread_mutex_lock(&pool->lock);
+   pool->exit = true;
+   pthread_cond_broadcast(&pool->work);
+   pthread_mutex_unlock(&pool->lock);
+
+   for (i = 0; i < pool->count; i++)
+     pthread_join(pool->threads[i], NULL);
+
+   pthread_cond_destroy(&pool->done);
+   pthread_cond_destroy(&pool->work);
+   pthread_mutex_destroy(&pool->lock);
+}
+
+static void
+results_sample(results_t *results, pool_t *pool, int flags, bool rates_only)
+{
+   size_t i;
+
+   /* Every pseudo file in one go, before the collectors parse them. */
+#if defined(__linux__)
+   reader_fill(results->reader);
+#endif
+
+   pthread_mutex_lock(&pool->lock);
+
+   pool->results = results;
+   pool->job_count = pool->next = 0;
+
+   for (i = 0; i < COLLECTORS_COUNT; i++)
+     {
+        if (!(flags & collectors[i].flag) || !collectors[i].sample) continue;
+        if (rates_only && !collectors[i].rate) continue;
+        pool->jobs[pool->job_count++] = &collectors[i];
+     }
+
+   pool->pending = pool->job_count;
+   if (pool->job_count > 1)
+     pthread_cond_broadcast(&pool->work);
+
+   while (_pool_job_run(pool));
+
+   while (pool->pending)
+     pthread_cond_wait(&pool->done, &pool->lock);
+
+   pthread_mutex_unlock(&pool->lock);
+}
+
+static bool
+results_rates(int flags)
+{
+   size_t i;
+
+   for (i = 0; i < COLLECTORS_COUNT; i++)
+     {
+        if ((flags & collectors[i].flag) && collectors[i].rate && collectors[i].sample)
+          return true;
+     }
+
+   return false;
+}
+
+static void
+results_shutdown(results_t *results, int flags)
+{
+   size_t i;
+
+   for (i = 0; i < COLLECTORS_COUNT; i++)
+     {
+        if ((flags & collectors[i].flag) && collectors[i].shutdown)
+          collectors[i].shutdown(results);
+     }
+}
+
+struct tingle_t
+{
+   int        flags;
+   int        primed;
+   results_t  results;
+   pool_t     pool;
+};
+
+void
+tingle_options_init(tingle_options_t *options)
+{
+   memset(options, 0, sizeof(tingle_options_t));
+   options->size = sizeof(tingle_options_t);
+}
+
+#define OPTION_SET(options, member) \
+   (offsetof(tingle_options_t, member) + sizeof((options)->member) <= (options)->size)
+
+tingle_t *
+tingle_new(int flags, const tingle_options_t *options)
+{
+   tingle_t *tingle;
+
+   /* A size we don't know (unset, or from a newer header) is refused
+    * rather than guessed at. */
+   if (options && (options->size < sizeof(size_t) || options->size > sizeof(tingle_options_t)))
+     {
+        errno = EINVAL;
+        return NULL;
+     }
+
+   tingle = calloc(1, sizeof(tingle_t));
+   if (!tingle) return NULL;
+
+   /* Per-node CPU usage is grouped from the per-core samples and the
+    * scheduler counters come from the CPU collector's read of /proc/stat. */
+   if (flags & (RESULTS_NUMA | RESULTS_SCHED))
+     flags |= RESULTS_CPU;
+
+   tingle->flags = flags;
+
+   /* Option strings are referenced, not copied. Options past the
+    * caller's size keep their defaults. */
+   if (options)
+     {
+        if (OPTION_SET(options, network_filter))
+          tingle->results.network.filter = options->network_filter;
+        if (OPTION_SET(options, irqs_threshold))
+          tingle->results.irqs.threshold = options->irqs_threshold;
+        if (OPTION_SET(options, pids))
+          tingle->results.procs.pids = options->pids;
+        if (OPTION_SET(options, fs_filter))
+          tingle->results.filesystems.filter = options->fs_filter;
+     }
+
+#if defined(__linux__)
+   tingle->results.reader = reader_new();
+#endif
+
+   results_init(&tingle->results, flags);
+   pool_init(&tingle->pool, flags);
+
+   return tingle;
+}
+
+void
+tingle_free(tingle_t *tingle)
+{
+   if (!tingle) return;
+
+   pool_shutdown(&tingle->pool);
+   results_shutdown(&tingle->results, tingle->flags);
+#if defined(__linux__)
+   reader_free(tingle->results.reader);
+#endif
+
+   free(tingle);
+}
+
+void
+tingle_sample(tingle_t *tingle)
+{
+   results_sample(&tingle->results, &tingle->pool, tingle->flags, false);
+   tingle->primed = tingle->flags;
+}
+
+/* Sample only the rate collectors, e.g. one interval before a single
+ * tingle_sample(). */
+void
+tingle_baseline(tingle_t *tingle)
+{
+   results_sample(&tingle->results, &tingle->pool, tingle->flags, true);
+   tingle->primed = tingle->flags;
+}
+
+/* True while a rate collector has no previous sample (or restored
+ * state) to compute against. */
+bool
+tingle_rates(const tingle_t *tingle)
+{
+   return results_rates(tingle->flags & ~tingle->primed);
+}
+
+/* Re-enumerate devices (CPUs, batteries) and take a new baseline. */
+void
+tingle_reload(tingle_t *tingle)
+{
+   results_shutdown(&tingle->results, tingle->flags);
+   results_init(&tingle->results, tingle->flags);
+   tingle->primed = 0;
+   tingle_baseline(tingle);
+}
+
+int
+tingle_flags(const tingle_t *tingle)
+{
+   return tingle->flags;
+}
+
+results_t *
+tingle_results(tingle_t *tingle)
+{
+   return &tingle->results;
+}
+
+/* Mean of a per-core percent array. Four independent sums let the
+ * compiler keep them in one vector register instead of serialising on
+ * a single accumulator. */
+float
+tingle_percent_avg(const float *percent, int count)
+{
+   float sum[4] = { 0, 0, 0, 0 };
+   int i;
+
+   if (count <= 0) return 0;
+
+   for (i = 0; i + 4 <= count; i += 4)
+     {
+        sum[0] += percent[i];
+        sum[1] += percent[i + 1];
+        sum[2] += percent[i + 2];
+        sum[3] += percent[i + 3];
+     }
+   for (; i < count; i++)
+     sum[0] += percent[i];
+
+   return (sum[0] + sum[1] + sum[2] + sum[3]) / count;
+}
+
+/* Saved state lets a one-shot run compute CPU, network and scheduler
+ * rates against the previous run instead of sleeping. Monotonic stamps
+ * only compare within one boot, so the file carries the boot id. */
+#define STATE_MAGIC    "tingle2"
+#define STATE_MAX_AGE  60.0
+#define STATE_MIN_AGE  0.2
+
+typedef struct
+{
+   char            magic[8];
+   char            boot_id[40];
+   uint64_t        stamp;
+   int             flags;
+   int             cpu_count;
+   int             iface_count;
+   unsigned long   ctxt;
+   unsigned long   intr;
+   unsigned long   forks;
+   uint64_t        sched_stamp;
+   uint64_t        net_stamp;
+} state_header_t;
+
+typedef struct
+{
+   char          name[IF_NAMESIZE];
+   unsigned int  ifindex;
+   unsigned long in;
+   unsigned long out;
+} state_iface_t;
+
+static bool
+_state_boot_id(char *boot_id, size_t size)
+{
+#if defined(__linux__)
+   ssize_t len;
+   int fd;
+
+   fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+   if (fd == -1) return false;
+
+   memset(boot_id, 0, size);
+   len = read(fd, boot_id, size - 1);
+   close(fd);
+   if (len <= 0) return false;
+
+   boot_id[strcspn(boot_id, "\n")] = '\0';
+
+   return true;
+#elif defined(KERN_BOOTTIME)
+   int mib[2] = { CTL_KERN, KERN_BOOTTIME };
+   struct timeval boottime;
+   size_t len = sizeof(boottime);
+
+   memset(boot_id, 0, size);
+   if (sysctl(mib, 2, &boottime, &len, NULL, 0) < 0)
+     return false;
+
+   snprintf(boot_id, size, "%ld.%ld", (long) boottime.tv_sec, (long) boottime.tv_usec);
+
+   return true;
+#else
+   (void) boot_id;
+   (void) size;
+   return false;
+#endif
+}
+
+/* Restore what the previous run saved. Returns false, leaving the
+ * handle untouched, when the state is missing, from another boot or
+ * system layout, or too old or too recent to give a useful rate. */
+bool
+tingle_state_load(tingle_t *tingle, const char *path)
+{
+   results_t *results = &tingle->results;
+   network_t *network = &results->network;
+   state_header_t header;
+   state_iface_t siface;
+   char boot_id[40];
+   double age;
+   FILE *f;
+   int i, idx;
+   bool ok = false;
+
+   if (!_state_boot_id(boot_id, sizeof(boot_id)))
+     return false;
+
+   f = fopen(path, "rb");
+   if (!f) return false;
+
+   if (fread(&header, sizeof(header), 1, f) != 1) goto out;
+   if (memcmp(header.magic, STATE_MAGIC, sizeof(header.magic))) goto out;
+   if (strncmp(header.boot_id, boot_id, sizeof(header.boot_id))) goto out;
+   if (header.flags != tingle->flags) goto out;
+   if (header.cpu_count != results->cpu_count) goto out;
+
+   age = _stamp_elapsed(header.stamp, _stamp_now());
+   if (age < STATE_MIN_AGE || age > STATE_MAX_AGE) goto out;
+
+   if ((tingle->flags & RESULTS_CPU) && results->cpu_count)
+     {
+        if (fread(results->cores.total, sizeof(unsigned long), results->cpu_count, f) != (size_t) results->cpu_count ||
+            fread(results->cores.idle, sizeof(unsigned long), results->cpu_count, f) != (size_t) results->cpu_count)
+          {
+             memset(results->cores.arena, 0, results->cpu_count * (2 * sizeof(unsigned long) + sizeof(float)));
+             goto out;
+          }
+     }
+
+   if (tingle->flags & RESULTS_SCHED)
+     {
+        results->sched.ctxt = header.ctxt;
+        results->sched.intr = header.intr;
+        results->sched.forks = header.forks;
+        results->sched.stamp = header.sched_stamp;
+     }
+
+   if (tingle->flags & RESULTS_NET)
+     {
+        /* Saved interfaces become the previous sample. */
+        for (i = 0; i < header.iface_count; i++)
+          {
+             if (fread(&siface, sizeof(siface), 1, f) != 1) break;
+             siface.name[IF_NAMESIZE - 1] = '\0';
+             if (network->slot_size && _network_iface_find(network, siface.ifindex) != -1)
+               continue;
+             idx = _network_iface_add(network, siface.name, siface.ifindex);
+             if (idx == -1) break;
+             network->ifaces[idx].in = siface.in;
+             network->ifaces[idx].out = siface.out;
+             network->ifaces[idx].valid = true;
+             network->ifaces[idx].seen = network->generation;
+             network->order[network->order_count++] = idx;
+          }
+        network->stamp = header.net_stamp;
+     }
+
+   tingle->primed |= tingle->flags & (RESULTS_CPU | RESULTS_NET);
+   ok = true;
+out:
+   fclose(f);
+
+   return ok;
+}
+
+/* Written to a temporary file and renamed so concurrent runs never read
+ * a partial state. */
+bool
+tingle_state_save(tingle_t *tingle, const char *path)
+{
+   results_t *results = &tingle->results;
+   network_t *network = &results->network;
+   state_header_t header;
+   state_iface_t siface;
+   net_iface_t *iface;
+   char tmp[PATH_MAX];
+   FILE *f;
+   int i;
+   bool ok = true;
+
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+   if (!_state_boot_id(header.boot_id, sizeof(header.boot_id)))
+     return false;
+
+   header.stamp = _stamp_now();
+   header.flags = tingle->flags;
+   header.cpu_count = results->cpu_count;
+   header.ctxt = results->sched.ctxt;
+   header.intr = results->sched.intr;
+   header.forks = results->sched.forks;
+   header.sched_stamp = results->sched.stamp;
+   header.net_stamp = network->stamp;
+
+   for (i = 0; i < network->order_count; i++)
+     {
+        if (network->ifaces[network->order[i]].valid)
+          header.iface_count++;
+     }
+
+   snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+   f = fopen(tmp, "wb");
+   if (!f) return false;
+
+   if (fwrite(&header, sizeof(header), 1, f) != 1)
+     ok = false;
+
+   if (ok && (tingle->flags & RESULTS_CPU) && results->cpu_count)
+     {
+        if (fwrite(results->cores.total, sizeof(unsigned long), results->cpu_count, f) != (size_t) results->cpu_count ||
+            fwrite(results->cores.idle, sizeof(unsigned long), results->cpu_count, f) != (size_t) results->cpu_count)
+          ok = false;
+     }
+
+   for (i = 0; ok && i < network->order_count; i++)
+     {
+        iface = &network->ifaces[network->order[i]];
+        if (!iface->valid) continue;
+
+        memset(&siface, 0, sizeof(siface));
+        memcpy(siface.name, iface->name, sizeof(siface.name));
+        siface.ifindex = iface->ifindex;
+        siface.in = iface->in;
+        siface.out = iface->out;
+        if (fwrite(&siface, sizeof(siface), 1, f) != 1)
+          ok = false;
+     }
+
+   if (fclose(f))
+     ok = false;
+
+   if (!ok || rename(tmp, path))
+     {
+        unlink(tmp);
+        return false;
+     }
+
+   return true;
+}
+
+const char *
+tingle_version(void)
+{
+   return TINGLE_VERSION;
+}
+
+/* Flags this build can honour: those of the collectors compiled in
+ * (see DISABLE in the makefile) and the display modifiers. */
+int
+tingle_collectors(void)
+{
+   int flags = RESULTS_MEM_MB | RESULTS_MEM_GB | RESULTS_CPU_CORES | RESULTS_NET_IFACES;
+   size_t i;
+
+   for (i = 0; i < COLLECTORS_COUNT; i++)
+     flags |= collectors[i].flag;
+
+   return flags;
+}
+
+/* Named fields. Most read a member of results_t directly; the rest are
+ * derived from several. Memory is in KB, network and I/O in bytes per
+ * second, frequencies in MHz and counters per second. */
+typedef enum
+{
+   FIELD_ULONG,
+   FIELD_UINT,
+   FIELD_UINT8,
+   FIELD_BOOL,
+   FIELD_DOUBLE,
+   FIELD_DERIVED,
+} field_type_t;
+
+typedef struct
+{
+   const char    *name;
+   int            flag;
+   field_type_t   type;
+   size_t         offset;
+   bool         (*get)(const results_t *results, double *value);
+} field_t;
+
+static bool
+_field_cpu_percent(const results_t *results, double *value)
+{
+   if (!results->cpu_count) return false;
+
+   *value = tingle_percent_avg(results->cores.percent, results->cpu_count);
+
+   return true;
+}
+
+static bool
+_field_mem_percent(const results_t *results, double *value)
+{
+   if (!results->memory.total) return false;
+
+   *value = results->memory.used * 100.0 / results->memory.total;
+
+   return true;
+}
+
+static bool
+_field_swap_percent(const results_t *results, double *value)
+{
+   if (!results->memory.swap_total) return false;
+
+   *value = results->memory.swap_used * 100.0 / results->memory.swap_total;
+
+   return true;
+}
+
+static bool
+_field_battery_percent(const results_t *results, double *value)
+{
+   const power_t *power = &results->power;
+   double total = 0;
+   int i;
+
+   if (!power->battery_count) return false;
+
+   for (i = 0; i < power->battery_count; i++)
+     total += power->percent[i];
+
+   *value = total / power->battery_count;
+
+   return true;
+}
+
+static bool
+_field_temperature(const results_t *results, double *value)
+{
+   if (results->temperature == INVALID_TEMP) return false;
+
+   *value = results->temperature;
+
+   return true;
+}
+
+/* Watts summed over every package for one kind of RAPL zone. */
+static bool
+_field_rapl(const results_t *results, int type, double *value)
+{
+   const rapl_t *rapl = &results->rapl;
+   bool found = false;
+   int i;
+
+   *value = 0;
+   for (i = 0; i < rapl->count; i++)
+     {
+        if (rapl->zones[i].type != type || !rapl->zones[i].valid) continue;
+        *value += rapl->zones[i].watts;
+        found = true;
+     }
+
+   return found;
+}
+
+static bool
+_field_rapl_package(const results_t *results, double *value)
+{
+   return _field_rapl(results, RAPL_PACKAGE, value);
+}
+
+static bool
+_field_rapl_core(const results_t *results, double *value)
+{
+   return _field_rapl(results, RAPL_CORE, value);
+}
+
+static bool
+_field_rapl_uncore(const results_t *results, double *value)
+{
+   return _field_rapl(results, RAPL_UNCORE, value);
+}
+
+static bool
+_field_rapl_dram(const results_t *results, double *value)
+{
+   return _field_rapl(results, RAPL_DRAM, value);
+}
+
+static bool
+_field_runq_wait(const results_t *results, double *value)
+{
+   if (!results->runq.valid) return false;
+
+   *value = results->runq.wait;
+
+   return true;
+}
+
+static bool
+_field_runq_delay(const results_t *results, double *value)
+{
+   if (!results->runq.valid) return false;
+
+   *value = results->runq.delay;
+
+   return true;
+}
+
+/* The hottest hwmon temperature, in degrees. */
+static bool
+_field_hwmon_temp(const results_t *results, double *value)
+{
+   const hwmon_sensor_t *sensor;
+   bool found = false;
+   int i;
+
+   for (i = 0; i < results->hwmon.count; i++)
+     {
+        sensor = &results->hwmon.sensors[i];
+        if (sensor->type != HWMON_TEMP || !sensor->valid) continue;
+        if (!found || sensor->value / 1000.0 > *value)
+          *value = sensor->value / 1000.0;
+        found = true;
+     }
+
+   return found;
+}
+
+/* The fullest mount is what matters for alerts. */
+static bool
+_field_fs_percent(const results_t *results, double *value)
+{
+   const filesystems_t *fs = &results->filesystems;
+   bool found = false;
+   int i;
+
+   for (i = 0; i < fs->count; i++)
+     {
+        if (!fs->mounts[i].valid) continue;
+        if (!found || fs->mounts[i].percent > *value)
+          *value = fs->mounts[i].percent;
+        found = true;
+     }
+
+   return found;
+}
+
+static bool
+_field_fs_inodes_percent(const results_t *results, double *value)
+{
+   const filesystems_t *fs = &results->filesystems;
+   bool found = false;
+   int i;
+
+   for (i = 0; i < fs->count; i++)
+     {
+        if (!fs->mounts[i].valid || !fs->mounts[i].inodes) continue;
+        if (!found || fs->mounts[i].inodes_percent > *value)
+          *value = fs->mounts[i].inodes_percent;
+        found = true;
+     }
+
+   return found;
+}
+
+static bool
+_field_cpu_freq(const results_t *results, double *value)
+{
+   const cpufreq_t *cpufreq = &results->cpufreq;
+   double total = 0;
+   int i;
+
+   if (!cpufreq->count) return false;
+
+   for (i = 0; i < cpufreq->count; i++)
+     total += cpufreq->cores[i].cur;
+
+   *value = total / cpufreq->count / 1000;
+
+   return true;
+}
+
+#define FIELD(name, flag, type, member) { name, flag, type, offsetof(results_t, member), NULL }
+#define FIELD_FN(name, flag, fn)        { name, flag, FIELD_DERIVED, 0, fn }
+
+static const field_t fields[] = {
+   FIELD_FN("cpu.percent", RESULTS_CPU, _field_cpu_percent),
+   FIELD_FN("cpu.freq", RESULTS_FREQ, _field_cpu_freq),
+   FIELD("mem.total", RESULTS_MEM, FIELD_ULONG, memory.total),
+   FIELD("mem.used", RESULTS_MEM, FIELD_ULONG, memory.used),
+   FIELD("mem.cached", RESULTS_MEM, FIELD_ULONG, memory.cached),
+   FIELD("mem.buffered", RESULTS_MEM, FIELD_ULONG, memory.buffered),
+   FIELD("mem.shared", RESULTS_MEM, FIELD_ULONG, memory.shared),
+   FIELD("mem.swap_total", RESULTS_MEM, FIELD_ULONG, memory.swap_total),
+   FIELD("mem.swap_used", RESULTS_MEM, FIELD_ULONG, memory.swap_used),
+   FIELD_FN("mem.percent", RESULTS_MEM, _field_mem_percent),
+   FIELD_FN("mem.swap_percent", RESULTS_MEM, _field_swap_percent),
+   FIELD("net.in", RESULTS_NET, FIELD_ULONG, incoming),
+   FIELD("net.out", RESULTS_NET, FIELD_ULONG, outgoing),
+   FIELD("power.ac", RESULTS_PWR, FIELD_BOOL, power.have_ac),
+   FIELD_FN("power.battery", RESULTS_PWR, _field_battery_percent),
+   FIELD_FN("temperature", RESULTS_TMP, _field_temperature),
+   FIELD("mixer.left", RESULTS_AUD, FIELD_UINT8, mixer.volume_left),
+   FIELD("mixer.right", RESULTS_AUD, FIELD_UINT8, mixer.volume_right),
+   FIELD("load.1", RESULTS_SCHED, FIELD_DOUBLE, sched.load[0]),
+   FIELD("load.5", RESULTS_SCHED, FIELD_DOUBLE, sched.load[1]),
+   FIELD("load.15", RESULTS_SCHED, FIELD_DOUBLE, sched.load[2]),
+   FIELD("sched.running", RESULTS_SCHED, FIELD_UINT, sched.running),
+   FIELD("sched.blocked", RESULTS_SCHED, FIELD_UINT, sched.blocked),
+   FIELD("sched.runnable", RESULTS_SCHED, FIELD_UINT, sched.runnable),
+   FIELD("sched.tasks", RESULTS_SCHED, FIELD_UINT, sched.tasks),
+   FIELD("sched.ctxt", RESULTS_SCHED, FIELD_ULONG, sched.ctxt_rate),
+   FIELD("sched.intr", RESULTS_SCHED, FIELD_ULONG, sched.intr_rate),
+   FIELD("sched.forks", RESULTS_SCHED, FIELD_ULONG, sched.fork_rate),
+   FIELD("tcp.retrans", RESULTS_NETSTAT, FIELD_ULONG, netstat.rates[NETSTAT_TCP_RETRANS_SEGS]),
+   FIELD("tcp.resets", RESULTS_NETSTAT, FIELD_ULONG, netstat.rates[NETSTAT_TCP_OUT_RSTS]),
+   FIELD("tcp.listen_drops", RESULTS_NETSTAT, FIELD_ULONG, netstat.rates[NETSTAT_TCP_LISTEN_DROPS]),
+   FIELD("tcp.established", RESULTS_NETSTAT, FIELD_ULONG, netstat.rates[NETSTAT_TCP_CURR_ESTAB]),
+   FIELD("udp.errors", RESULTS_NETSTAT, FIELD_ULONG, netstat.rates[NETSTAT_UDP_IN_ERRORS]),
+   FIELD("sockets", RESULTS_NETSTAT, FIELD_ULONG, netstat.sockets),
+   FIELD_FN("fs.percent", RESULTS_FS, _field_fs_percent),
+   FIELD_FN("fs.inodes_percent", RESULTS_FS, _field_fs_inodes_percent),
+   FIELD_FN("hwmon.temp", RESULTS_HWMON, _field_hwmon_temp),
+   FIELD_FN("runq.wait", RESULTS_RUNQ, _field_runq_wait),
+   FIELD_FN("runq.delay", RESULTS_RUNQ, _field_runq_delay),
+   FIELD_FN("power.package", RESULTS_ENERGY, _field_rapl_package),
+   FIELD_FN("power.core", RESULTS_ENERGY, _field_rapl_core),
+   FIELD_FN("power.uncore", RESULTS_ENERGY, _field_rapl_uncore),
+   FIELD_FN("power.dram", RESULTS_ENERGY, _field_rapl_dram),
+};
+
+#define FIELDS_COUNT ((int) (sizeof(fields) / sizeof(field_t)))
+
+int
+tingle_field_count(void)
+{
+   return FIELDS_COUNT;
+}
+
+const char *
+tingle_field_name(int field)
+{
+   if (field < 0 || field >= FIELDS_COUNT) return NULL;
+
+   return fields[field].name;
+}
+
+/* The collector flag a field needs. */
+int
+tingle_field_flag(int field)
+{
+   if (field < 0 || field >= FIELDS_COUNT) return 0;
+
+   return fields[field].flag;
+}
+
+int
+tingle_field_find(const char *name)
+{
+   int i;
+
+   for (i = 0; i < FIELDS_COUNT; i++)
+     {
+        if (!strcmp(fields[i].name, name))
+          return i;
+     }
+
+   return -1;
+}
+
+/* False when the field is unknown, its collector isn't enabled on the
+ * handle or the system doesn't provide it. */
+bool
+tingle_field_get(const tingle_t *tingle, int field, double *value)
+{
+   const field_t *f;
+   const char *p;
+
+   if (field < 0 || field >= FIELDS_COUNT) return false;
+
+   f = &fields[field];
+   if (!(tingle->flags & f->flag)) return false;
+
+   p = (const char *) &tingle->results + f->offset;
+
+   switch (f->type)
+     {
+      case FIELD_ULONG:
+        *value = *(const unsigned long *) p;
+        break;
+      case FIELD_UINT:
+        *value = *(const unsigned int *) p;
+        break;
+      case FIELD_UINT8:
+        *value = *(const uint8_t *) p;
+        break;
+      case FIELD_BOOL:
+        *value = *(const bool *) p;
+        break;
+      case FIELD_DOUBLE:
+        *value = *(const double *) p;
+        break;
+      case FIELD_DERIVED:
+        return f->get(&tingle->results, value);
+     }
+
+   return true;
+}
@@ -22,1548 +22,3914 @@
    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
-#define VERSION "0.9.0"
 #define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
-#include <stdint.h>
 #include <unistd.h>
-#include <dirent.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <math.h>
-#include <sys/types.h>
-#include <sys/param.h>
-#include <sys/sysctl.h>
-#include <sys/ioctl.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
-#include <net/if.h>
-#include <pthread.h>
-
-#if defined(__APPLE__) && defined(__MACH__)
-#define __MacOS__
-# include <mach/mach.h>
-# include <mach/vm_statistics.h>
-# include <mach/mach_types.h>
-# include <mach/mach_init.h>
-# include <mach/mach_host.h>
-# include <net/if_mib.h>
-# include <AudioToolBox/AudioServices.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+
+#include <sched.h>
+#include <sys/resource.h>
+
+#if defined(__linux__)
+# include <sys/prctl.h>
+# include <sys/epoll.h>
+# include <sys/timerfd.h>
+# include <sys/signalfd.h>
+#endif
+
+#include "tingle.h"
+
+static void
+_memsize_kb_to_mb(unsigned long *bytes)
+{
+   *bytes = (unsigned int)*bytes >> 10;
+}
+
+static void
+_memsize_kb_to_gb(unsigned long *bytes)
+{
+   *bytes = (unsigned int)*bytes >> 20;
+}
+
+static int
+percentage(int value, int max)
+{
+   double avg = (max / 100.0);
+   double tmp = value / avg;
+
+   return round(tmp);
+}
+
+static const char *
+_network_units(double *incoming, double *outgoing)
+{
+   const char *unit = "B/s";
+
+   if ((*incoming > 1048576) || (*outgoing > 1048576))
+     {
+        *incoming /= 1048576;
+        *outgoing /= 1048576;
+        unit = "MB/s";
+     }
+   else if (((*incoming > 1024) && (*incoming < 1048576)) ||
+            ((*outgoing > 1024) && (*outgoing < 1048576)))
+     {
+        *incoming /= 1024;
+        *outgoing /= 1024;
+        unit = "KB/s";
+     }
+
+   return unit;
+}
+
+/* Utilisation of the busier direction as a percentage of the link
+ * speed (Mbit/s), or -1 when the speed isn't known. */
+static int
+_network_iface_util(net_iface_t *iface)
+{
+   unsigned long busiest;
+
+   if (!iface->speed)
+     return -1;
+
+   busiest = iface->incoming > iface->outgoing ? iface->incoming : iface->outgoing;
+
+   return round((busiest * 8.0) / (iface->speed * 10000.0));
+}
+
+/* Per-node CPU usage from the per-core figures. */
+static double
+_numa_node_cpu_percent(results_t *results, numa_node_t *node)
+{
+   double percent = 0;
+   int i, count = 0;
+
+   for (i = 0; i < node->cpu_count; i++)
+     {
+        if (node->cpus[i] >= results->cpu_count) continue;
+        percent += results->cores.percent[node->cpus[i]];
+        count++;
+     }
+
+   return count ? percent / count : 0;
+}
+
+/* Average current frequency (kHz) of a package's cores. */
+static unsigned long
+_cpufreq_package_avg(cpufreq_t *cpufreq, int package)
+{
+   unsigned long total = 0;
+   int i, count = 0;
+
+   for (i = 0; i < cpufreq->count; i++)
+     {
+        if (cpufreq->cores[i].package != package) continue;
+        total += cpufreq->cores[i].cur;
+        count++;
+     }
+
+   return count ? total / count : 0;
+}
+
+/* At or over the critical, or failing that the maximum, threshold. */
+static bool
+_hwmon_alarm(const hwmon_sensor_t *sensor)
+{
+   if (sensor->crit)
+     return sensor->value >= sensor->crit;
+
+   return sensor->max && sensor->value >= sensor->max;
+}
+
+static const hwmon_sensor_t *
+_hwmon_core(const hwmon_t *hw, int cpu)
+{
+   const hwmon_sensor_t *sensor;
+
+   if (!hw->cpus || cpu >= hw->cpu_count || hw->cpus[cpu] == -1)
+     return NULL;
+
+   sensor = &hw->sensors[hw->cpus[cpu]];
+
+   return sensor->valid ? sensor : NULL;
+}
+
+static void
+_hwmon_core_pretty(const hwmon_t *hw, int cpu)
+{
+   const hwmon_sensor_t *sensor = _hwmon_core(hw, cpu);
+
+   if (sensor)
+     printf(" %.0fC", sensor->value / 1000.0);
+}
+
+static void
+results_pretty(results_t *results, int *order, int count)
+{
+   int i, j, flags, units = 0;
+
+   /* Node memory is shown in the unit of -k, -m or -g, MB otherwise. */
+   for (i = 0; i < count; i++)
+     {
+        if (order[i] & RESULTS_MEM)
+          units = order[i];
+     }
+
+   for (i = 0; i < count; i++) {
+        flags = order[i];
+        if (flags & RESULTS_CPU_CORES)
+          {
+             if (results->cpu_count > 1)
+               printf(" [CPUs]: ");
+             else
+               printf(" [CPU]: ");
+             for (j = 0; j < results->cpu_count; j++) {
+                  printf("%.2f%%", results->cores.percent[j]);
+                  _hwmon_core_pretty(&results->hwmon, j);
+                  if (j < (results->cpu_count - 1))
+                    printf(" ");
+               }
+          }
+        else if (flags & RESULTS_CPU)
+          {
+             printf(" [CPU]: %.2f%%", tingle_percent_avg(results->cores.percent, results->cpu_count));
+          }
+
+        if (flags & RESULTS_MEM)
+          {
+             unsigned long used = results->memory.used;
+             unsigned long total = results->memory.total;
+             char unit;
+
+             if (flags & RESULTS_MEM_GB)
+               {
+                  unit = 'G';
+                  _memsize_kb_to_gb(&used);
+                  _memsize_kb_to_gb(&total);
+               }
+             else if (flags & RESULTS_MEM_MB)
+               {
+                  unit = 'M';
+                  _memsize_kb_to_mb(&used);
+                  _memsize_kb_to_mb(&total);
+               }
+             else
+               unit = 'K';
+
+             printf(" [MEM]: %lu/%lu%c", used, total, unit);
+          }
+
+        if (flags & RESULTS_NET_IFACES)
+          {
+             network_t *network = &results->network;
+             printf(" [NET]");
+             for (j = 0; j < network->order_count; j++)
+               {
+                  net_iface_t *iface = &network->ifaces[network->order[j]];
+                  if (!iface->included) continue;
+
+                  double incoming = iface->incoming;
+                  double outgoing = iface->outgoing;
+                  const char *unit = _network_units(&incoming, &outgoing);
+                  int util = _network_iface_util(iface);
+
+                  printf(" %s %.2f/%.2f %s", iface->name, incoming, outgoing, unit);
+                  if (util != -1)
+                    printf(" %d%%", util);
+               }
+          }
+        else if (flags & RESULTS_NET)
+          {
+             double incoming = results->incoming;
+             double outgoing = results->outgoing;
+             const char *unit = _network_units(&incoming, &outgoing);
+
+             printf(" [NET] %.2f/%.2f %s", incoming, outgoing, unit);
+          }
+
+        if (flags & RESULTS_SCHED)
+          {
+             sched_t *sched = &results->sched;
+
+             printf(" [LOAD]: %.2f %.2f %.2f", sched->load[0], sched->load[1], sched->load[2]);
+#if defined(__linux__)
+             printf(" %u/%u blk %u", sched->runnable, sched->tasks, sched->blocked);
+#endif
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__DragonFly__)
+             printf(" cs %lu/s fork %lu/s", sched->ctxt_rate, sched->fork_rate);
+#endif
+          }
+
+        if (flags & RESULTS_PROCS)
+          {
+             for (j = 0; j < results->procs.count; j++)
+               {
+                  proc_t *proc = &results->procs.procs[j];
+                  double rd = proc->read_rate, wr = proc->write_rate;
+                  const char *unit;
+
+                  if (!proc->alive)
+                    {
+                       printf(" [%s:%d]: exited", proc->comm, (int) proc->pid);
+                       continue;
+                    }
+
+                  unit = _network_units(&rd, &wr);
+                  printf(" [%s:%d]: %.2f%% %luM %ut io %.2f/%.2f %s", proc->comm,
+                         (int) proc->pid, proc->percent, proc->rss >> 10,
+                         proc->threads, rd, wr, unit);
+               }
+          }
+
+        if (flags & RESULTS_FS)
+          {
+             filesystems_t *fs = &results->filesystems;
+
+             printf(" [FS]:");
+             for (j = 0; j < fs->count; j++)
+               {
+                  fs_mount_t *m = &fs->mounts[j];
+                  if (!m->valid) continue;
+
+                  printf(" %s %.0f%%", m->mount, m->percent);
+                  if (m->inodes_percent > m->percent)
+                    printf(" (inodes %.0f%%)", m->inodes_percent);
+               }
+          }
+
+        if (flags & RESULTS_RUNQ)
+          {
+             if (results->runq.valid)
+               printf(" [RUNQ]: %.2fms/s %.0fus", results->runq.wait, results->runq.delay);
+          }
+
+        if (flags & RESULTS_ENERGY)
+          {
+             rapl_t *rapl = &results->rapl;
+
+             printf(" [RAPL]:");
+             for (j = 0; j < rapl->count; j++)
+               {
+                  if (rapl->zones[j].valid)
+                    printf(" %s %.1fW", rapl->zones[j].name, rapl->zones[j].watts);
+               }
+          }
+
+        if (flags & RESULTS_HWMON)
+          {
+             hwmon_t *hw = &results->hwmon;
+
+             printf(" [HWMON]:");
+             for (j = 0; j < hw->count; j++)
+               {
+                  hwmon_sensor_t *s = &hw->sensors[j];
+                  if (!s->valid || s->type == HWMON_IN) continue;
+
+                  if (s->type == HWMON_TEMP)
+                    printf(" %s %.0fC", s->label, s->value / 1000.0);
+                  else
+                    printf(" %s %ldrpm", s->label, s->value);
+                  if (_hwmon_alarm(s))
+                    printf("!");
+               }
+          }
+
+        if (flags & RESULTS_NETSTAT)
+          {
+             unsigned long *rates = results->netstat.rates;
+             unsigned long out = rates[NETSTAT_TCP_OUT_SEGS];
+
+             printf(" [TCP]: %lu est %lu retrans/s (%.1f%%) %lu drops/s",
+                    rates[NETSTAT_TCP_CURR_ESTAB], rates[NETSTAT_TCP_RETRANS_SEGS],
+                    out ? (rates[NETSTAT_TCP_RETRANS_SEGS] * 100.0) / out : 0.0,
+                    rates[NETSTAT_TCP_LISTEN_DROPS]);
+             printf(" [UDP]: %lu errors/s", rates[NETSTAT_UDP_IN_ERRORS]);
+          }
+
+        if (flags & RESULTS_IRQS)
+          {
+             irqs_t *irqs = &results->irqs;
+             unsigned long softirqs = 0, hardirqs = 0;
+
+             for (j = 0; j < irqs->type_count; j++)
+               {
+                  if (!strcmp(irqs->types[j].name, "IRQ"))
+                    hardirqs = irqs->types[j].total;
+                  else
+                    softirqs += irqs->types[j].total;
+               }
+             printf(" [IRQ]: %lu/%lu/s", hardirqs, softirqs);
+
+             for (j = 0; j < irqs->type_count; j++)
+               {
+                  irq_type_t *type = &irqs->types[j];
+                  if (type->imbalanced)
+                    printf(" %s!cpu%d %d%%", type->name, irqs->cpus[type->busiest], type->share);
+               }
+          }
+
+        if (flags & RESULTS_FREQ)
+          {
+             cpufreq_t *cpufreq = &results->cpufreq;
+
+             printf(" [FREQ]:");
+             for (j = 0; j < cpufreq->packages; j++)
+               {
+                  if (cpufreq->packages > 1)
+                    printf(" P%d", j);
+                  printf(" %.2fGHz", _cpufreq_package_avg(cpufreq, j) / 1e6);
+               }
+          }
+
+        if (flags & RESULTS_NUMA)
+          {
+             for (j = 0; j < results->numa.node_count; j++)
+               {
+                  numa_node_t *node = &results->numa.nodes[j];
+                  unsigned long used = node->mem_used, total = node->mem_total;
+                  char unit;
+
+                  if (units & RESULTS_MEM_GB)
+                    {
+                       unit = 'G';
+                       _memsize_kb_to_gb(&used);
+                       _memsize_kb_to_gb(&total);
+                    }
+                  else if (units && !(units & RESULTS_MEM_MB))
+                    unit = 'K';
+                  else
+                    {
+                       unit = 'M';
+                       _memsize_kb_to_mb(&used);
+                       _memsize_kb_to_mb(&total);
+                    }
+
+                  printf(" [N%d]: %.2f%% %lu/%lu%c", node->id,
+                         _numa_node_cpu_percent(results, node), used, total, unit);
+                  if (node->miss || node->foreign)
+                    printf(" %lu miss/s %lu foreign/s", node->miss, node->foreign);
+               }
+          }
+
+        if (flags & RESULTS_TMP)
+          {
+             if (results->temperature != INVALID_TEMP)
+               printf(" [T]: %dC", results->temperature);
+          }
+
+        if (flags & RESULTS_AUD)
+          {
+             if (results->mixer.enabled)
+               {
+                  uint8_t level =
+                    results->mixer.volume_right >
+                    results->mixer.volume_left ? results->mixer.
+                    volume_right : results->mixer.volume_left;
+#if defined(__MacOS__) || defined(__linux__) || defined(__FreeBSD__) || defined(__DragonFly__)
+                  uint8_t perc = percentage(level, 100);
+                  printf(" [VOL]: %d%%", perc);
+#elif defined(__OpenBSD__) || defined(__NetBSD__)
+                  uint8_t perc = percentage(level, 255);
+                  printf(" [VOL]: %d%%", perc);
 #endif
+               }
+          }
+
+        if (flags & RESULTS_PWR)
+          {
+             if (results->power.have_ac)
+	       printf(" [AC]");
+             else
+	       printf(" [DC]");
+
+	     if (results->power.battery_count != 0)
+	       printf(":");
+
+             for (int i = 0; i < results->power.battery_count; i++)
+               {
+                  printf(" %d%%", results->power.percent[i]);
+               }
+          }
+
+     }
+}
+
+static void
+results_cpu(results_t *results, int flags)
+{
+   const hwmon_sensor_t *sensor;
+   int i, cpu_count = results->cpu_count;
+
+   if (flags & RESULTS_CPU_CORES)
+     {
+        for (i = 0; i < cpu_count; i++)
+          printf("%.2f ", results->cores.percent[i]);
+     }
+   else
+     printf("%.2f", tingle_percent_avg(results->cores.percent, cpu_count));
+
+   printf("\n");
+
+   /* With -H, per core temperatures follow on a line of their own. */
+   if (!(flags & RESULTS_CPU_CORES) || !results->hwmon.cpus)
+     return;
+
+   for (i = 0; i < cpu_count; i++)
+     {
+        sensor = _hwmon_core(&results->hwmon, i);
+        if (sensor)
+          printf("%.1f ", sensor->value / 1000.0);
+        else
+          printf("- ");
+     }
+   printf("\n");
+}
+
+static void
+results_mem(meminfo_t *mem, int flags)
+{
+   unsigned long total, used, cached, buffered;
+   unsigned long shared, swap_total, swap_used;
+
+   total = mem->total;
+   used = mem->used;
+   cached = mem->cached;
+   buffered = mem->buffered;
+   shared = mem->shared;
+   swap_total = mem->swap_total;
+   swap_used = mem->swap_used;
+
+   if (flags & RESULTS_MEM_MB)
+     {
+        _memsize_kb_to_mb(&total);
+        _memsize_kb_to_mb(&used);
+        _memsize_kb_to_mb(&cached);
+        _memsize_kb_to_mb(&buffered);
+        _memsize_kb_to_mb(&shared);
+        _memsize_kb_to_mb(&swap_total);
+        _memsize_kb_to_mb(&swap_used);
+     }
+   else if (flags & RESULTS_MEM_GB)
+     {
+        _memsize_kb_to_gb(&total);
+        _memsize_kb_to_gb(&used);
+        _memsize_kb_to_gb(&cached);
+        _memsize_kb_to_gb(&buffered);
+        _memsize_kb_to_gb(&shared);
+        _memsize_kb_to_gb(&swap_total);
+        _memsize_kb_to_gb(&swap_used);
+     }
+
+   printf("%lu %lu %lu %lu %lu %lu %lu\n",
+          total, used, cached, buffered, shared, swap_total, swap_used);
+}
+
+static void
+results_power(power_t *power)
+{
+   printf("%d", power->have_ac);
+   for (int i = 0; i < power->battery_count; i++)
+     {
+        printf(" %d", power->percent[i]);
+     }
+
+   printf("\n");
+}
+
+static void
+results_temperature(int temp)
+{
+   printf("%d\n", temp);
+}
+
+static void
+results_network(results_t *results, int flags)
+{
+   network_t *network = &results->network;
+   net_iface_t *iface;
+   int i;
+
+   if (!(flags & RESULTS_NET_IFACES))
+     {
+        printf("%lu %lu\n", results->incoming, results->outgoing);
+        return;
+     }
+
+   for (i = 0; i < network->order_count; i++)
+     {
+        iface = &network->ifaces[network->order[i]];
+        if (!iface->included) continue;
+        printf("%s %lu %lu %d\n", iface->name, iface->incoming, iface->outgoing,
+               _network_iface_util(iface));
+     }
+}
+
+static void
+results_numa(results_t *results)
+{
+   numa_node_t *node;
+   int i;
+
+   for (i = 0; i < results->numa.node_count; i++)
+     {
+        node = &results->numa.nodes[i];
+        printf("%d %.2f %lu %lu %lu %lu %lu %lu\n", node->id,
+               _numa_node_cpu_percent(results, node), node->mem_total,
+               node->mem_used, node->mem_free, node->hit, node->miss,
+               node->foreign);
+     }
+}
+
+static void
+results_sched(sched_t *sched)
+{
+   printf("%.2f %.2f %.2f %u %u %u %u %lu %lu %lu\n",
+          sched->load[0], sched->load[1], sched->load[2],
+          sched->running, sched->blocked, sched->runnable, sched->tasks,
+          sched->ctxt_rate, sched->intr_rate, sched->fork_rate);
+}
+
+static void
+results_procs(procs_t *procs)
+{
+   proc_t *proc;
+   int i;
+
+   for (i = 0; i < procs->count; i++)
+     {
+        proc = &procs->procs[i];
+        printf("%d %s %d %.2f %lu %lu %u %lu %lu %lu %lu\n", (int) proc->pid,
+               proc->comm[0] ? proc->comm : "-", proc->alive, proc->percent,
+               proc->rss, proc->pss, proc->threads, proc->voluntary_rate,
+               proc->involuntary_rate, proc->read_rate, proc->write_rate);
+     }
+}
+
+static void
+results_filesystems(filesystems_t *fs)
+{
+   fs_mount_t *m;
+   int i;
+
+   for (i = 0; i < fs->count; i++)
+     {
+        m = &fs->mounts[i];
+        if (!m->valid) continue;
+        printf("%s %s %s %llu %llu %llu %.2f %llu %llu %llu %.2f\n", m->mount,
+               m->type, m->source, (unsigned long long) m->total,
+               (unsigned long long) m->used, (unsigned long long) m->avail,
+               m->percent, (unsigned long long) m->inodes,
+               (unsigned long long) m->inodes_used,
+               (unsigned long long) m->inodes_free, m->inodes_percent);
+     }
+}
+
+/* wait delay for the machine, then cpuN wait delay per CPU. */
+static void
+results_runq(runq_t *runq)
+{
+   int i;
+
+   if (!runq->valid) return;
+
+   printf("all %.3f %.3f\n", runq->wait, runq->delay);
+   for (i = 0; i < runq->count; i++)
+     printf("cpu%d %.3f %.3f\n", runq->cpus[i].cpu, runq->cpus[i].wait, runq->cpus[i].delay);
+}
+
+/* zone watts energy_uj */
+static void
+results_rapl(rapl_t *rapl)
+{
+   rapl_zone_t *zone;
+   int i;
+
+   for (i = 0; i < rapl->count; i++)
+     {
+        zone = &rapl->zones[i];
+        if (!zone->valid) continue;
+        printf("%s %.2f %llu\n", zone->name, zone->watts, (unsigned long long) zone->energy);
+     }
+}
+
+/* hwmonN chip type value max crit label, in degrees C, RPM or volts;
+ * the label comes last as it may hold spaces. */
+static void
+results_hwmon(hwmon_t *hw)
+{
+   static const char *types[HWMON_TYPES] = { "temp", "fan", "in" };
+   static const double scales[HWMON_TYPES] = { 1000.0, 1.0, 1000.0 };
+   hwmon_sensor_t *s;
+   double scale;
+   int i;
+
+   for (i = 0; i < hw->count; i++)
+     {
+        s = &hw->sensors[i];
+        scale = scales[s->type];
+        printf("hwmon%d %s %s ", s->hwmon, s->chip, types[s->type]);
+        if (s->valid)
+          printf("%.*f ", s->type == HWMON_FAN ? 0 : 3, s->value / scale);
+        else
+          printf("- ");
+        if (s->max)
+          printf("%.*f ", s->type == HWMON_FAN ? 0 : 3, s->max / scale);
+        else
+          printf("- ");
+        if (s->crit)
+          printf("%.*f ", s->type == HWMON_FAN ? 0 : 3, s->crit / scale);
+        else
+          printf("- ");
+        printf("%s\n", s->label);
+     }
+}
+
+static void
+results_netstat(netstat_t *netstat)
+{
+   int i;
+
+   for (i = 0; i < NETSTAT_COUNTERS; i++)
+     {
+        if (netstat->index[i].file == -1) continue;
+        printf("%s.%s %lu\n", tingle_netstat_counters[i].section,
+               tingle_netstat_counters[i].name, netstat->rates[i]);
+     }
+
+   printf("Sockstat.Sockets %lu\n", netstat->sockets);
+   printf("Sockstat.TcpInuse %lu\n", netstat->tcp_inuse);
+   printf("Sockstat.TcpOrphan %lu\n", netstat->tcp_orphan);
+   printf("Sockstat.TcpTimeWait %lu\n", netstat->tcp_tw);
+   printf("Sockstat.TcpAlloc %lu\n", netstat->tcp_alloc);
+   printf("Sockstat.UdpInuse %lu\n", netstat->udp_inuse);
+}
+
+static void
+results_irqs(irqs_t *irqs)
+{
+   irq_type_t *type;
+   int i, j;
+
+   for (i = 0; i < irqs->type_count; i++)
+     {
+        type = &irqs->types[i];
+        printf("%s %lu %d %d %d", type->name, type->total,
+               irqs->cpus[type->busiest], type->share,
+               type->imbalanced);
+        for (j = 0; j < irqs->columns; j++)
+          printf(" %lu", type->rates[j]);
+        printf("\n");
+     }
+}
+
+static void
+results_cpufreq(cpufreq_t *cpufreq)
+{
+   cpu_freq_t *core;
+   int i;
+
+   for (i = 0; i < cpufreq->count; i++)
+     {
+        core = &cpufreq->cores[i];
+        printf("%d %lu %lu %lu\n", core->package, core->cur / 1000,
+               core->min / 1000, core->max / 1000);
+     }
+}
+
+static void
+results_mixer(mixer_t *mixer)
+{
+   if (!mixer->enabled)
+     return;
+
+   printf("%d %d\n", mixer->volume_left, mixer->volume_right);
+}
+
+static void
+results_verbose(results_t *results, int *order, int count)
+{
+   int i, flags;
+   for (i = 0; i < count; i++) {
+        flags = order[i];
+        if (flags & RESULTS_CPU)
+          results_cpu(results, flags);
+        else if (flags & RESULTS_MEM)
+          results_mem(&results->memory, flags);
+        else if (flags & RESULTS_PWR)
+          results_power(&results->power);
+        else if (flags & RESULTS_TMP)
+          results_temperature(results->temperature);
+        else if (flags & RESULTS_NET)
+          results_network(results, flags);
+        else if (flags & RESULTS_AUD)
+          results_mixer(&results->mixer);
+        else if (flags & RESULTS_NUMA)
+          results_numa(results);
+        else if (flags & RESULTS_FREQ)
+          results_cpufreq(&results->cpufreq);
+        else if (flags & RESULTS_SCHED)
+          results_sched(&results->sched);
+        else if (flags & RESULTS_IRQS)
+          results_irqs(&results->irqs);
+        else if (flags & RESULTS_NETSTAT)
+          results_netstat(&results->netstat);
+        else if (flags & RESULTS_PROCS)
+          results_procs(&results->procs);
+        else if (flags & RESULTS_FS)
+          results_filesystems(&results->filesystems);
+        else if (flags & RESULTS_HWMON)
+          results_hwmon(&results->hwmon);
+        else if (flags & RESULTS_ENERGY)
+          results_rapl(&results->rapl);
+        else if (flags & RESULTS_RUNQ)
+          results_runq(&results->runq);
+     }
+}
+
+/* Alert rules (-e). A rule is a list of comparisons joined by "and",
+ * e.g. "cpu > 90 for 10s" or "battery < 10 and not ac : cmd". Rules are
+ * compiled once into a flat array of comparisons over library fields;
+ * each sample reads every field used once and walks that array. A rule
+ * fires after holding for its duration, then stays active until one of
+ * its comparisons is false by more than the hysteresis margin. */
+enum
+{
+   RULE_GT,
+   RULE_GE,
+   RULE_LT,
+   RULE_LE,
+   RULE_EQ,
+   RULE_NE,
+};
+
+typedef struct
+{
+   int     field;
+   int     op;
+   double  value;
+   double  clear;
+} rule_cmp_t;
+
+typedef struct
+{
+   char           *text;
+   const char     *command;
+   int             first;
+   int             count;
+   double          hold;
+   double          cooldown;
+   bool            pending;
+   bool            active;
+   bool            fired_once;
+   struct timespec since;
+   struct timespec fired;
+} rule_t;
+
+typedef struct
+{
+   rule_cmp_t *cmps;
+   int         cmp_count;
+   rule_t     *rules;
+   int         count;
+   int        *fields;
+   int         field_count;
+   double     *values;
+   bool       *valid;
+   int         flags;
+} rules_t;
+
+static const struct
+{
+   const char *alias;
+   const char *name;
+} rule_aliases[] = {
+   { "cpu",     "cpu.percent" },
+   { "freq",    "cpu.freq" },
+   { "mem",     "mem.used" },
+   { "swap",    "mem.swap_used" },
+   { "temp",    "temperature" },
+   { "battery", "power.battery" },
+   { "ac",      "power.ac" },
+   { "load",    "load.1" },
+   { "disk",    "fs.percent" },
+};
+
+static int
+_rule_field(char **tokens, int count, int *used)
+{
+   char name[64];
+   size_t i;
+   int field;
+
+   /* "net in" is net.in. */
+   if (count > 1)
+     {
+        snprintf(name, sizeof(name), "%s.%s", tokens[0], tokens[1]);
+        field = tingle_field_find(name);
+        if (field != -1)
+          {
+             *used = 2;
+             return field;
+          }
+     }
+
+   *used = 1;
+   for (i = 0; i < sizeof(rule_aliases) / sizeof(rule_aliases[0]); i++)
+     {
+        if (!strcasecmp(tokens[0], rule_aliases[i].alias))
+          return tingle_field_find(rule_aliases[i].name);
+     }
+
+   return tingle_field_find(tokens[0]);
+}
+
+static bool
+_rule_percent(int field)
+{
+   const char *name = tingle_field_name(field);
+
+   return strstr(name, "percent") || !strcmp(name, "power.battery");
+}
+
+/* "mem > 90%" compares the share in use rather than the size. */
+static int
+_rule_field_percent(int field, const char *token)
+{
+   size_t len = strlen(token);
+
+   if (!len || token[len - 1] != '%') return field;
+   if (field == tingle_field_find("mem.used"))
+     return tingle_field_find("mem.percent");
+   if (field == tingle_field_find("mem.swap_used"))
+     return tingle_field_find("mem.swap_percent");
+
+   return field;
+}
+
+/* 100, 95%, 85C, 1.5G, 100MB/s. Sizes are in bytes, memory fields
+ * are in KB; % is only taken for percentages. */
+static bool
+_rule_number(const char *token, double *value, int field)
+{
+   char *end;
+   double v, scale = 1;
+
+   v = strtod(token, &end);
+   if (end == token) return false;
+
+   if (*end == 'K' || *end == 'k') scale = 1024, end++;
+   else if (*end == 'M') scale = 1048576, end++;
+   else if (*end == 'G') scale = 1073741824.0, end++;
+   if (scale > 1 && field != -1 && tingle_field_flag(field) == RESULTS_MEM)
+     scale /= 1024;
+   v *= scale;
+   if (*end == '%' && field != -1 && !_rule_percent(field)) return false;
+   if (*end == 'B' || *end == '%' || *end == 'C') end++;
+   if (!strcmp(end, "/s")) end += 2;
+
+   *value = v;
+
+   return *end == '\0';
+}
+
+/* 10, 10s, 500ms, 5m or 1h, in seconds. */
+static bool
+_rule_duration(const char *token, double *seconds)
+{
+   char *end;
+   double v;
+
+   v = strtod(token, &end);
+   if (end == token || v < 0) return false;
+
+   if (!strcmp(end, "ms")) v /= 1000;
+   else if (!strcmp(end, "m")) v *= 60;
+   else if (!strcmp(end, "h")) v *= 3600;
+   else if (!strcmp(end, "d")) v *= 86400;
+   else if (*end && strcmp(end, "s")) return false;
+
+   *seconds = v;
+
+   return true;
+}
+
+static int
+_rule_op(const char *token)
+{
+   if (!strcmp(token, ">")) return RULE_GT;
+   if (!strcmp(token, ">=")) return RULE_GE;
+   if (!strcmp(token, "<")) return RULE_LT;
+   if (!strcmp(token, "<=")) return RULE_LE;
+   if (!strcmp(token, "==") || !strcmp(token, "=")) return RULE_EQ;
+   if (!strcmp(token, "!=")) return RULE_NE;
+
+   return -1;
+}
+
+static bool
+_rule_cmp_add(rules_t *rules, int field, int op, double value)
+{
+   rule_cmp_t *tmp;
+
+   tmp = realloc(rules->cmps, (rules->cmp_count + 1) * sizeof(rule_cmp_t));
+   if (!tmp) return false;
+
+   rules->cmps = tmp;
+   rules->cmps[rules->cmp_count].field = field;
+   rules->cmps[rules->cmp_count].op = op;
+   rules->cmps[rules->cmp_count].value = value;
+   rules->cmps[rules->cmp_count].clear = value;
+   rules->cmp_count++;
+
+   rules->flags |= tingle_field_flag(field);
+
+   return true;
+}
+
+/* Parse one rule. Returns false with a reason on error. */
+static bool
+rules_add(rules_t *rules, const char *text, const char **error)
+{
+   char *copy, *colon, *tokens[64], *save = NULL, *tok;
+   rule_t *tmp, *rule;
+   double hysteresis = 0, value;
+   int i, count = 0, used, field, op, first = rules->cmp_count;
+   bool negate;
+
+   *error = NULL;
+
+   copy = strdup(text);
+   if (!copy) return false;
+
+   tmp = realloc(rules->rules, (rules->count + 1) * sizeof(rule_t));
+   if (!tmp)
+     {
+        free(copy);
+        return false;
+     }
+   rules->rules = tmp;
+   rule = &rules->rules[rules->count];
+   memset(rule, 0, sizeof(rule_t));
+
+   colon = strchr(copy, ':');
+   if (colon)
+     {
+        *colon = '\0';
+        rule->command = text + (colon - copy) + 1;
+        while (isspace(*rule->command)) rule->command++;
+     }
+
+   /* The condition alone names the rule in events. */
+   rule->text = strdup(copy);
+   if (!rule->text)
+     {
+        free(copy);
+        return false;
+     }
+   tok = rule->text + strlen(rule->text);
+   while (tok > rule->text && isspace(tok[-1]))
+     *--tok = '\0';
+
+   for (tok = strtok_r(copy, " \t", &save); tok && count < 64; tok = strtok_r(NULL, " \t", &save))
+     tokens[count++] = tok;
+
+   *error = NULL;
+   for (i = 0; i < count && !*error;)
+     {
+        if (!strcmp(tokens[i], "for") || !strcmp(tokens[i], "cooldown"))
+          {
+             if (i + 1 >= count || !_rule_duration(tokens[i + 1], tokens[i][0] == 'f' ? &rule->hold : &rule->cooldown))
+               *error = "invalid duration";
+             i += 2;
+             continue;
+          }
+        if (!strcmp(tokens[i], "hyst"))
+          {
+             if (i + 1 >= count || !_rule_number(tokens[i + 1], &hysteresis, -1))
+               *error = "invalid hysteresis";
+             i += 2;
+             continue;
+          }
+        if (!strcmp(tokens[i], "and"))
+          {
+             i++;
+             continue;
+          }
+
+        negate = !strcmp(tokens[i], "not");
+        if (negate) i++;
+        if (i >= count)
+          {
+             *error = "missing field";
+             break;
+          }
+
+        field = _rule_field(&tokens[i], count - i, &used);
+        if (field == -1)
+          {
+             *error = "unknown field";
+             break;
+          }
+        i += used;
+
+        if (i + 1 < count && (op = _rule_op(tokens[i])) != -1)
+          {
+             field = _rule_field_percent(field, tokens[i + 1]);
+             if (negate || !_rule_number(tokens[i + 1], &value, field))
+               {
+                  *error = "invalid comparison";
+                  break;
+               }
+             i += 2;
+          }
+        else
+          {
+             /* A bare field is true when non-zero. */
+             op = negate ? RULE_EQ : RULE_NE;
+             value = 0;
+          }
+
+        if (!_rule_cmp_add(rules, field, op, value))
+          *error = "out of memory";
+     }
+
+   if (!*error && rules->cmp_count == first)
+     *error = "no condition";
+
+   free(copy);
+
+   if (*error)
+     {
+        free(rule->text);
+        rules->cmp_count = first;
+        return false;
+     }
+
+   /* Crossing back needs to clear the threshold by the margin. */
+   for (i = first; i < rules->cmp_count; i++)
+     {
+        rule_cmp_t *cmp = &rules->cmps[i];
+        if (cmp->op == RULE_GT || cmp->op == RULE_GE)
+          cmp->clear = cmp->value - hysteresis;
+        else if (cmp->op == RULE_LT || cmp->op == RULE_LE)
+          cmp->clear = cmp->value + hysteresis;
+     }
+
+   rule->first = first;
+   rule->count = rules->cmp_count - first;
+   rules->count++;
+
+   return true;
+}
+
+/* Distinct fields, read once per sample. */
+static bool
+rules_compile(rules_t *rules)
+{
+   int i, j, n = tingle_field_count();
+   bool *used;
+
+   if (!rules->count) return true;
+
+   used = calloc(n, sizeof(bool));
+   rules->fields = malloc(n * sizeof(int));
+   rules->values = calloc(n, sizeof(double));
+   rules->valid = calloc(n, sizeof(bool));
+   if (!used || !rules->fields || !rules->values || !rules->valid)
+     {
+        free(used);
+        return false;
+     }
+
+   for (i = 0; i < rules->cmp_count; i++)
+     used[rules->cmps[i].field] = true;
+   for (i = j = 0; i < n; i++)
+     {
+        if (used[i])
+          rules->fields[j++] = i;
+     }
+   rules->field_count = j;
+   free(used);
+
+   /* Commands aren't waited for. */
+   for (i = 0; i < rules->count; i++)
+     {
+        if (rules->rules[i].command)
+          {
+             signal(SIGCHLD, SIG_IGN);
+             break;
+          }
+     }
+
+   return true;
+}
+
+extern char **environ;
+
+static char *
+_rule_env(const char *name, const char *value)
+{
+   size_t size = strlen(name) + strlen(value) + 2;
+   char *var = malloc(size);
+
+   if (var)
+     snprintf(var, size, "%s=%s", name, value);
+
+   return var;
+}
+
+static void
+_rule_event(rules_t *rules, rule_t *rule, const char *event)
+{
+   rule_cmp_t *cmp = &rules->cmps[rule->first];
+   pid_t pid;
+   char value[32], *vars[3], **envp;
+   sigset_t mask;
+   int i, j, n;
+
+   snprintf(value, sizeof(value), "%.2f", rules->values[cmp->field]);
+   fprintf(stderr, "%ld %s %s (%s=%s)\n", (long) time(NULL), event, rule->text,
+           tingle_field_name(cmp->field), value);
+   fflush(stderr);
+
+   if (!rule->command || strcmp(event, "fire"))
+     return;
+
+   /* Other threads may hold the allocator's locks across fork(), so the
+    * child's environment is put together here and it only execs. */
+   for (n = 0; environ[n]; n++);
+   envp = malloc((n + 4) * sizeof(char *));
+   vars[0] = _rule_env("TINGLE_RULE", rule->text);
+   vars[1] = _rule_env("TINGLE_FIELD", tingle_field_name(cmp->field));
+   vars[2] = _rule_env("TINGLE_VALUE", value);
+   if (!envp || !vars[0] || !vars[1] || !vars[2])
+     goto out;
+
+   for (i = j = 0; i < n; i++)
+     {
+        if (strncmp(environ[i], "TINGLE_RULE=", 12) &&
+            strncmp(environ[i], "TINGLE_FIELD=", 13) &&
+            strncmp(environ[i], "TINGLE_VALUE=", 13))
+          envp[j++] = environ[i];
+     }
+   envp[j++] = vars[0];
+   envp[j++] = vars[1];
+   envp[j++] = vars[2];
+   envp[j] = NULL;
+
+   pid = fork();
+   if (pid == 0)
+     {
+        /* The watch loop blocks signals it reads through signalfd. */
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        signal(SIGCHLD, SIG_DFL);
+
+        execle("/bin/sh", "sh", "-c", rule->command, (char *) NULL, envp);
+        _exit(127);
+     }
+
+out:
+   for (i = 0; i < 3; i++)
+     free(vars[i]);
+   free(envp);
+}
+
+static bool
+_rule_cmp_true(const rule_cmp_t *cmp, double value, bool active)
+{
+   double threshold = active ? cmp->clear : cmp->value;
+
+   switch (cmp->op)
+     {
+      case RULE_GT: return value > threshold;
+      case RULE_GE: return value >= threshold;
+      case RULE_LT: return value < threshold;
+      case RULE_LE: return value <= threshold;
+      case RULE_EQ: return value == threshold;
+      default: return value != threshold;
+     }
+}
+
+static void
+rules_eval(rules_t *rules, tingle_t *tingle)
+{
+   struct timespec now;
+   rule_t *rule;
+   rule_cmp_t *cmp;
+   double elapsed;
+   int i, j, field;
+   bool match;
+
+   if (!rules->count) return;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   for (i = 0; i < rules->field_count; i++)
+     {
+        field = rules->fields[i];
+        rules->valid[field] = tingle_field_get(tingle, field, &rules->values[field]);
+     }
+
+   for (i = 0; i < rules->count; i++)
+     {
+        rule = &rules->rules[i];
+        match = true;
+        for (j = 0; j < rule->count && match; j++)
+          {
+             cmp = &rules->cmps[rule->first + j];
+             match = rules->valid[cmp->field] &&
+                     _rule_cmp_true(cmp, rules->values[cmp->field], rule->active);
+          }
+
+        if (rule->active)
+          {
+             if (!match)
+               {
+                  rule->active = rule->pending = false;
+                  _rule_event(rules, rule, "clear");
+               }
+             continue;
+          }
+
+        if (!match)
+          {
+             rule->pending = false;
+             continue;
+          }
+
+        if (!rule->pending)
+          {
+             rule->pending = true;
+             rule->since = now;
+          }
+
+        elapsed = (now.tv_sec - rule->since.tv_sec) + (now.tv_nsec - rule->since.tv_nsec) / 1e9;
+        if (elapsed < rule->hold)
+          continue;
+
+        if (rule->fired_once && rule->cooldown > 0)
+          {
+             elapsed = (now.tv_sec - rule->fired.tv_sec) + (now.tv_nsec - rule->fired.tv_nsec) / 1e9;
+             if (elapsed < rule->cooldown)
+               continue;
+          }
+
+        rule->active = rule->fired_once = true;
+        rule->fired = now;
+        _rule_event(rules, rule, "fire");
+     }
+}
+
+static void
+rules_shutdown(rules_t *rules)
+{
+   int i;
+
+   for (i = 0; i < rules->count; i++)
+     free(rules->rules[i].text);
+   free(rules->cmps);
+   free(rules->rules);
+   free(rules->fields);
+   free(rules->values);
+   free(rules->valid);
+}
+
+/* Output templates (--format), e.g. 'C:{cpu:.0}% M:{mem.used:M}/{mem.total:M}'.
+ * A template is parsed once into a list of literal and field ops. Each
+ * sample renders into one preallocated buffer with a fixed-point
+ * formatter and goes out in a single write(); a field whose value is
+ * unchanged copies its previous text. {{ and }} are literal braces. */
+#define FORMAT_FIELD_MAX   32
+#define FORMAT_DECIMALS    9
+
+typedef struct
+{
+   const char *text;
+   int         len;
+   int         field;
+   double      scale;
+   int         decimals;
+   bool        valid;
+   double      value;
+   int         rendered_len;
+   char        rendered[FORMAT_FIELD_MAX];
+} format_op_t;
+
+typedef struct
+{
+   char        *text;
+   format_op_t *ops;
+   int          count;
+   char        *buf;
+   size_t       size;
+   int          flags;
+} format_t;
+
+static int
+_format_field(const char *name)
+{
+   size_t i;
+   int field = tingle_field_find(name);
+
+   if (field != -1) return field;
+
+   for (i = 0; i < sizeof(rule_aliases) / sizeof(rule_aliases[0]); i++)
+     {
+        if (!strcmp(name, rule_aliases[i].alias))
+          return tingle_field_find(rule_aliases[i].name);
+     }
+
+   return -1;
+}
+
+/* [K|M|G][.decimals]. Memory fields are in KB, the rest in units.
+ * Scaled values are whole units unless decimals are given. */
+static bool
+_format_spec(format_op_t *op, const char *spec)
+{
+   double scale = 1;
+   char *end;
+   long decimals = -1;
+
+   if (*spec == 'K') scale = 1024, spec++;
+   else if (*spec == 'M') scale = 1048576, spec++;
+   else if (*spec == 'G') scale = 1073741824.0, spec++;
+   if (scale > 1 && tingle_field_flag(op->field) == RESULTS_MEM)
+     scale /= 1024;
+
+   if (*spec == '.')
+     {
+        decimals = strtol(spec + 1, &end, 10);
+        if (end == spec + 1 || decimals < 0 || decimals > FORMAT_DECIMALS)
+          return false;
+        spec = end;
+     }
+   else if (scale > 1)
+     decimals = 0;
+
+   op->scale = scale;
+   op->decimals = decimals;
+
+   return *spec == '\0';
+}
+
+static bool
+format_compile(format_t *format, const char *template, const char **error)
+{
+   format_op_t *op;
+   char *p, *w, *close, *colon;
+   size_t size;
+   int max;
+
+   memset(format, 0, sizeof(format_t));
+   *error = NULL;
+
+   /* Literals are unescaped in place and never outnumber the fields. */
+   format->text = strdup(template);
+   max = 2 * strlen(template) + 1;
+   format->ops = calloc(max, sizeof(format_op_t));
+   if (!format->text || !format->ops) return false;
+
+   size = 1;
+   p = w = format->text;
+   op = NULL;
+   while (*p)
+     {
+        if (*p == '{' && p[1] != '{')
+          {
+             close = strchr(p, '}');
+             if (!close)
+               {
+                  *error = "unterminated {";
+                  return false;
+               }
+             *close = '\0';
+             colon = strchr(p + 1, ':');
+             if (colon) *colon = '\0';
+
+             op = &format->ops[format->count++];
+             op->field = _format_field(p + 1);
+             if (op->field == -1)
+               {
+                  *error = "unknown field";
+                  return false;
+               }
+             if (!_format_spec(op, colon ? colon + 1 : ""))
+               {
+                  *error = "invalid field format";
+                  return false;
+               }
+             format->flags |= tingle_field_flag(op->field);
+             size += FORMAT_FIELD_MAX;
+             op = NULL;
+             p = close + 1;
+             continue;
+          }
+
+        if (*p == '}' && p[1] != '}')
+          {
+             *error = "unmatched }";
+             return false;
+          }
+
+        if (!op)
+          {
+             op = &format->ops[format->count++];
+             op->text = w;
+             op->field = -1;
+          }
+        /* {{ and }} */
+        if (*p == '{' || *p == '}') p++;
+        *w++ = *p++;
+        op->len++;
+        size++;
+     }
+
+   format->size = size;
+   format->buf = malloc(size);
+
+   return format->buf != NULL;
+}
+
+/* Fixed point, no locale and no stdio. */
+static int
+_format_number(char *out, double value, int decimals)
+{
+   char digits[FORMAT_FIELD_MAX];
+   unsigned long long n;
+   double scaled;
+   int i, len = 0, count = 0;
+   bool negative;
+
+   if (decimals < 0)
+     decimals = (value == floor(value)) ? 0 : 2;
+
+   scaled = fabs(value);
+   for (i = 0; i < decimals; i++)
+     scaled *= 10;
+   if (scaled != scaled || scaled >= 1e18)
+     {
+        out[0] = '-';
+        return 1;
+     }
+   n = (unsigned long long) (scaled + 0.5);
+   negative = value < 0 && n;
+
+   do {
+        digits[count++] = '0' + n % 10;
+        n /= 10;
+        if (count == decimals)
+          digits[count++] = '.';
+   } while (n || count <= decimals + (decimals > 0));
+
+   if (negative)
+     out[len++] = '-';
+   while (count)
+     out[len++] = digits[--count];
+
+   return len;
+}
+
+static size_t
+format_render(format_t *format, tingle_t *tingle)
+{
+   format_op_t *op;
+   double value;
+   size_t len = 0;
+   int i;
+
+   for (i = 0; i < format->count; i++)
+     {
+        op = &format->ops[i];
+        if (op->field == -1)
+          {
+             memcpy(format->buf + len, op->text, op->len);
+             len += op->len;
+             continue;
+          }
+
+        if (!tingle_field_get(tingle, op->field, &value))
+          {
+             op->valid = false;
+             op->rendered[0] = '-';
+             op->rendered_len = 1;
+          }
+        else if (!op->valid || value != op->value)
+          {
+             op->valid = true;
+             op->value = value;
+             op->rendered_len = _format_number(op->rendered, value / op->scale, op->decimals);
+          }
+        memcpy(format->buf + len, op->rendered, op->rendered_len);
+        len += op->rendered_len;
+     }
+   format->buf[len++] = '\n';
+
+   return len;
+}
+
+static bool
+format_write(format_t *format, tingle_t *tingle, int fd)
+{
+   size_t len = format_render(format, tingle), done = 0;
+   ssize_t n;
+
+   while (done < len)
+     {
+        n = write(fd, format->buf + done, len - done);
+        if (n == -1)
+          {
+             if (errno == EINTR) continue;
+             return false;
+          }
+        done += n;
+     }
+
+   return true;
+}
+
+static void
+format_shutdown(format_t *format)
+{
+   free(format->text);
+   free(format->ops);
+   free(format->buf);
+}
+
+/* Event loop for long-running (-w) mode. Sampling is driven by an
+ * absolute deadline timer so ticks don't drift with collector run time,
+ * and any other descriptor (client sockets, netlink, ALSA, PSI) can be
+ * attached as a source. Linux uses epoll, timerfd and signalfd; other
+ * systems fall back to poll() and plain signal handlers. */
+#define LOOP_READ         0x01
+#define LOOP_WRITE        0x02
+#define LOOP_PRI          0x04
+#define LOOP_SOURCES_MAX  1024
+
+typedef struct loop_t loop_t;
+typedef struct loop_source_t loop_source_t;
+
+typedef void (*loop_cb)(loop_t *loop, loop_source_t *source, int events);
+
+struct loop_source_t
+{
+   int      fd;
+   int      events;
+   loop_cb  cb;
+   void    *data;
+};
+
+struct loop_t
+{
+   bool             running;
+   bool             align;
+   unsigned int     interval;
+   unsigned long    wakeups;
+   void           (*tick)(loop_t *loop);
+   void           (*signal)(loop_t *loop, int signo);
+   void            *data;
+#if defined(__linux__)
+   int              epfd;
+   loop_source_t    timer;
+   loop_source_t    signals;
+#else
+   loop_source_t   *sources[LOOP_SOURCES_MAX];
+   int              source_count;
+   struct timespec  deadline;
+#endif
+};
+
+static void
+_timespec_add_ms(struct timespec *ts, unsigned int ms)
+{
+   ts->tv_sec += ms / 1000;
+   ts->tv_nsec += (ms % 1000) * 1000000L;
+   if (ts->tv_nsec >= 1000000000L)
+     {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+     }
+}
+
+/* Round down to a multiple of ms so periodic wakeups line up with
+ * those of other timers on the same boundaries. */
+static void
+_timespec_align(struct timespec *ts, unsigned int ms)
+{
+   long long now_ms;
+
+   if (!ms) return;
+
+   now_ms = (long long) ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+   now_ms -= now_ms % ms;
+   ts->tv_sec = now_ms / 1000;
+   ts->tv_nsec = (now_ms % 1000) * 1000000L;
+}
+
+#if defined(__linux__)
+static int
+_loop_events_to_epoll(int events)
+{
+   int ev = 0;
+
+   if (events & LOOP_READ) ev |= EPOLLIN;
+   if (events & LOOP_WRITE) ev |= EPOLLOUT;
+   if (events & LOOP_PRI) ev |= EPOLLPRI;
+
+   return ev;
+}
+
+static int
+_loop_events_from_epoll(int ev)
+{
+   int events = 0;
+
+   if (ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) events |= LOOP_READ;
+   if (ev & EPOLLOUT) events |= LOOP_WRITE;
+   if (ev & EPOLLPRI) events |= LOOP_PRI;
+
+   return events;
+}
+
+static bool
+loop_add(loop_t *loop, loop_source_t *source)
+{
+   struct epoll_event ev;
+
+   memset(&ev, 0, sizeof(ev));
+   ev.events = _loop_events_to_epoll(source->events);
+   ev.data.ptr = source;
+
+   return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, source->fd, &ev) == 0;
+}
+
+static void
+loop_del(loop_t *loop, loop_source_t *source)
+{
+   struct epoll_event ev;
+
+   memset(&ev, 0, sizeof(ev));
+   epoll_ctl(loop->epfd, EPOLL_CTL_DEL, source->fd, &ev);
+}
+
+static bool
+loop_interval_set(loop_t *loop, unsigned int interval)
+{
+   struct itimerspec it;
+
+   loop->interval = interval;
+
+   memset(&it, 0, sizeof(it));
+   clock_gettime(CLOCK_MONOTONIC, &it.it_value);
+   _timespec_align(&it.it_value, loop->align ? interval : 0);
+   _timespec_add_ms(&it.it_value, interval);
+   _timespec_add_ms(&it.it_interval, interval);
+
+   return timerfd_settime(loop->timer.fd, TFD_TIMER_ABSTIME, &it, NULL) == 0;
+}
+
+static void
+_loop_timer_cb(loop_t *loop, loop_source_t *source, int events)
+{
+   uint64_t expirations;
+
+   (void) events;
+
+   /* Missed deadlines are collapsed into a single sample. */
+   if (read(source->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+     return;
+
+   loop->tick(loop);
+}
+
+static void
+_loop_signal_cb(loop_t *loop, loop_source_t *source, int events)
+{
+   struct signalfd_siginfo info;
+
+   (void) events;
+
+   while (read(source->fd, &info, sizeof(info)) == sizeof(info))
+     loop->signal(loop, info.ssi_signo);
+}
+
+static bool
+loop_init(loop_t *loop, unsigned int interval)
+{
+   sigset_t mask;
+
+   loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+   if (loop->epfd == -1)
+     return false;
+
+   loop->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (loop->timer.fd == -1)
+     return false;
+
+   loop->timer.events = LOOP_READ;
+   loop->timer.cb = _loop_timer_cb;
+   if (!loop_add(loop, &loop->timer) || !loop_interval_set(loop, interval))
+     return false;
+
+   sigemptyset(&mask);
+   sigaddset(&mask, SIGINT);
+   sigaddset(&mask, SIGTERM);
+   sigaddset(&mask, SIGHUP);
+   sigaddset(&mask, SIGUSR1);
+   if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+     return false;
+
+   loop->signals.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+   if (loop->signals.fd == -1)
+     return false;
+
+   loop->signals.events = LOOP_READ;
+   loop->signals.cb = _loop_signal_cb;
+
+   return loop_add(loop, &loop->signals);
+}
+
+static void
+loop_run(loop_t *loop)
+{
+   struct epoll_event events[LOOP_SOURCES_MAX];
+   loop_source_t *source;
+   int i, n;
+
+   loop->running = true;
+
+   while (loop->running)
+     {
+        n = epoll_wait(loop->epfd, events, LOOP_SOURCES_MAX, -1);
+        loop->wakeups++;
+        if (n == -1)
+          {
+             if (errno == EINTR) continue;
+             break;
+          }
+
+        for (i = 0; i < n && loop->running; i++)
+          {
+             source = events[i].data.ptr;
+             source->cb(loop, source, _loop_events_from_epoll(events[i].events));
+          }
+     }
+}
+
+static void
+loop_shutdown(loop_t *loop)
+{
+   if (loop->signals.fd > 0) close(loop->signals.fd);
+   if (loop->timer.fd > 0) close(loop->timer.fd);
+   if (loop->epfd > 0) close(loop->epfd);
+}
+
+#else
+
+static volatile sig_atomic_t _loop_signo = 0;
+
+static double
+_timespec_elapsed(const struct timespec *from, const struct timespec *to)
+{
+   return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void
+_loop_signal_handler(int signo)
+{
+   _loop_signo = signo;
+}
+
+static bool
+loop_add(loop_t *loop, loop_source_t *source)
+{
+   if (loop->source_count == LOOP_SOURCES_MAX)
+     return false;
+
+   loop->sources[loop->source_count++] = source;
+
+   return true;
+}
+
+static void
+loop_del(loop_t *loop, loop_source_t *source)
+{
+   int i;
+
+   for (i = 0; i < loop->source_count; i++)
+     {
+        if (loop->sources[i] != source) continue;
+        loop->sources[i] = loop->sources[--loop->source_count];
+        break;
+     }
+}
+
+static bool
+loop_interval_set(loop_t *loop, unsigned int interval)
+{
+   loop->interval = interval;
+   clock_gettime(CLOCK_MONOTONIC, &loop->deadline);
+   _timespec_align(&loop->deadline, loop->align ? interval : 0);
+   _timespec_add_ms(&loop->deadline, interval);
+
+   return true;
+}
+
+static bool
+loop_init(loop_t *loop, unsigned int interval)
+{
+   struct sigaction sa;
+
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = _loop_signal_handler;
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+   sigaction(SIGHUP, &sa, NULL);
+   sigaction(SIGUSR1, &sa, NULL);
+
+   return loop_interval_set(loop, interval);
+}
+
+static void
+loop_run(loop_t *loop)
+{
+   struct pollfd fds[LOOP_SOURCES_MAX];
+   loop_source_t *sources[LOOP_SOURCES_MAX];
+   struct timespec now;
+   double remaining;
+   int i, n, count, events;
+
+   loop->running = true;
+
+   while (loop->running)
+     {
+        /* Callbacks may remove sources. */
+        count = loop->source_count;
+        memcpy(sources, loop->sources, count * sizeof(loop_source_t *));
+        for (i = 0; i < count; i++)
+          {
+             fds[i].fd = sources[i]->fd;
+             fds[i].events = 0;
+             fds[i].revents = 0;
+             if (sources[i]->events & LOOP_READ) fds[i].events |= POLLIN;
+             if (sources[i]->events & LOOP_WRITE) fds[i].events |= POLLOUT;
+             if (sources[i]->events & LOOP_PRI) fds[i].events |= POLLPRI;
+          }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining = _timespec_elapsed(&now, &loop->deadline);
+
+        n = poll(fds, count, remaining > 0 ? (int)(remaining * 1000) + 1 : 0);
+        loop->wakeups++;
+
+        if (_loop_signo)
+          {
+             int signo = _loop_signo;
+             _loop_signo = 0;
+             loop->signal(loop, signo);
+             if (!loop->running) break;
+          }
+
+        for (i = 0; n > 0 && i < count; i++)
+          {
+             if (!fds[i].revents) continue;
+             events = 0;
+             if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) events |= LOOP_READ;
+             if (fds[i].revents & POLLOUT) events |= LOOP_WRITE;
+             if (fds[i].revents & POLLPRI) events |= LOOP_PRI;
+             sources[i]->cb(loop, sources[i], events);
+          }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (_timespec_elapsed(&loop->deadline, &now) >= 0)
+          {
+             /* Advance by whole periods, collapsing missed deadlines. */
+             while (_timespec_elapsed(&loop->deadline, &now) >= 0)
+               _timespec_add_ms(&loop->deadline, loop->interval);
+             loop->tick(loop);
+          }
+     }
+}
+
+static void
+loop_shutdown(loop_t *loop)
+{
+   (void) loop;
+}
+
+#endif
+
+/* Output sinks (-o). Each sink is a named pipe or an inherited
+ * descriptor with its own template, fed from the one sampling loop. A
+ * line is only handed over when its text changed, and writes never
+ * block: while a reader lags, newer lines replace the one waiting to
+ * be written, so a reader catching up sees the latest. FIFOs without a
+ * reader are retried every sample. */
+#define SINK_FORMAT_DEFAULT " [CPU]: {cpu:.2}% [MEM]: {mem.used:M}/{mem.total:M}M [NET] {net.in:K.2}/{net.out:K.2} KB/s"
+
+#if defined(__linux__) && !defined(F_SETPIPE_SZ)
+# define F_SETPIPE_SZ 1031
+#endif
+
+typedef struct
+{
+   loop_source_t  source;
+   const char    *spec;
+   char          *path;
+   format_t       format;
+   char          *line;
+   size_t         line_len;
+   bool           fresh;
+   char          *out;
+   size_t         out_len;
+   size_t         out_off;
+   bool           watching;
+   bool           dead;
+} sink_t;
+
+typedef struct
+{
+   sink_t *sinks;
+   int     count;
+   int     flags;
+} sinks_t;
+
+static bool
+sinks_add(sinks_t *sinks, const char *spec)
+{
+   sink_t *tmp = realloc(sinks->sinks, (sinks->count + 1) * sizeof(sink_t));
+
+   if (!tmp) return false;
+   sinks->sinks = tmp;
+
+   memset(&sinks->sinks[sinks->count], 0, sizeof(sink_t));
+   sinks->sinks[sinks->count].spec = spec;
+   sinks->sinks[sinks->count].source.fd = -1;
+   sinks->count++;
+
+   return true;
+}
+
+static void
+_sink_close(sink_t *sink, loop_t *loop)
+{
+   if (sink->watching && loop)
+     loop_del(loop, &sink->source);
+   sink->watching = false;
+
+   close(sink->source.fd);
+   sink->source.fd = -1;
+   sink->out_len = sink->out_off = 0;
+
+   /* An inherited descriptor can't be opened again. */
+   if (!sink->path)
+     sink->dead = true;
+}
+
+static void
+_sink_open(sink_t *sink)
+{
+   struct stat st;
+   int fd;
+
+   fd = open(sink->path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+   if (fd == -1 && errno == ENOENT && mkfifo(sink->path, 0600) == 0)
+     fd = open(sink->path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+   if (fd == -1) return;
+
+#if defined(__linux__)
+   /* Keep the backlog of stale lines in the pipe short. */
+   if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode))
+     fcntl(fd, F_SETPIPE_SZ, getpagesize());
+#else
+   (void) st;
+#endif
+
+   sink->source.fd = fd;
+   sink->fresh = sink->line_len > 0;
+}
+
+static void
+_sink_flush(sink_t *sink, loop_t *loop)
+{
+   ssize_t n;
+
+   while (sink->source.fd != -1)
+     {
+        if (sink->out_off == sink->out_len)
+          {
+             if (!sink->fresh) break;
+             memcpy(sink->out, sink->line, sink->line_len);
+             sink->out_len = sink->line_len;
+             sink->out_off = 0;
+             sink->fresh = false;
+          }
+
+        n = write(sink->source.fd, sink->out + sink->out_off, sink->out_len - sink->out_off);
+        if (n > 0)
+          {
+             sink->out_off += n;
+             continue;
+          }
+        if (n == -1 && errno == EINTR)
+          continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          {
+             /* Finish when the reader catches up. */
+             if (!sink->watching && loop)
+               sink->watching = loop_add(loop, &sink->source);
+             return;
+          }
+
+        _sink_close(sink, loop);
+        return;
+     }
+
+   if (sink->watching)
+     {
+        loop_del(loop, &sink->source);
+        sink->watching = false;
+     }
+}
+
+static void
+_sink_writable_cb(loop_t *loop, loop_source_t *source, int events)
+{
+   (void) events;
+
+   _sink_flush(source->data, loop);
+}
+
+static bool
+sinks_compile(sinks_t *sinks, const char *template, const char **error)
+{
+   sink_t *sink;
+   const char *eq;
+   char *end;
+   long fd;
+   int i, flags;
+
+   *error = NULL;
+
+   for (i = 0; i < sinks->count; i++)
+     {
+        sink = &sinks->sinks[i];
+        eq = strchr(sink->spec, '=');
+
+        if (!format_compile(&sink->format, eq ? eq + 1 : template ? template : SINK_FORMAT_DEFAULT, error))
+          return false;
+        sinks->flags |= sink->format.flags;
+
+        sink->line = malloc(sink->format.size);
+        sink->out = malloc(sink->format.size);
+        if (!sink->line || !sink->out) return false;
+
+        sink->source.events = LOOP_WRITE;
+        sink->source.cb = _sink_writable_cb;
+        sink->source.data = sink;
+
+        /* A number is a descriptor we were started with. */
+        fd = strtol(sink->spec, &end, 10);
+        if (end != sink->spec && (*end == '=' || *end == '\0'))
+          {
+             flags = fd < 0 || fd > INT_MAX ? -1 : fcntl(fd, F_GETFL);
+             if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+               {
+                  *error = "bad descriptor";
+                  return false;
+               }
+             sink->source.fd = fd;
+          }
+        else
+          {
+             sink->path = eq ? strndup(sink->spec, eq - sink->spec) : strdup(sink->spec);
+             if (!sink->path) return false;
+          }
+     }
+
+   /* A reader going away must not kill us. */
+   if (sinks->count)
+     signal(SIGPIPE, SIG_IGN);
+
+   return true;
+}
+
+static void
+sinks_write(sinks_t *sinks, loop_t *loop, tingle_t *tingle)
+{
+   sink_t *sink;
+   size_t len;
+   int i;
+
+   for (i = 0; i < sinks->count; i++)
+     {
+        sink = &sinks->sinks[i];
+        if (sink->dead) continue;
 
-#if defined(__OpenBSD__) || defined(__NetBSD__)
-# include <sys/swap.h>
-# include <sys/sched.h>
-# include <sys/mount.h>
-# include <sys/sensors.h>
-# include <sys/audioio.h>
-# include <net/if_types.h>
-# include <ifaddrs.h>
-#endif
+        len = format_render(&sink->format, tingle);
+        if (len != sink->line_len || memcmp(sink->line, sink->format.buf, len))
+          {
+             memcpy(sink->line, sink->format.buf, len);
+             sink->line_len = len;
+             sink->fresh = true;
+          }
 
-#if defined(__FreeBSD__) || defined(__DragonFly__)
-# include <net/if_mib.h>
-# include <vm/vm_param.h>
-# include <sys/soundcard.h>
-#endif
+        if (sink->source.fd == -1 && sink->path)
+          _sink_open(sink);
 
-#if defined(__linux__)
-# include <sys/soundcard.h>
-#endif
+        _sink_flush(sink, loop);
+     }
+}
 
-#if defined(__linux__) && defined(HAVE_ALSA)
-# include <alsa/asoundlib.h>
-#endif
+static void
+sinks_shutdown(sinks_t *sinks, loop_t *loop)
+{
+   sink_t *sink;
+   int i;
 
-#if defined(__OpenBSD__)
-# define CPU_STATES       6
-#else
-#define CPU_STATES        5
-#endif
+   for (i = 0; i < sinks->count; i++)
+     {
+        sink = &sinks->sinks[i];
+        if (sink->source.fd != -1)
+          _sink_close(sink, loop);
+        format_shutdown(&sink->format);
+        free(sink->path);
+        free(sink->line);
+        free(sink->out);
+     }
+   free(sinks->sinks);
+   sinks->sinks = NULL;
+   sinks->count = 0;
+}
 
-#define MAX_BATTERIES     5
-#define INVALID_TEMP      -999
-
-/* Filter requests and results */
-#define RESULTS_CPU       0x01
-#define RESULTS_MEM       0x02
-#define RESULTS_PWR       0x04
-#define RESULTS_TMP       0x08
-#define RESULTS_AUD       0x10
-#define RESULTS_NET       0x20
-#define RESULTS_DEFAULT   0x3f
-#define RESULTS_MEM_MB    0x40
-#define RESULTS_MEM_GB    0x80
-#define RESULTS_CPU_CORES 0x100
+/* Recordings (--record). A header naming the recorded fields, then one
+ * fixed-size record per sample: milliseconds since the epoch and a
+ * double per field, NaN where the field had no value. Fixed records
+ * let --analyze binary search a memory-mapped file by time. Files are
+ * in host byte order, the marker catches a move between machines. */
+#define RECORD_MAGIC      "TGR1"
+#define RECORD_ORDER      0x01020304
+#define RECORD_NAME_MAX   32
+#define RECORD_HEADER     16
 
 typedef struct
 {
-   float         percent;
-   unsigned long total;
-   unsigned long idle;
-} cpu_core_t;
+   char     magic[4];
+   uint32_t order;
+   uint32_t count;
+   uint32_t size;
+} record_header_t;
 
 typedef struct
 {
-   unsigned long total;
-   unsigned long used;
-   unsigned long cached;
-   unsigned long buffered;
-   unsigned long shared;
-   unsigned long swap_total;
-   unsigned long swap_used;
-} meminfo_t;
-
-typedef struct
+   int       fd;
+   int      *fields;
+   int       count;
+   uint8_t  *header;
+   size_t    header_size;
+   uint8_t  *record;
+   size_t    record_size;
+} recorder_t;
+
+/* A new file gets the header, an existing one must record the same
+ * fields. */
+static const char *
+_recorder_header_check(recorder_t *recorder)
 {
-   double charge_full;
-   double charge_current;
-   uint8_t percent;
-} bat_t;
+   uint8_t *buf;
+   struct stat st;
+   off_t whole;
+   bool same;
 
-typedef struct
-{
-   bool    have_ac;
-   int     battery_count;
+   if (fstat(recorder->fd, &st) == -1)
+     return strerror(errno);
 
-   bat_t **batteries;
+   if (st.st_size == 0)
+     {
+        if (write(recorder->fd, recorder->header, recorder->header_size) != (ssize_t) recorder->header_size)
+          return strerror(errno);
+        return NULL;
+     }
 
-   char    battery_names[256];
-   int    *bat_mibs[MAX_BATTERIES];
-   int     ac_mibs[5];
-} power_t;
+   buf = malloc(recorder->header_size);
+   if (!buf) return "out of memory";
 
-typedef struct
-{
-   bool    enabled;
-   uint8_t volume_left;
-   uint8_t volume_right;
-} mixer_t;
+   same = pread(recorder->fd, buf, recorder->header_size, 0) == (ssize_t) recorder->header_size &&
+          !memcmp(buf, recorder->header, recorder->header_size);
+   free(buf);
+   if (!same)
+     return "file records a different set of fields";
+
+   /* Drop a record cut short by a crash. */
+   whole = st.st_size - (st.st_size - recorder->header_size) % recorder->record_size;
+   if (whole != st.st_size && ftruncate(recorder->fd, whole) == -1)
+     return strerror(errno);
+
+   return NULL;
+}
 
-typedef struct results_t results_t;
-struct results_t
+static bool
+recorder_open(recorder_t *recorder, const char *path, tingle_t *tingle)
 {
-   int           cpu_count;
-   cpu_core_t    **cores;
+   record_header_t *header;
+   const char *error;
+   int i, n = tingle_field_count(), flags = tingle_flags(tingle);
+
+   memset(recorder, 0, sizeof(recorder_t));
+   recorder->fd = -1;
+
+   recorder->fields = malloc(n * sizeof(int));
+   if (!recorder->fields)
+     {
+        fprintf(stderr, "Error: out of memory\n");
+        return false;
+     }
 
-   meminfo_t     memory;
+   for (i = 0; i < n; i++)
+     {
+        if (tingle_field_flag(i) & flags)
+          recorder->fields[recorder->count++] = i;
+     }
 
-   power_t       power;
+   recorder->header_size = RECORD_HEADER + recorder->count * RECORD_NAME_MAX;
+   recorder->record_size = sizeof(int64_t) + recorder->count * sizeof(double);
+   recorder->header = calloc(1, recorder->header_size);
+   recorder->record = malloc(recorder->record_size);
+   if (!recorder->header || !recorder->record)
+     {
+        fprintf(stderr, "Error: out of memory\n");
+        return false;
+     }
 
-   mixer_t       mixer;
+   header = (record_header_t *) recorder->header;
+   memcpy(header->magic, RECORD_MAGIC, 4);
+   header->order = RECORD_ORDER;
+   header->count = recorder->count;
+   header->size = recorder->record_size;
+   for (i = 0; i < recorder->count; i++)
+     {
+        strncpy((char *) recorder->header + RECORD_HEADER + i * RECORD_NAME_MAX,
+                tingle_field_name(recorder->fields[i]), RECORD_NAME_MAX - 1);
+     }
 
-   unsigned long incoming;
-   unsigned long outgoing;
+   recorder->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+   error = recorder->fd == -1 ? strerror(errno) : _recorder_header_check(recorder);
+   if (error)
+     {
+        fprintf(stderr, "Error: unable to record to %s: %s\n", path, error);
+        return false;
+     }
 
-   int           temperature;
-};
+   return true;
+}
 
 static void
-_memsize_bytes_to_kb(unsigned long *bytes)
+recorder_write(recorder_t *recorder, tingle_t *tingle)
 {
-   *bytes = (unsigned int)*bytes >> 10;
-}
+   struct timespec ts;
+   int64_t now;
+   double *values;
+   int i;
+
+   if (!recorder || recorder->fd == -1) return;
+
+   clock_gettime(CLOCK_REALTIME, &ts);
+   now = (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+   memcpy(recorder->record, &now, sizeof(now));
 
-#define _memsize_kb_to_mb _memsize_bytes_to_kb
+   values = (double *) (recorder->record + sizeof(int64_t));
+   for (i = 0; i < recorder->count; i++)
+     {
+        if (!tingle_field_get(tingle, recorder->fields[i], &values[i]))
+          values[i] = NAN;
+     }
+
+   /* A failing disk stops the recording, not the sampling. */
+   if (write(recorder->fd, recorder->record, recorder->record_size) != (ssize_t) recorder->record_size)
+     {
+        fprintf(stderr, "Error: recording stopped: %s\n", strerror(errno));
+        close(recorder->fd);
+        recorder->fd = -1;
+     }
+}
 
 static void
-_memsize_kb_to_gb(unsigned long *bytes)
+recorder_close(recorder_t *recorder)
 {
-   *bytes = (unsigned int)*bytes >> 20;
+   if (recorder->fd != -1)
+     close(recorder->fd);
+   free(recorder->fields);
+   free(recorder->header);
+   free(recorder->record);
 }
 
-#if defined(__linux__)
-static char *
-Fcontents(const char *path)
+/* Remote snapshots. A long-running tingle with --listen answers each
+ * request (any bytes) on a connection with a fixed-size binary snapshot
+ * of its latest sample; --aggregate keeps a connection to each of many
+ * such tingles and polls them all from one event loop. Values are
+ * big-endian integers in hundredths, a mask says which ones the host
+ * has. */
+#define SNAPSHOT_MAGIC        "TGS1"
+#define SNAPSHOT_FIELDS       8
+#define SNAPSHOT_SIZE         (12 + SNAPSHOT_FIELDS * 8)
+#define SNAPSHOT_FLAGS        ((RESULTS_CPU | RESULTS_MEM | RESULTS_NET | RESULTS_SCHED | \
+                               RESULTS_TMP | RESULTS_FS) & tingle_collectors())
+#define SERVER_CLIENTS_MAX    64
+
+enum
+{
+   SNAPSHOT_CPU,
+   SNAPSHOT_MEM_USED,
+   SNAPSHOT_MEM_TOTAL,
+   SNAPSHOT_NET_IN,
+   SNAPSHOT_NET_OUT,
+   SNAPSHOT_LOAD,
+   SNAPSHOT_TEMP,
+   SNAPSHOT_DISK,
+};
+
+static const char *snapshot_fields[SNAPSHOT_FIELDS] = {
+   "cpu.percent", "mem.used", "mem.total", "net.in", "net.out", "load.1",
+   "temperature", "fs.percent",
+};
+
+typedef struct
 {
-   char *buf;
-   char byte[1];
-   size_t count, bytes = 0;
-   FILE *f = fopen(path, "r");
-   if (!f) return NULL;
+   uint32_t  mask;
+   uint32_t  seq;
+   double    values[SNAPSHOT_FIELDS];
+} snapshot_t;
 
-   int n = 1024;
+static void
+_snapshot_put32(uint8_t *p, uint32_t v)
+{
+   p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static uint32_t
+_snapshot_get32(const uint8_t *p)
+{
+   return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
 
-   buf = malloc(n * sizeof(byte) + 1);
-   if (!buf) return NULL;
+static void
+snapshot_encode(const snapshot_t *snap, uint8_t *out)
+{
+   int64_t v;
+   int i;
 
-   while ((count = (fread(byte, sizeof(byte), 1, f))) > 0)
+   memcpy(out, SNAPSHOT_MAGIC, 4);
+   _snapshot_put32(out + 4, snap->mask);
+   _snapshot_put32(out + 8, snap->seq);
+   for (i = 0; i < SNAPSHOT_FIELDS; i++)
      {
-        bytes += sizeof(byte);
-        if (bytes == (n * sizeof(byte)))
-          {
-             n *= 2;
-             char *tmp = realloc(buf, n * sizeof(byte) + 1);
-             if (!tmp) return NULL;
-             buf = tmp;
-          }
-        memcpy(&buf[bytes - sizeof(byte)], byte, sizeof(byte));
+        v = llround(snap->values[i] * 100);
+        _snapshot_put32(out + 12 + i * 8, (uint64_t) v >> 32);
+        _snapshot_put32(out + 16 + i * 8, (uint64_t) v);
      }
+}
 
-   if (!feof(f)) return NULL;
-   fclose(f);
+static bool
+snapshot_decode(snapshot_t *snap, const uint8_t *in)
+{
+   uint64_t v;
+   int i;
 
-   buf[bytes] = 0;
+   if (memcmp(in, SNAPSHOT_MAGIC, 4)) return false;
 
-   return buf;
-}
+   snap->mask = _snapshot_get32(in + 4);
+   snap->seq = _snapshot_get32(in + 8);
+   for (i = 0; i < SNAPSHOT_FIELDS; i++)
+     {
+        v = ((uint64_t) _snapshot_get32(in + 12 + i * 8) << 32) | _snapshot_get32(in + 16 + i * 8);
+        snap->values[i] = (int64_t) v / 100.0;
+     }
 
-#endif
+   return true;
+}
 
-#if defined(__FreeBSD__) || defined(__DragonFly__)
-static long int
-_sysctlfromname(const char *name, void *mib, int depth, size_t *len)
+#if defined(TINGLE_STATIC)
+/* A static glibc binary would have getaddrinfo load NSS modules at run
+ * time, so static builds only take numeric addresses and ports. */
+static bool
+_remote_resolve_numeric(const char *host, const char *port, bool passive, struct sockaddr_storage *addr, socklen_t *len)
 {
-   long int result;
+   struct sockaddr_in *sin = (struct sockaddr_in *) addr;
+   struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) addr;
+   char *end;
+   long n;
 
-   if (sysctlnametomib(name, mib, len) < 0)
-     return -1;
+   n = strtol(port, &end, 10);
+   if (end == port || *end || n < 0 || n > 65535)
+     {
+        errno = EINVAL;
+        return false;
+     }
 
-   *len = sizeof(result);
-   if (sysctl(mib, depth, &result, len, NULL, 0) < 0)
-     return -1;
+   memset(addr, 0, sizeof(struct sockaddr_storage));
+   if (!host[0] || inet_pton(AF_INET, host, &sin->sin_addr) == 1)
+     {
+        if (!host[0])
+          sin->sin_addr.s_addr = htonl(passive ? INADDR_ANY : INADDR_LOOPBACK);
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(n);
+        *len = sizeof(struct sockaddr_in);
+     }
+   else if (inet_pton(AF_INET6, host, &sin6->sin6_addr) == 1)
+     {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(n);
+        *len = sizeof(struct sockaddr_in6);
+     }
+   else
+     {
+        errno = EINVAL;
+        return false;
+     }
 
-   return result;
+   return true;
 }
-
 #endif
 
-static int
-cpu_count(void)
+/* "host:port", "[v6]:port" or just "port". */
+static bool
+_remote_resolve(const char *spec, bool passive, struct sockaddr_storage *addr, socklen_t *len)
 {
-   int cores = 0;
-#if defined(__linux__)
-   char buf[4096];
-   FILE *f;
-   int line = 0;
-
-   f = fopen("/proc/stat", "r");
-   if (!f) return 0;
+#if !defined(TINGLE_STATIC)
+   struct addrinfo hints, *res;
+#endif
+   char host[256];
+   const char *port = strrchr(spec, ':');
+   size_t n;
 
-   while (fgets(buf, sizeof(buf), f))
+   host[0] = '\0';
+   if (port)
      {
-        if (line)
+        n = port - spec;
+        if (n >= sizeof(host)) return false;
+        memcpy(host, spec, n);
+        host[n] = '\0';
+        port++;
+        if (host[0] == '[' && n > 1 && host[n - 1] == ']')
           {
-             if (!strncmp(buf, "cpu", 3))
-               cores++;
-             else
-               break;
+             memmove(host, host + 1, n - 2);
+             host[n - 2] = '\0';
           }
-        line++;
      }
+   else
+     port = spec;
 
-   fclose(f);
-#elif defined(__MacOS__) || defined(__FreeBSD__) || defined(__DragonFly__) || defined(__OpenBSD__) || defined(__NetBSD__)
-   size_t len;
-   int mib[2] = { CTL_HW, HW_NCPU };
+#if defined(TINGLE_STATIC)
+   return _remote_resolve_numeric(host, port, passive, addr, len);
+#else
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+   if (getaddrinfo(host[0] ? host : NULL, port, &hints, &res))
+     return false;
 
-   len = sizeof(cores);
-   if (sysctl(mib, 2, &cores, &len, NULL, 0) < 0)
-     return 0;
+   memcpy(addr, res->ai_addr, res->ai_addrlen);
+   *len = res->ai_addrlen;
+   freeaddrinfo(res);
+
+   return true;
 #endif
-   return cores;
 }
 
-static void
-_cpu_state_get(cpu_core_t **cores, int ncpu)
+static int
+_remote_socket(int family)
 {
-   int diff_total, diff_idle;
-   double ratio, percent;
-   unsigned long total, idle, used;
-   cpu_core_t *core;
-#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__OpenBSD__) || defined(__NetBSD__)
-   size_t size;
-   int i, j;
-#endif
-#if defined(__FreeBSD__) || defined(__DragonFly__)
-   if (!ncpu)
-     return;
-   size = sizeof(unsigned long) * (CPU_STATES * ncpu);
-   unsigned long cpu_times[ncpu][CPU_STATES];
-
-   if (sysctlbyname("kern.cp_times", cpu_times, &size, NULL, 0) < 0)
-     return;
+   int fd, one = 1;
 
-   for (i = 0; i < ncpu; i++) {
-        core = cores[i];
-        unsigned long *cpu = cpu_times[i];
+   fd = socket(family, SOCK_STREAM, 0);
+   if (fd == -1) return -1;
 
-        total = 0;
-        for (j = 0; j < CPU_STATES; j++)
-          total += cpu[j];
+   fcntl(fd, F_SETFD, FD_CLOEXEC);
+   fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+   setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
-        idle = cpu[4];
+   return fd;
+}
 
-        diff_total = total - core->total;
-        diff_idle = idle - core->idle;
-        if (diff_total == 0) diff_total = 1;
+typedef struct
+{
+   loop_source_t  listener;
+   loop_source_t  clients[SERVER_CLIENTS_MAX];
+   tingle_t      *tingle;
+   int            fields[SNAPSHOT_FIELDS];
+   uint32_t       seq;
+   void         (*demand)(loop_t *loop, void *data);
+   void          *data;
+} server_t;
 
-        ratio = diff_total / 100.0;
-        used = diff_total - diff_idle;
-        percent = used / ratio;
+static void
+_server_client_close(loop_t *loop, loop_source_t *client)
+{
+   loop_del(loop, client);
+   close(client->fd);
+   client->fd = -1;
+}
 
-        if (percent > 100) percent = 100;
-        else if (percent < 0)
-          percent = 0;
+static void
+_server_client_cb(loop_t *loop, loop_source_t *client, int events)
+{
+   server_t *server = client->data;
+   snapshot_t snap;
+   uint8_t buf[SNAPSHOT_SIZE];
+   ssize_t n;
+   int i;
 
-        core->percent = percent;
-        core->total = total;
-        core->idle = idle;
-     }
-#elif defined(__OpenBSD__)
-   static struct cpustats cpu_times[CPU_STATES];
-   static int cpu_time_mib[] = { CTL_KERN, KERN_CPUSTATS, 0 };
+   (void) events;
 
-   memset(&cpu_times, 0, CPU_STATES * sizeof(struct cpustats));
-   if (!ncpu)
+   n = read(client->fd, buf, sizeof(buf));
+   if (n == -1 && (errno == EAGAIN || errno == EINTR))
      return;
-
-   for (i = 0; i < ncpu; i++)
+   if (n <= 0)
      {
-        core = cores[i];
-        size = sizeof(struct cpustats);
-        cpu_time_mib[2] = i;
-        if (sysctl(cpu_time_mib, 3, &cpu_times[i], &size, NULL, 0) < 0)
-          return;
-
-        total = 0;
-        for (j = 0; j < CPU_STATES; j++)
-          total += cpu_times[i].cs_time[j];
-
-        idle = cpu_times[i].cs_time[CP_IDLE];
-
-        diff_total = total - core->total;
-        if (diff_total == 0) diff_total = 1;
-
-        diff_idle = idle - core->idle;
-        ratio = diff_total / 100.0;
-        used = diff_total - diff_idle;
-        percent = used / ratio;
+        _server_client_close(loop, client);
+        return;
+     }
 
-        if (percent > 100) percent = 100;
-        else if (percent < 0)
-          percent = 0;
+   /* Someone is looking: sample at the fastest rate again. */
+   if (server->demand)
+     server->demand(loop, server->data);
 
-        core->percent = percent;
-        core->total = total;
-        core->idle = idle;
+   memset(&snap, 0, sizeof(snap));
+   snap.seq = server->seq;
+   for (i = 0; i < SNAPSHOT_FIELDS; i++)
+     {
+        if (tingle_field_get(server->tingle, server->fields[i], &snap.values[i]))
+          snap.mask |= 1u << i;
      }
-#elif defined(__linux__)
-   char *buf, name[128];
-   int i;
-
-   buf = Fcontents("/proc/stat");
-   if (!buf) return;
+   snapshot_encode(&snap, buf);
 
-   for (i = 0; i < ncpu; i++) {
-        core = cores[i];
-        snprintf(name, sizeof(name), "cpu%d", i);
-        char *line = strstr(buf, name);
-        if (line)
-          {
-             line = strchr(line, ' ') + 1;
-             unsigned long cpu_times[4] = { 0 };
+   /* Replies are tiny; a client that can't take one is gone. */
+   if (write(client->fd, buf, sizeof(buf)) != sizeof(buf))
+     _server_client_close(loop, client);
+}
 
-             if (4 != sscanf(line, "%lu %lu %lu %lu", &cpu_times[0], &cpu_times[1], &cpu_times[2], &cpu_times[3]))
-               return;
+static void
+_server_accept_cb(loop_t *loop, loop_source_t *listener, int events)
+{
+   server_t *server = listener->data;
+   loop_source_t *client = NULL;
+   int fd, i, one = 1;
 
-             total = cpu_times[0] + cpu_times[1] + cpu_times[2] + cpu_times[3];
-             idle = cpu_times[3];
-             diff_total = total - core->total;
-             if (diff_total == 0) diff_total = 1;
+   (void) events;
 
-             diff_idle = idle - core->idle;
-             ratio = diff_total / 100.0;
-             used = diff_total - diff_idle;
-             percent = used / ratio;
+   while ((fd = accept(listener->fd, NULL, NULL)) != -1)
+     {
+        for (i = 0; i < SERVER_CLIENTS_MAX && !client; i++)
+          {
+             if (server->clients[i].fd == -1)
+               client = &server->clients[i];
+          }
+        if (!client)
+          {
+             close(fd);
+             continue;
+          }
 
-             if (percent > 100) percent = 100;
-             else if (percent < 0)
-               percent = 0;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
-             core->percent = percent;
-             core->total = total;
-             core->idle = idle;
+        client->fd = fd;
+        client->events = LOOP_READ;
+        client->cb = _server_client_cb;
+        client->data = server;
+        if (!loop_add(loop, client))
+          {
+             close(fd);
+             client->fd = -1;
           }
+        client = NULL;
      }
-   free(buf);
-#elif defined(__MacOS__)
-   mach_msg_type_number_t count;
-   processor_cpu_load_info_t load;
-   mach_port_t mach_port;
-   unsigned int cpu_count;
-   int i;
-
-   cpu_count = ncpu;
+}
 
-   count = HOST_CPU_LOAD_INFO_COUNT;
-   mach_port = mach_host_self();
-   if (host_processor_info(mach_port, PROCESSOR_CPU_LOAD_INFO, &cpu_count, (processor_info_array_t *)&load, &count) != KERN_SUCCESS)
-     exit(4 << 1);
+static bool
+server_init(server_t *server, const char *spec, tingle_t *tingle)
+{
+   struct sockaddr_storage addr;
+   socklen_t len;
+   int i, one = 1;
+
+   memset(server, 0, sizeof(server_t));
+   server->tingle = tingle;
+   server->listener.fd = -1;
+   for (i = 0; i < SERVER_CLIENTS_MAX; i++)
+     server->clients[i].fd = -1;
+   for (i = 0; i < SNAPSHOT_FIELDS; i++)
+     server->fields[i] = tingle_field_find(snapshot_fields[i]);
+
+   if (!_remote_resolve(spec, true, &addr, &len))
+     {
+        errno = EINVAL;
+        return false;
+     }
 
-   for (i = 0; i < ncpu; i++) {
-        core = cores[i];
+   signal(SIGPIPE, SIG_IGN);
 
-        total = load[i].cpu_ticks[CPU_STATE_USER] + load[i].cpu_ticks[CPU_STATE_SYSTEM] + load[i].cpu_ticks[CPU_STATE_IDLE] + load[i].cpu_ticks[CPU_STATE_NICE];
-        idle = load[i].cpu_ticks[CPU_STATE_IDLE];
+   server->listener.fd = _remote_socket(addr.ss_family);
+   if (server->listener.fd == -1)
+     return false;
 
-        diff_total = total - core->total;
-        if (diff_total == 0) diff_total = 1;
-        diff_idle = idle - core->idle;
-        ratio = diff_total / 100.0;
-        used = diff_total - diff_idle;
-        percent = used / ratio;
+   setsockopt(server->listener.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+   if (bind(server->listener.fd, (struct sockaddr *) &addr, len) == -1 ||
+       listen(server->listener.fd, 16) == -1)
+     return false;
 
-        if (percent > 100) percent = 100;
-        else if (percent < 0)
-          percent = 0;
+   server->listener.events = LOOP_READ;
+   server->listener.cb = _server_accept_cb;
+   server->listener.data = server;
 
-        core->percent = percent;
-        core->total = total;
-        core->idle = idle;
-     }
-#endif
+   return true;
 }
 
-static cpu_core_t **
-_cpu_cores_state_get(int *ncpu)
+static void
+server_shutdown(server_t *server)
 {
-   cpu_core_t **cores;
    int i;
 
-   *ncpu = cpu_count();
-
-   cores = malloc((*ncpu) * sizeof(cpu_core_t *));
-
-   for (i = 0; i < *ncpu; i++)
-     cores[i] = calloc(1, sizeof(cpu_core_t));
-
-   _cpu_state_get(cores, *ncpu);
-   usleep(1000000);
-   _cpu_state_get(cores, *ncpu);
-
-   return cores;
+   for (i = 0; i < SERVER_CLIENTS_MAX; i++)
+     {
+        if (server->clients[i].fd != -1)
+          close(server->clients[i].fd);
+     }
+   if (server->listener.fd != -1)
+     close(server->listener.fd);
 }
 
-#if defined(__linux__)
-static unsigned long
-_meminfo_parse_line(const char *line)
-{
-   char *p, *tok;
+/* Adaptive (-A) sampling doubles the interval, up to a maximum, after
+ * a few samples in which no field moved noticeably, and drops back to
+ * the -w interval on change or on demand (SIGUSR1). */
+#define ADAPTIVE_STABLE_TICKS  3
+#define ADAPTIVE_CHANGE        0.10
+#define ADAPTIVE_CHANGE_MIN    10.0
 
-   p = strchr(line, ':') + 1;
-   while (isspace(*p))
-     p++;
-   tok = strtok(p, " ");
+typedef struct
+{
+   tingle_t       *tingle;
+   rules_t        *rules;
+   format_t       *format;
+   sinks_t        *sinks;
+   server_t       *server;
+   recorder_t     *recorder;
+   int            *order;
+   int             count;
+   bool            status_line;
+
+   bool            adaptive;
+   unsigned int    interval_min;
+   unsigned int    interval_max;
+   int             stable;
+   double         *prev;
+   bool           *prev_valid;
+
+   struct timespec stamp;
+   unsigned long   wakeups;
+   double          cpu_time;
+   double          wakeup_rate;
+   double          cpu_percent;
+} watch_t;
 
-   return atol(tok);
+static void
+_results_output(results_t *results, int *order, int count, bool status_line)
+{
+   if (status_line)
+     results_pretty(results, order, count ? count : 1);
+   else
+     results_verbose(results, order, count);
 }
 
+#if defined(__linux__) && !defined(SCHED_IDLE)
+# define SCHED_IDLE 5
 #endif
 
+/* Run below normal tasks and let the kernel batch our timers. */
 static void
-_memory_usage_get(meminfo_t *memory)
+_watch_priority_lower(void)
 {
-#if defined(__FreeBSD__) || defined(__DragonFly__) || defined(__OpenBSD__)
-   size_t len = 0;
-   int i = 0;
+#if defined(__linux__)
+   struct sched_param param;
+
+   memset(&param, 0, sizeof(param));
+   if (sched_setscheduler(0, SCHED_IDLE, &param) == 0)
+     return;
 #endif
-   memset(memory, 0, sizeof(meminfo_t));
+   setpriority(PRIO_PROCESS, 0, 19);
+}
+
+static void
+_watch_slack_set(unsigned int interval)
+{
 #if defined(__linux__)
-   FILE *f;
-   unsigned long swap_free = 0, tmp_free = 0, tmp_slab = 0;
-   char line[256];
-   int fields = 0;
+   /* A tenth of the interval, in nanoseconds. */
+   prctl(PR_SET_TIMERSLACK, (unsigned long) interval * 100000UL, 0, 0, 0);
+#else
+   (void) interval;
+#endif
+}
 
-   f = fopen("/proc/meminfo", "r");
-   if (!f) return;
+static bool
+_watch_changed(watch_t *watch)
+{
+   double value, delta, scale;
+   bool changed = false;
+   int i, n = tingle_field_count();
 
-   while (fgets(line, sizeof(line), f) != NULL)
+   for (i = 0; i < n; i++)
      {
-        if (!strncmp("MemTotal:", line, 9))
-          {
-             memory->total = _meminfo_parse_line(line);
-             fields++;
-          }
-        else if (!strncmp("MemFree:", line, 8))
-          {
-             tmp_free = _meminfo_parse_line(line);
-             fields++;
-          }
-        else if (!strncmp("Cached:", line, 7))
-          {
-             memory->cached = _meminfo_parse_line(line);
-             fields++;
-          }
-        else if (!strncmp("Slab:", line, 5))
-          {
-             tmp_slab = _meminfo_parse_line(line);
-             fields++;
-          }
-        else if (!strncmp("Buffers:", line, 8))
-          {
-             memory->buffered = _meminfo_parse_line(line);
-             fields++;
-          }
-        else if (!strncmp("Shmem:", line, 6))
-          {
-             memory->shared = _meminfo_parse_line(line);
-             fields++;
-          }
-        else if (!strncmp("SwapTotal:", line, 10))
-          {
-             memory->swap_total = _meminfo_parse_line(line);
-             fields++;
-          }
-        else if (!strncmp("SwapFree:", line, 9))
+        if (!tingle_field_get(watch->tingle, i, &value))
+          continue;
+
+        if (watch->prev_valid[i])
           {
-             swap_free = _meminfo_parse_line(line);
-             fields++;
+             delta = fabs(value - watch->prev[i]);
+             scale = fmax(fabs(value), fabs(watch->prev[i]));
+             if (delta > ADAPTIVE_CHANGE_MIN && delta > scale * ADAPTIVE_CHANGE)
+               changed = true;
           }
+        else
+          changed = true;
 
-        if (fields >= 8)
-          break;
+        watch->prev[i] = value;
+        watch->prev_valid[i] = true;
      }
 
-   memory->cached += tmp_slab;
-   memory->used = memory->total - tmp_free - memory->cached - memory->buffered;
-   memory->swap_used = memory->swap_total = swap_free;
-
-   fclose(f);
-#elif defined(__FreeBSD__) || defined(__DragonFly__)
-   int total_pages = 0, free_pages = 0, inactive_pages = 0;
-   long int result = 0;
-   int page_size = getpagesize();
-   int mib[4] = { CTL_HW, HW_PHYSMEM, 0, 0 };
-
-   len = sizeof(memory->total);
-   if (sysctl(mib, 2, &memory->total, &len, NULL, 0) == -1)
-     return;
-   memory->total /= 1024;
-
-   total_pages =
-     _sysctlfromname("vm.stats.vm.v_page_count", mib, 4, &len);
-   if (total_pages < 0)
-     return;
-
-   free_pages = _sysctlfromname("vm.stats.vm.v_free_count", mib, 4, &len);
-   if (free_pages < 0)
-     return;
-
-   inactive_pages =
-     _sysctlfromname("vm.stats.vm.v_inactive_count", mib, 4, &len);
-   if (inactive_pages < 0)
-     return;
-
-   memory->used = (total_pages - free_pages - inactive_pages) * page_size;
-   _memsize_bytes_to_kb(&memory->used);
-
-   result = _sysctlfromname("vfs.bufspace", mib, 2, &len);
-   if (result < 0)
-     return;
-   memory->buffered = (result);
-   _memsize_bytes_to_kb(&memory->buffered);
-
-   result = _sysctlfromname("vm.stats.vm.v_active_count", mib, 4, &len);
-   if (result < 0)
-     return;
-   memory->cached = (result * page_size);
-   _memsize_bytes_to_kb(&memory->cached);
-
-   result = _sysctlfromname("vm.stats.vm.v_cache_count", mib, 4, &len);
-   if (result < 0)
-     return;
-   memory->shared = (result * page_size);
-   _memsize_bytes_to_kb(&memory->shared);
-
-   result = _sysctlfromname("vm.swap_total", mib, 2, &len);
-   if (result < 0)
-     return;
-   memory->swap_total = (result / 1024);
+   return changed;
+}
 
-   struct xswdev xsw;
-   /* previous mib is important for this one... */
+static void
+_watch_adapt(loop_t *loop, watch_t *watch)
+{
+   unsigned int interval = loop->interval;
 
-   while (i++)
+   if (_watch_changed(watch))
      {
-        mib[2] = i;
-        len = sizeof(xsw);
-        if (sysctl(mib, 3, &xsw, &len, NULL, 0) == -1)
-          break;
-
-        memory->swap_used += xsw.xsw_used * page_size;
+        interval = watch->interval_min;
+        watch->stable = 0;
+     }
+   else if (++watch->stable >= ADAPTIVE_STABLE_TICKS)
+     {
+        interval = interval * 2 > watch->interval_max ? watch->interval_max : interval * 2;
+        watch->stable = 0;
      }
 
-   memory->swap_used >>= 10;
-
-#elif defined(__OpenBSD__)
-   static int mib[] = { CTL_HW, HW_PHYSMEM64 };
-   static int bcstats_mib[] = { CTL_VFS, VFS_GENERIC, VFS_BCACHESTAT };
-   struct bcachestats bcstats;
-   static int uvmexp_mib[] = { CTL_VM, VM_UVMEXP };
-   struct uvmexp uvmexp;
-   int nswap, rnswap;
-   struct swapent *swdev = NULL;
+   if (interval != loop->interval)
+     {
+        _watch_slack_set(interval);
+        loop_interval_set(loop, interval);
+     }
+}
 
-   len = sizeof(memory->total);
-   if (sysctl(mib, 2, &memory->total, &len, NULL, 0) == -1)
-     return;
+/* Our own wakeups per second and CPU use, over at least a second.
+ * Returns whether they were updated. */
+static bool
+_watch_self_update(loop_t *loop, watch_t *watch)
+{
+   struct rusage usage;
+   struct timespec now;
+   double elapsed, cpu_time;
 
-   len = sizeof(uvmexp);
-   if (sysctl(uvmexp_mib, 2, &uvmexp, &len, NULL, 0) == -1)
-     return;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   elapsed = (now.tv_sec - watch->stamp.tv_sec) + (now.tv_nsec - watch->stamp.tv_nsec) / 1e9;
+   if (watch->stamp.tv_sec && elapsed < 1.0)
+     return false;
 
-   len = sizeof(bcstats);
-   if (sysctl(bcstats_mib, 3, &bcstats, &len, NULL, 0) == -1)
-     return;
+   getrusage(RUSAGE_SELF, &usage);
+   cpu_time = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+              usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
 
-   /* Don't fail if there's not swap! */
-   nswap = swapctl(SWAP_NSWAP, 0, 0);
-   if (nswap == 0)
-     goto swap_out;
+   if (watch->stamp.tv_sec)
+     {
+        watch->wakeup_rate = (loop->wakeups - watch->wakeups) / elapsed;
+        watch->cpu_percent = (cpu_time - watch->cpu_time) * 100.0 / elapsed;
+     }
 
-   swdev = calloc(nswap, sizeof(*swdev));
-   if (swdev == NULL)
-     goto swap_out;
+   watch->stamp = now;
+   watch->wakeups = loop->wakeups;
+   watch->cpu_time = cpu_time;
 
-   rnswap = swapctl(SWAP_STATS, swdev, nswap);
-   if (rnswap == -1)
-     goto swap_out;
+   return true;
+}
 
-   for (i = 0; i < nswap; i++) {
-        if (swdev[i].se_flags & SWF_ENABLE)
+static void
+_watch_tick_cb(loop_t *loop)
+{
+   watch_t *watch = loop->data;
+
+   tingle_sample(watch->tingle);
+   rules_eval(watch->rules, watch->tingle);
+   sinks_write(watch->sinks, loop, watch->tingle);
+   recorder_write(watch->recorder, watch->tingle);
+   if (watch->server)
+     watch->server->seq++;
+
+   /* A template owns the output line, and with only sinks asked for
+    * there's nothing for stdout. */
+   if (watch->format || (!watch->count && !watch->status_line))
+     {
+        if (watch->format)
+          format_write(watch->format, watch->tingle, STDOUT_FILENO);
+        if (watch->adaptive)
           {
-             memory->swap_used += (swdev[i].se_inuse / (1024 / DEV_BSIZE));
-             memory->swap_total += (swdev[i].se_nblks / (1024 / DEV_BSIZE));
+             /* The line isn't ours to extend; report on stderr. */
+             if (_watch_self_update(loop, watch))
+               fprintf(stderr, "self %.2f %.3f %u\n", watch->wakeup_rate,
+                       watch->cpu_percent, loop->interval);
+             _watch_adapt(loop, watch);
           }
+        return;
      }
-swap_out:
-   if (swdev)
-     free(swdev);
-
-   memory->total /= 1024;
-
-   memory->cached = (uvmexp.pagesize * bcstats.numbufpages);
-   _memsize_bytes_to_kb(&memory->cached);
-
-   memory->used = (uvmexp.active * uvmexp.pagesize);
-   _memsize_bytes_to_kb(&memory->used);
 
-   memory->buffered = (uvmexp.pagesize * (uvmexp.npages - uvmexp.free));
-   _memsize_bytes_to_kb(&memory->buffered);
+   _results_output(tingle_results(watch->tingle), watch->order, watch->count, watch->status_line);
 
-   memory->shared = (uvmexp.pagesize * uvmexp.wired);
-   _memsize_bytes_to_kb(&memory->shared);
-#elif defined(__MacOS__)
-   int mib[2] = { CTL_HW, HW_MEMSIZE };
-   size_t total;
-   vm_size_t page_size;
-   mach_port_t mach_port;
-   mach_msg_type_number_t count;
-   vm_statistics64_data_t vm_stats;
-   struct xsw_usage xsu;
-
-   size_t len = sizeof(size_t);
-   if (sysctl(mib, 2, &total, &len, NULL, 0) == -1)
-     return;
-   mach_port = mach_host_self();
-   count = sizeof(vm_stats) / sizeof(natural_t);
-
-   total >>= 10;
-   memory->total = total;
-
-   if (host_page_size(mach_port, &page_size) == KERN_SUCCESS &&
-       host_statistics64(mach_port, HOST_VM_INFO, (host_info64_t)&vm_stats, &count) == KERN_SUCCESS)
+   if (watch->adaptive)
      {
-        memory->used = vm_stats.active_count + vm_stats.inactive_count + vm_stats.wire_count * page_size;
-        memory->used >>= 10;
-        memory->cached = vm_stats.active_count * page_size;
-        memory->cached >>= 10;
-        memory->shared = vm_stats.wire_count * page_size;
-        memory->shared >>= 10;
-        memory->buffered = vm_stats.inactive_count * page_size;
-        memory->buffered >>= 10;
+        _watch_self_update(loop, watch);
+        if (watch->status_line)
+          printf(" [SELF]: %.2f wakeups/s %.3f%% %ums", watch->wakeup_rate,
+                 watch->cpu_percent, loop->interval);
+        else
+          printf("self %.2f %.3f %u", watch->wakeup_rate, watch->cpu_percent, loop->interval);
+        _watch_adapt(loop, watch);
      }
+   if (watch->status_line || watch->adaptive)
+     printf("\n");
+   fflush(stdout);
+}
+
+static void
+_watch_demand(loop_t *loop, void *data)
+{
+   watch_t *watch = data;
 
-   total = sizeof(xsu);
-   if (sysctlbyname("vm.swapusage", &xsu, &total, NULL, 0) != -1)
+   watch->stable = 0;
+   if (watch->adaptive && loop->interval != watch->interval_min)
      {
-        memory->swap_total = xsu.xsu_total;
-        memory->swap_used = xsu.xsu_used;
+        _watch_slack_set(watch->interval_min);
+        loop_interval_set(loop, watch->interval_min);
      }
-#endif
 }
 
-static int
-_mixer_master_volume_get(mixer_t *mixer)
+static void
+_watch_signal_cb(loop_t *loop, int signo)
 {
-#if defined(__OpenBSD__) || defined(__NetBSD__)
-   int i, fd, devn;
-   char name[64];
-   mixer_devinfo_t dinfo;
-   mixer_ctrl_t *values = NULL;
-   mixer_devinfo_t *info = NULL;
+   watch_t *watch = loop->data;
 
-   fd = open("/dev/mixer", O_RDONLY);
-   if (fd < 0)
-     return 0;
+   if (signo == SIGHUP)
+     tingle_reload(watch->tingle);
+   else if (signo == SIGUSR1)
+     {
+        /* Someone wants fresh figures now. */
+        _watch_demand(loop, watch);
+        loop->tick(loop);
+     }
+   else
+     loop->running = false;
+}
 
-   for (devn = 0;; devn++) {
-        dinfo.index = devn;
-        if (ioctl(fd, AUDIO_MIXER_DEVINFO, &dinfo))
-          break;
-     }
+/* The outputs in watch are filled in by the caller. */
+static int
+watch_run(watch_t *watch, unsigned int interval, unsigned int interval_max)
+{
+   loop_t loop;
+   server_t *server = watch->server;
+   int ret = EXIT_SUCCESS;
 
-   info = calloc(devn, sizeof(*info));
-   if (!info)
-     return 0;
+   memset(&loop, 0, sizeof(loop_t));
 
-   for (i = 0; i < devn; i++) {
-        info[i].index = i;
-        if (ioctl(fd, AUDIO_MIXER_DEVINFO, &info[i]) == -1)
+   if (interval_max > interval)
+     {
+        watch->adaptive = loop.align = true;
+        watch->interval_min = interval;
+        watch->interval_max = interval_max;
+        watch->prev = calloc(tingle_field_count(), sizeof(double));
+        watch->prev_valid = calloc(tingle_field_count(), sizeof(bool));
+        if (!watch->prev || !watch->prev_valid)
           {
-             --devn;
-             --i;
-             mixer->enabled = true;
-             continue;
+             fprintf(stderr, "Error: out of memory\n");
+             ret = EXIT_FAILURE;
+             goto out;
           }
+        _watch_slack_set(interval);
      }
 
-   values = calloc(devn, sizeof(*values));
-   if (!values)
-     return 0;
+   loop.data = watch;
+   loop.tick = _watch_tick_cb;
+   loop.signal = _watch_signal_cb;
 
-   for (i = 0; i < devn; i++) {
-        values[i].dev = i;
-        values[i].type = info[i].type;
-        if (info[i].type != AUDIO_MIXER_CLASS)
-          {
-             values[i].un.value.num_channels = 2;
-             if (ioctl(fd, AUDIO_MIXER_READ, &values[i]) == -1)
-               {
-                  values[i].un.value.num_channels = 1;
-                  if (ioctl(fd, AUDIO_MIXER_READ, &values[i])
-                      == -1)
-                    return 0;
-               }
-          }
+   if (!loop_init(&loop, interval))
+     {
+        fprintf(stderr, "Error: unable to create event loop: %s\n", strerror(errno));
+        ret = EXIT_FAILURE;
      }
-
-   for (i = 0; i < devn; i++) {
-        strlcpy(name, info[i].label.name, sizeof(name));
-        if (!strcmp("master", name))
-          {
-             mixer->volume_left = values[i].un.value.level[0];
-             mixer->volume_right = values[i].un.value.level[1];
-             mixer->enabled = true;
-             break;
-          }
+   else if (server && !loop_add(&loop, &server->listener))
+     {
+        fprintf(stderr, "Error: unable to watch listener: %s\n", strerror(errno));
+        ret = EXIT_FAILURE;
      }
-
-   close(fd);
-
-   if (values)
-     free(values);
-   if (info)
-     free(info);
-
-#elif defined(__FreeBSD__) || defined(__DragonFly__) || defined(__linux__) && !defined(HAVE_ALSA)
-   int bar;
-   int fd = open("/dev/mixer", O_RDONLY);
-   if (fd == -1)
-     return 0;
-
-   if ((ioctl(fd, MIXER_READ(0), &bar)) == -1)
+   else
      {
-        return 0;
+        if (server)
+          {
+             server->demand = _watch_demand;
+             server->data = watch;
+          }
+        tingle_baseline(watch->tingle);
+        loop_run(&loop);
      }
 
-   mixer->enabled = true;
-   mixer->volume_left = bar & 0x7f;
-   mixer->volume_right = (bar >> 8) & 0x7f;
-   close(fd);
-#elif defined(__linux__) && defined(HAVE_ALSA)
-   snd_mixer_t *h;
-   snd_mixer_elem_t *elem;
-   snd_mixer_selem_id_t *id;
-   long int value;
-   double volume;
-
-   snd_mixer_selem_id_alloca(&id);
-   snd_mixer_selem_id_set_index(id, 0);
-   snd_mixer_selem_id_set_name(id, "Master");
-
-   if ((snd_mixer_open(&h, 0)) == -1) return (0);
-   if ((snd_mixer_attach(h, "default")) == -1) return(0);
-   if ((snd_mixer_selem_register(h, NULL, NULL)) == -1) goto out;
-   if ((snd_mixer_load(h)) == -1) goto out;
-
-   if (!(elem = snd_mixer_find_selem(h, id))) goto out;
-
-   long int max, min;
+   /* Sinks waiting on the loop leave it before it goes. */
+   sinks_shutdown(watch->sinks, &loop);
+   loop_shutdown(&loop);
+out:
+   free(watch->prev);
+   free(watch->prev_valid);
 
-   snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
-   snd_mixer_selem_get_playback_volume(elem, 0, &value);
-   double ratio = max - min / 100;
-   volume = value / ratio;
+   return ret;
+}
 
-   mixer->enabled = true;
-   mixer->volume_left = mixer->volume_right = volume * 100;
-out:
-   snd_mixer_close(h);
-#elif defined(__MacOS__)
-   AudioDeviceID id;
-   AudioObjectPropertyAddress prop;
-   float volume;
-   unsigned int id_size = sizeof(id);
-   unsigned int vol_size = sizeof(volume);
+/* Aggregator (--aggregate). One persistent connection per peer, all
+ * driven from the loop: every interval the replies to the previous
+ * round are printed with fleet-wide sum, max and 95th percentile, then
+ * each connected peer is asked again. Peers that are down are retried
+ * once per interval; one that stays silent is reconnected. */
+#define AGGREGATE_PEERS_MAX   (LOOP_SOURCES_MAX - 8)
+#define AGGREGATE_STALL_TICKS 3
+#define AGGREGATE_RESOLVE_TICKS 10
 
-   prop.mSelector = kAudioHardwarePropertyDefaultOutputDevice;
-   prop.mScope = kAudioObjectPropertyScopeGlobal;
-   prop.mElement = kAudioObjectPropertyElementMaster;
+enum
+{
+   PEER_DISCONNECTED,
+   PEER_CONNECTING,
+   PEER_CONNECTED,
+};
 
-   if (AudioObjectGetPropertyData(kAudioObjectSystemObject, &prop, 0, NULL, &id_size, &id))
-     return (0);
+typedef struct
+{
+   loop_source_t            source;
+   char                    *name;
+   struct sockaddr_storage  addr;
+   socklen_t                addr_len;
+   int                      state;
+   int                      waiting;
+   int                      resolve_wait;
+   uint8_t                  buf[SNAPSHOT_SIZE];
+   size_t                   len;
+   bool                     fresh;
+   snapshot_t               snap;
+} peer_t;
 
-   prop.mSelector = kAudioDevicePropertyVolumeScalar;
-   prop.mScope = kAudioDevicePropertyScopeOutput;
-   prop.mElement = 0;
+typedef struct
+{
+   peer_t  *peers;
+   int      count;
+   double  *scratch;
+   bool     status_line;
+} aggregate_t;
 
-   if (AudioObjectGetPropertyData(id, &prop, 0, NULL, &vol_size, &volume))
-     return (0);
+static void
+_peer_close(loop_t *loop, peer_t *peer)
+{
+   if (peer->source.fd != -1)
+     {
+        loop_del(loop, &peer->source);
+        close(peer->source.fd);
+     }
+   peer->source.fd = -1;
+   peer->state = PEER_DISCONNECTED;
+   peer->waiting = 0;
+   peer->len = 0;
+}
 
-   mixer->volume_left = mixer->volume_right = volume * 100;
+static void
+_peer_request(loop_t *loop, peer_t *peer)
+{
+   char c = 's';
 
-   mixer->enabled = true;
-#endif
-   return mixer->enabled;
+   if (write(peer->source.fd, &c, 1) != 1)
+     _peer_close(loop, peer);
+   else
+     peer->waiting = 1;
 }
 
 static void
-_temperature_cpu_get(int *temperature)
+_peer_watch(loop_t *loop, peer_t *peer, int events)
 {
-#if defined(__OpenBSD__) || defined(__NetBSD__)
-   int mibs[5] = { CTL_HW, HW_SENSORS, 0, 0, 0 };
-   int devn, numt;
-   struct sensor snsr;
-   size_t slen = sizeof(struct sensor);
-   struct sensordev snsrdev;
-   size_t sdlen = sizeof(struct sensordev);
+   loop_del(loop, &peer->source);
+   peer->source.events = events;
+   if (!loop_add(loop, &peer->source))
+     _peer_close(loop, peer);
+}
 
-   for (devn = 0;; devn++) {
-        mibs[2] = devn;
+static void
+_peer_cb(loop_t *loop, loop_source_t *source, int events)
+{
+   peer_t *peer = source->data;
+   socklen_t len = sizeof(int);
+   ssize_t n;
+   int error = 0;
 
-        if (sysctl(mibs, 3, &snsrdev, &sdlen, NULL, 0) == -1)
+   if (peer->state == PEER_CONNECTING)
+     {
+        if (!(events & (LOOP_WRITE | LOOP_READ)))
+          return;
+        if (getsockopt(source->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error)
           {
-             if (errno == ENOENT)
-               break;
-             else
-               continue;
+             _peer_close(loop, peer);
+             return;
           }
-        if (!strcmp("cpu0", snsrdev.xname))
-          break;
-        else if (!strcmp("km0", snsrdev.xname))
-          break;
-     }
-
-   for (numt = 0; numt < snsrdev.maxnumt[SENSOR_TEMP]; numt++) {
-        mibs[4] = numt;
-
-        if (sysctl(mibs, 5, &snsr, &slen, NULL, 0) == -1)
-          continue;
-
-        if (slen > 0 && (snsr.flags & SENSOR_FINVALID) == 0)
-          break;
+        peer->state = PEER_CONNECTED;
+        _peer_watch(loop, peer, LOOP_READ);
+        if (peer->state == PEER_CONNECTED)
+          _peer_request(loop, peer);
+        return;
      }
 
-   if (sysctl(mibs, 5, &snsr, &slen, NULL, 0)
-       != -1)
+   n = read(source->fd, peer->buf + peer->len, sizeof(peer->buf) - peer->len);
+   if (n == -1 && (errno == EAGAIN || errno == EINTR))
+     return;
+   if (n <= 0)
      {
-        *temperature = (snsr.value - 273150000) / 1000000.0;
+        _peer_close(loop, peer);
+        return;
      }
+
+   peer->len += n;
+   if (peer->len < sizeof(peer->buf))
+     return;
+
+   peer->len = 0;
+   peer->waiting = 0;
+   if (snapshot_decode(&peer->snap, peer->buf))
+     peer->fresh = true;
    else
-     *temperature = INVALID_TEMP;
-#elif defined(__FreeBSD__) || defined(__DragonFly__)
-   unsigned int value;
-   size_t len = sizeof(value);
-   if ((sysctlbyname
-          ("hw.acpi.thermal.tz0.temperature", &value, &len, NULL,
-          0)) != -1)
+     _peer_close(loop, peer);
+}
+
+static void
+_peer_connect(loop_t *loop, peer_t *peer)
+{
+   /* Names are looked up on each connect, so one that doesn't resolve
+    * yet is only shown as down. The lookup blocks, so after a failure
+    * it waits a few ticks. */
+   if (peer->resolve_wait && --peer->resolve_wait)
+     return;
+   if (!_remote_resolve(peer->name, false, &peer->addr, &peer->addr_len))
      {
-        *temperature = (value - 2732) / 10;
+        peer->resolve_wait = AGGREGATE_RESOLVE_TICKS;
+        return;
      }
-   else
-     *temperature = INVALID_TEMP;
-#elif defined(__linux__)
-   struct dirent *dh;
-   DIR *dir;
-   char path[PATH_MAX];
-
-   *temperature = INVALID_TEMP;
 
-   dir = opendir("/sys/class/thermal");
-   if (!dir) return;
+   peer->source.fd = _remote_socket(peer->addr.ss_family);
+   if (peer->source.fd == -1)
+     return;
 
-   while ((dh = readdir(dir)) != NULL)
+   peer->state = PEER_CONNECTING;
+   peer->source.events = LOOP_WRITE;
+   if (connect(peer->source.fd, (struct sockaddr *) &peer->addr, peer->addr_len) == -1 &&
+       errno != EINPROGRESS)
      {
-        if (!strncmp(dh->d_name, "thermal_zone", 12))
-          {
-             snprintf(path, sizeof(path), "/sys/class/thermal/%s/type", dh->d_name);
-             char *type = Fcontents(path);
-             if (type)
-               {
-                  /* This should ensure we get the highest available core temperature */
-                  if (strstr(type, "_pkg_temp"))
-                    {
-                       snprintf(path, sizeof(path), "/sys/class/thermal/%s/temp", dh->d_name);
-                       char *value = Fcontents(path);
-                       if (value)
-                         {
-                            *temperature = atoi(value) / 1000;
-                            free(value);
-                            free(type);
-                            break;
-                         }
-                    }
-                  free(type);
-               }
-          }
+        close(peer->source.fd);
+        peer->source.fd = -1;
+        peer->state = PEER_DISCONNECTED;
+        return;
      }
 
-   closedir(dir);
-#elif defined(__MacOS__)
-   *temperature = INVALID_TEMP;
-#endif
+   if (!loop_add(loop, &peer->source))
+     _peer_close(loop, peer);
 }
 
 static int
-_power_battery_count_get(power_t *power)
-{
-#if defined(__OpenBSD__) || defined(__NetBSD__)
-   struct sensordev snsrdev;
-   size_t sdlen = sizeof(struct sensordev);
-   int mib[5] = { CTL_HW, HW_SENSORS, 0, 0, 0 };
-   int i, devn;
-   for (devn = 0;; devn++) {
-        mib[2] = devn;
-        if (sysctl(mib, 3, &snsrdev, &sdlen, NULL, 0) == -1)
-          {
-             if (errno == ENXIO)
-               continue;
-             if (errno == ENOENT)
-               break;
-          }
+_aggregate_cmp(const void *a, const void *b)
+{
+   double x = *(const double *) a, y = *(const double *) b;
 
-        for (i = 0; i < MAX_BATTERIES; i++) {
-             char buf[64];
-             snprintf(buf, sizeof(buf), "acpibat%d", i);
-             if (!strcmp(buf, snsrdev.xname))
-               {
-                  power->bat_mibs[power->battery_count] =
-                    malloc(sizeof(int) * 5);
-                  int *tmp = power->bat_mibs[power->battery_count++];
-                  tmp[0] = mib[0];
-                  tmp[1] = mib[1];
-                  tmp[2] = mib[2];
-               }
-          }
+   return (x > y) - (x < y);
+}
 
-        if (!strcmp("acpiac0", snsrdev.xname))
-          {
-             power->ac_mibs[0] = mib[0];
-             power->ac_mibs[1] = mib[1];
-             power->ac_mibs[2] = mib[2];
-          }
-     }
-#elif defined(__FreeBSD__) || defined(__DragonFly__)
-   size_t len;
-   if ((sysctlbyname("hw.acpi.battery.life", NULL, &len, NULL, 0)) != -1)
+/* Sum, max and nearest-rank 95th percentile of one field over the
+ * peers that answered. */
+static int
+_aggregate_stats(aggregate_t *agg, int field, double *sum, double *max, double *p95)
+{
+   peer_t *peer;
+   int i, n = 0;
+
+   *sum = *max = *p95 = 0;
+   for (i = 0; i < agg->count; i++)
      {
-        power->bat_mibs[power->battery_count] = malloc(sizeof(int) * 5);
-        sysctlnametomib("hw.acpi.battery.life",
-                        power->bat_mibs[power->battery_count], &len);
-        power->battery_count = 1;
+        peer = &agg->peers[i];
+        if (!peer->fresh || !(peer->snap.mask & (1u << field))) continue;
+        agg->scratch[n++] = peer->snap.values[field];
+        *sum += peer->snap.values[field];
      }
+   if (!n) return 0;
+
+   qsort(agg->scratch, n, sizeof(double), _aggregate_cmp);
+   *max = agg->scratch[n - 1];
+   *p95 = agg->scratch[(int) ceil(n * 0.95) - 1];
+
+   return n;
+}
 
-   if ((sysctlbyname("hw.acpi.acline", NULL, &len, NULL, 0)) != -1)
+static void
+_aggregate_value(const snapshot_t *snap, int field, double scale)
+{
+   if (snap->mask & (1u << field))
+     printf(" %.2f", snap->values[field] / scale);
+   else
+     printf(" -");
+}
+
+static void
+_aggregate_verbose(aggregate_t *agg, int up)
+{
+   static const char *names[3] = { "sum", "max", "p95" };
+   static const double scales[SNAPSHOT_FIELDS] = { 1, 1024, 1024, 1024, 1024, 1, 1, 1 };
+   snapshot_t stats[3];
+   peer_t *peer;
+   int i, j;
+
+   memset(stats, 0, sizeof(stats));
+   for (i = 0; i < SNAPSHOT_FIELDS; i++)
      {
-        sysctlnametomib("hw.acpi.acline", power->ac_mibs, &len);
+        if (_aggregate_stats(agg, i, &stats[0].values[i], &stats[1].values[i], &stats[2].values[i]))
+          stats[0].mask |= 1u << i;
      }
-#elif defined(__linux__)
-   struct dirent *dh;
-   DIR *dir;
-
-   dir = opendir("/sys/class/power_supply");
-   if (!dir) return 0;
+   stats[1].mask = stats[2].mask = stats[0].mask;
 
-   while ((dh = readdir(dir)) != NULL)
+   /* cpu% mem.used mem.total (MB) net.in net.out (KB/s) load temp disk% */
+   for (i = 0; i < agg->count; i++)
      {
-        if (dh->d_name[0] == '.') continue;
-        if (!strncmp(dh->d_name, "BAT", 3))
+        peer = &agg->peers[i];
+        printf("%s %s", peer->name, peer->fresh ? "up" : "down");
+        if (peer->fresh)
           {
-             power->battery_names[power->battery_count++] = (char)dh->d_name[3];
+             for (j = 0; j < SNAPSHOT_FIELDS; j++)
+               _aggregate_value(&peer->snap, j, scales[j]);
           }
+        printf("\n");
      }
-
-   closedir(dir);
-#endif
-
-   power->batteries = malloc(power->battery_count * sizeof(bat_t **));
-
-   for (int i = 0; i < power->battery_count; i++)
+   for (i = 0; i < 3; i++)
      {
-	power->batteries[i] = calloc(1, sizeof(bat_t));
+        printf("%s %d", names[i], up);
+        for (j = 0; j < SNAPSHOT_FIELDS; j++)
+          _aggregate_value(&stats[i], j, scales[j]);
+        printf("\n");
      }
-
-   return power->battery_count;
 }
 
 static void
-_battery_state_get(power_t *power, int *mib)
+_aggregate_pretty(aggregate_t *agg, int up)
 {
-#if defined(__OpenBSD__) || defined(__NetBSD__)
-   static int index = 0;
-   double charge_full = 0;
-   double charge_current = 0;
-   size_t slen = sizeof(struct sensor);
-   struct sensor snsr;
+   double sum, max, p95, total, in, out;
 
-   mib[3] = 7;
-   mib[4] = 0;
-
-   if (sysctl(mib, 5, &snsr, &slen, NULL, 0) != -1)
-     charge_full = (double)snsr.value;
-
-   mib[3] = 7;
-   mib[4] = 3;
-
-   if (sysctl(mib, 5, &snsr, &slen, NULL, 0) != -1)
-     charge_current = (double)snsr.value;
-
-   /* ACPI bug workaround... */
-   if (charge_current == 0 || charge_full == 0)
+   printf(" [HOSTS]: %d/%d", up, agg->count);
+   if (_aggregate_stats(agg, SNAPSHOT_CPU, &sum, &max, &p95))
+     printf(" [CPU]: max %.2f%% p95 %.2f%%", max, p95);
+   if (_aggregate_stats(agg, SNAPSHOT_MEM_USED, &sum, &max, &p95))
      {
-        mib[3] = 8;
-        mib[4] = 0;
-
-        if (sysctl(mib, 5, &snsr, &slen, NULL, 0) != -1)
-          charge_full = (double)snsr.value;
+        _aggregate_stats(agg, SNAPSHOT_MEM_TOTAL, &total, &max, &p95);
+        printf(" [MEM]: %.0f/%.0fM", sum / 1024, total / 1024);
+     }
+   if (_aggregate_stats(agg, SNAPSHOT_NET_IN, &in, &max, &p95) &&
+       _aggregate_stats(agg, SNAPSHOT_NET_OUT, &out, &max, &p95))
+     printf(" [NET] %.2f/%.2f KB/s", in / 1024, out / 1024);
+   printf("\n");
+}
 
-        mib[3] = 8;
-        mib[4] = 3;
+static void
+_aggregate_tick_cb(loop_t *loop)
+{
+   aggregate_t *agg = loop->data;
+   peer_t *peer;
+   int i, up = 0;
 
-        if (sysctl(mib, 5, &snsr, &slen, NULL, 0) != -1)
-          charge_current = (double)snsr.value;
-     }
+   for (i = 0; i < agg->count; i++)
+     up += agg->peers[i].fresh;
 
-   power->batteries[index]->charge_full = charge_full;
-   power->batteries[index]->charge_current = charge_current;
-   ++index;
-#elif defined(__FreeBSD__) || defined(__DragonFly__)
-   unsigned int value;
-   size_t len = sizeof(value);
-   if ((sysctl(mib, 4, &value, &len, NULL, 0)) != -1)
-     power->batteries[0]->percent = value;
-#elif defined(__linux__)
-   char path[PATH_MAX];
-   struct dirent *dh;
-   DIR *dir;
-   char *buf, *naming = NULL;
-   int i = 0;
-   unsigned long charge_full = 0;
-   unsigned long charge_current = 0;
+   if (agg->status_line)
+     _aggregate_pretty(agg, up);
+   else
+     _aggregate_verbose(agg, up);
+   fflush(stdout);
 
-   while (power->battery_names[i] != '\0')
+   for (i = 0; i < agg->count; i++)
      {
-        snprintf(path, sizeof(path), "/sys/class/power_supply/BAT%c", power->battery_names[i]);
-        dir = opendir(path);
-        if (!dir) return;
-        while ((dh = readdir(dir)) != NULL)
-          {
-             if (!strcmp(dh->d_name, "energy_full"))
-               {
-                  naming = "energy"; break;
-               }
-             else if (!strcmp(dh->d_name, "capacity_full"))
-               {
-                  naming = "capacity"; break;
-               }
-          }
-        closedir(dir);
-        if (!naming) continue;
-        snprintf(path, sizeof(path), "/sys/class/power_supply/BAT%c/%s_full", power->battery_names[i], naming);
-        buf = Fcontents(path);
-        if (buf)
-          {
-             charge_full = atol(buf);
-             free(buf);
-          }
-        snprintf(path, sizeof(path), "/sys/class/power_supply/BAT%c/%s_now", power->battery_names[i], naming);
-        buf = Fcontents(path);
-        if (buf)
+        peer = &agg->peers[i];
+        peer->fresh = false;
+        if (peer->state == PEER_DISCONNECTED)
+          _peer_connect(loop, peer);
+        else if (peer->state == PEER_CONNECTING || peer->waiting)
           {
-             charge_current = atol(buf);
-             free(buf);
+             if (++peer->waiting > AGGREGATE_STALL_TICKS)
+               _peer_close(loop, peer);
           }
-        power->batteries[i]->charge_full = charge_full;
-        power->batteries[i]->charge_current = charge_current;
-        naming = NULL;
-        i++;
+        else
+          _peer_request(loop, peer);
      }
-#endif
 }
 
 static void
-_power_state_get(power_t *power)
+_aggregate_signal_cb(loop_t *loop, int signo)
 {
-   int i;
-#if defined(__OpenBSD__) || defined(__NetBSD__)
-   struct sensor snsr;
-   int have_ac = 0;
-   size_t slen = sizeof(struct sensor);
-#elif defined(__FreeBSD__) || defined(__DragonFly__)
-   unsigned int value;
-   size_t len;
-#elif defined(__linux__)
-   char *buf;
-   int have_ac = 0;
-#endif
-
-#if defined(__OpenBSD__) || defined(__NetBSD__)
-   power->ac_mibs[3] = 9;
-   power->ac_mibs[4] = 0;
+   if (signo == SIGINT || signo == SIGTERM)
+     loop->running = false;
+}
 
-   if (sysctl(power->ac_mibs, 5, &snsr, &slen, NULL, 0) != -1)
-     have_ac = (int)snsr.value;
-#elif defined(__FreeBSD__) || defined(__DragonFly__)
-   len = sizeof(value);
-   if ((sysctl(power->ac_mibs, 3, &value, &len, NULL, 0)) == -1)
+static int
+aggregate_run(const char *hosts, unsigned int interval, bool status_line)
+{
+   loop_t loop;
+   aggregate_t agg;
+   peer_t *peer;
+   char *list, *name, *save = NULL;
+   int i, ret = EXIT_SUCCESS;
+
+   memset(&loop, 0, sizeof(loop_t));
+   memset(&agg, 0, sizeof(aggregate_t));
+   agg.status_line = status_line;
+
+   list = strdup(hosts);
+   agg.peers = calloc(AGGREGATE_PEERS_MAX, sizeof(peer_t));
+   agg.scratch = calloc(AGGREGATE_PEERS_MAX, sizeof(double));
+   if (!list || !agg.peers || !agg.scratch)
      {
-        return;
+        fprintf(stderr, "Error: out of memory\n");
+        ret = EXIT_FAILURE;
+        goto out;
      }
-   power->have_ac = value;
-#elif defined(__linux__)
-   buf = Fcontents("/sys/class/power_supply/AC/online");
-   if (buf)
+
+   for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save))
      {
-        have_ac = atoi(buf);
-        free(buf);
+        if (agg.count == AGGREGATE_PEERS_MAX)
+          {
+             fprintf(stderr, "Error: too many hosts (at most %d)\n", AGGREGATE_PEERS_MAX);
+             ret = EXIT_FAILURE;
+             goto out;
+          }
+        peer = &agg.peers[agg.count];
+        peer->name = name;
+        peer->source.fd = -1;
+        peer->source.cb = _peer_cb;
+        peer->source.data = peer;
+        agg.count++;
      }
-#endif
 
-   for (i = 0; i < power->battery_count; i++)
-     _battery_state_get(power, power->bat_mibs[i]);
+   signal(SIGPIPE, SIG_IGN);
+
+   loop.data = &agg;
+   loop.tick = _aggregate_tick_cb;
+   loop.signal = _aggregate_signal_cb;
 
-#if defined(__OpenBSD__) || defined(__NetBSD__) || defined(__linux__)
-   for (i = 0; i < power->battery_count; i++)
+   if (!loop_init(&loop, interval))
      {
-        double percent =
-           100 * (power->batteries[i]->charge_current / power->batteries[i]->charge_full);
-        power->batteries[i]->percent = percent;
+        fprintf(stderr, "Error: unable to create event loop: %s\n", strerror(errno));
+        ret = EXIT_FAILURE;
      }
-   power->have_ac = have_ac;
-#elif defined(__FreeBSD__) || defined(__DragonFly__)
-   len = sizeof(value);
-   if ((sysctl(power->bat_mibs[0], 4, &value, &len, NULL, 0)) == -1)
+   else
      {
-        return;
+        for (i = 0; i < agg.count; i++)
+          _peer_connect(&loop, &agg.peers[i]);
+        loop_run(&loop);
      }
 
-   power->batteries[0]->percent = value;
+   for (i = 0; i < agg.count; i++)
+     _peer_close(&loop, &agg.peers[i]);
+   loop_shutdown(&loop);
+out:
+   free(agg.peers);
+   free(agg.scratch);
+   free(list);
 
-#endif
-   for (i = 0; i < power->battery_count; i++)
-     if (power->bat_mibs[i]) free(power->bat_mibs[i]);
+   return ret;
 }
 
-#if defined(__MacOS__) || defined(__FreeBSD__) || defined(__DragonFly__)
-static void
-_freebsd_generic_network_status(unsigned long int *in,
-                                unsigned long int *out)
+/* Analysis (--analyze) of a recording. The file is mapped and the time
+ * range found by binary search, then the selected fields are streamed
+ * over at most twice: once for count, min, mean and max, once into a
+ * fixed histogram for percentiles, which are within 1/ANALYZE_BINS of
+ * the range of the true value. --every downsamples in a single pass. */
+#define ANALYZE_BINS        4096
+#define ANALYZE_FIELDS_MAX  64
+
+typedef struct
 {
-   struct ifmibdata *ifmd;
-   size_t len;
-   int i, count;
-   len = sizeof(count);
+   const char   *from;
+   const char   *to;
+   const char   *fields[ANALYZE_FIELDS_MAX];
+   int           field_count;
+   double        every;
+   int           histogram;
+} analyze_query_t;
 
-   if (sysctlbyname
-         ("net.link.generic.system.ifcount", &count, &len, NULL, 0) < 0)
-     return;
+typedef struct
+{
+   const uint8_t *base;
+   size_t         size;
+   size_t         count;
+   uint32_t       columns;
+   const char    *names;
+} recording_t;
 
-   ifmd = malloc(sizeof(struct ifmibdata));
-   if (!ifmd)
-     return;
+typedef struct
+{
+   int             column;
+   unsigned long   count;
+   double          min;
+   double          max;
+   double          sum;
+   unsigned long  *bins;
+   unsigned long  *histogram;
+} analyze_stat_t;
+
+static int64_t
+_recording_time(const recording_t *rec, size_t i)
+{
+   return *(const int64_t *) (rec->base + i * rec->size);
+}
 
-   for (i = 1; i <= count; i++) {
-        int mib[] = { CTL_NET, PF_LINK, NETLINK_GENERIC, IFMIB_IFDATA, i, IFDATA_GENERAL };
-        len = sizeof(*ifmd);
-        if (sysctl(mib, 6, ifmd, &len, NULL, 0) < 0) continue;
-        if (!strcmp(ifmd->ifmd_name, "lo0"))
-          continue;
-        *in += ifmd->ifmd_data.ifi_ibytes;
-        *out += ifmd->ifmd_data.ifi_obytes;
-     }
-   free(ifmd);
+static const double *
+_recording_values(const recording_t *rec, size_t i)
+{
+   return (const double *) (rec->base + i * rec->size + sizeof(int64_t));
 }
 
-#endif
+static const char *
+_recording_name(const recording_t *rec, int column)
+{
+   return rec->names + column * RECORD_NAME_MAX;
+}
 
-#if defined(__OpenBSD__)
-static void
-_openbsd_generic_network_status(unsigned long int *in,
-                                unsigned long int *out)
+/* First record at or after ms (after, when past is set). */
+static size_t
+_recording_search(const recording_t *rec, int64_t ms, bool past)
 {
-   struct ifaddrs *interfaces, *ifa;
+   size_t lo = 0, hi = rec->count, mid;
+   int64_t t;
 
-   if (getifaddrs(&interfaces) < 0)
-     return;
+   while (lo < hi)
+     {
+        mid = lo + (hi - lo) / 2;
+        t = _recording_time(rec, mid);
+        if (t < ms || (past && t == ms))
+          lo = mid + 1;
+        else
+          hi = mid;
+     }
 
-   int sock = socket(AF_INET, SOCK_STREAM, 0);
-   if (sock < 0)
-     return;
+   return lo;
+}
 
-   for (ifa = interfaces; ifa; ifa = ifa->ifa_next) {
-        struct ifreq ifreq;
-        struct if_data if_data;
+static int
+_recording_column(const recording_t *rec, const char *name)
+{
+   uint32_t i;
+   int field;
 
-        ifreq.ifr_data = (void *)&if_data;
-        strncpy(ifreq.ifr_name, ifa->ifa_name, IFNAMSIZ - 1);
-        if (ioctl(sock, SIOCGIFDATA, &ifreq) < 0)
-          return;
+   for (i = 0; i < rec->columns; i++)
+     {
+        if (!strncmp(_recording_name(rec, i), name, RECORD_NAME_MAX))
+          return i;
+     }
 
-        struct if_data *const ifi = &if_data;
-        if (ifi->ifi_type == IFT_ETHER ||
-            ifi->ifi_type == IFT_FASTETHER ||
-            ifi->ifi_type == IFT_GIGABITETHERNET ||
-            ifi->ifi_type == IFT_IEEE80211)
-          {
-             if (ifi->ifi_ibytes)
-               *in += ifi->ifi_ibytes;
+   field = _format_field(name);
+   if (field == -1) return -1;
 
-             if (ifi->ifi_obytes)
-               *out += ifi->ifi_obytes;
-          }
-     }
-   close(sock);
+   return field == tingle_field_find(name) ? -1 : _recording_column(rec, tingle_field_name(field));
 }
 
-#endif
-
-#if defined(__linux__)
-static void
-_linux_generic_network_status(unsigned long int *in,
-                              unsigned long int *out)
+/* "now", "-<duration>", "@<epoch seconds>", "YYYY-MM-DD[ HH:MM[:SS]]"
+ * or "HH:MM[:SS]" today, in local time. */
+static bool
+_analyze_time(const char *text, int64_t now, int64_t *ms)
 {
-   FILE *f;
-   char buf[4096], dummy_s[256];
-   unsigned long int tmp_in, tmp_out, dummy;
+   struct tm tm;
+   time_t t = now / 1000;
+   double seconds;
+   char *end;
+   int n = 0;
+
+   if (!strcmp(text, "now"))
+     {
+        *ms = now;
+        return true;
+     }
+   if (text[0] == '-')
+     {
+        if (!_rule_duration(text + 1, &seconds)) return false;
+        *ms = now - (int64_t) (seconds * 1000);
+        return true;
+     }
+   if (text[0] == '@')
+     {
+        *ms = strtoll(text + 1, &end, 10) * 1000;
+        return end != text + 1 && !*end;
+     }
 
-   f = fopen("/proc/net/dev", "r");
-   if (!f) return;
+   localtime_r(&t, &tm);
+   tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+   tm.tm_isdst = -1;
 
-   while (fgets(buf, sizeof(buf), f))
+   if (strchr(text, '-'))
      {
-        if (17 == sscanf(buf, "%s %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu "
-                              "%lu %lu %lu %lu\n", dummy_s, &tmp_in, &dummy, &dummy,
-                         &dummy, &dummy, &dummy, &dummy, &dummy, &tmp_out, &dummy,
-                         &dummy, &dummy, &dummy, &dummy, &dummy, &dummy))
-          {
-             *in += tmp_in;
-             *out += tmp_out;
-          }
+        if (sscanf(text, "%d-%d-%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &n) != 3)
+          return false;
+        tm.tm_year -= 1900;
+        tm.tm_mon--;
+        text += n;
+        if (*text == ' ' || *text == 'T') text++;
+        else if (*text) return false;
+     }
+   if (*text)
+     {
+        if (sscanf(text, "%d:%d%n", &tm.tm_hour, &tm.tm_min, &n) != 2)
+          return false;
+        text += n;
+        if (*text == ':' && sscanf(text + 1, "%d%n", &tm.tm_sec, &n) == 1)
+          text += n + 1;
+        if (*text) return false;
      }
+   if (tm.tm_mon < 0 || tm.tm_mon > 11 || tm.tm_mday < 1 || tm.tm_mday > 31 ||
+       tm.tm_hour < 0 || tm.tm_hour > 23 || tm.tm_min < 0 || tm.tm_min > 59 ||
+       tm.tm_sec < 0 || tm.tm_sec > 60)
+     return false;
 
-   fclose(f);
-}
+   t = mktime(&tm);
+   if (t == (time_t) -1) return false;
 
-#endif
+   *ms = (int64_t) t * 1000;
+
+   return true;
+}
 
 static void
-_network_transfer_get(results_t *results)
+_analyze_time_print(int64_t ms)
 {
-   unsigned long first_in = 0, first_out = 0;
-   unsigned long last_in = 0, last_out = 0;
-#if defined(__linux__)
-   _linux_generic_network_status(&first_in, &first_out);
-   usleep(1000000);
-   _linux_generic_network_status(&last_in, &last_out);
-#elif defined(__OpenBSD__)
-   _openbsd_generic_network_status(&first_in, &first_out);
-   usleep(1000000);
-   _openbsd_generic_network_status(&last_in, &last_out);
-#elif defined(__MacOS__) || defined(__FreeBSD__) || defined(__DragonFly__)
-   _freebsd_generic_network_status(&first_in, &first_out);
-   usleep(1000000);
-   _freebsd_generic_network_status(&last_in, &last_out);
-#endif
-   results->incoming = last_in - first_in;
-   results->outgoing = last_out - first_out;
+   struct tm tm;
+   time_t t = ms / 1000;
+   char buf[32];
+
+   localtime_r(&t, &tm);
+   strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+   printf("%s", buf);
 }
 
-static int
-percentage(int value, int max)
+static double
+_analyze_percentile(const analyze_stat_t *stat, double p)
 {
-   double avg = (max / 100.0);
-   double tmp = value / avg;
+   unsigned long rank, seen = 0;
+   double width;
+   int i;
 
-   return round(tmp);
+   if (stat->max == stat->min) return stat->min;
+
+   rank = ceil(p * stat->count);
+   if (rank < 1) rank = 1;
+   width = (stat->max - stat->min) / ANALYZE_BINS;
+
+   for (i = 0; i < ANALYZE_BINS; i++)
+     {
+        if (seen + stat->bins[i] >= rank)
+          return stat->min + width * (i + (double) (rank - seen) / stat->bins[i]);
+        seen += stat->bins[i];
+     }
+
+   return stat->max;
 }
 
-static void
-results_pretty(results_t *results, int *order, int count)
+static int
+_analyze_bin(const analyze_stat_t *stat, double value, int bins)
 {
-   int i, j, flags;
+   int bin;
 
-   for (i = 0; i < count; i++) {
-        flags = order[i];
-        if (flags & RESULTS_CPU_CORES)
-          {
-             if (results->cpu_count > 1)
-               printf(" [CPUs]: ");
-             else
-               printf(" [CPU]: ");
-             for (j = 0; j < results->cpu_count; j++) {
-                  printf("%.2f%%", results->cores[j]->percent);
-                  if (j < (results->cpu_count - 1))
-                    printf(" ");
-               }
-          }
-        else if (flags & RESULTS_CPU)
-          {
-             double cpu_percent = 0;
-             for (j = 0; j < results->cpu_count; j++)
-               cpu_percent += results->cores[j]->percent;
+   if (stat->max == stat->min) return 0;
 
-             printf(" [CPU]: %.2f%%", cpu_percent / results->cpu_count);
-          }
+   bin = (value - stat->min) / (stat->max - stat->min) * bins;
 
-        if (flags & RESULTS_MEM)
-          {
-             unsigned long used = results->memory.used;
-             unsigned long total = results->memory.total;
-             char unit;
+   return bin >= bins ? bins - 1 : bin;
+}
 
-             if (flags & RESULTS_MEM_GB)
-               {
-                  unit = 'G';
-                  _memsize_kb_to_gb(&used);
-                  _memsize_kb_to_gb(&total);
-               }
-             else if (flags & RESULTS_MEM_MB)
-               {
-                  unit = 'M';
-                  _memsize_kb_to_mb(&used);
-                  _memsize_kb_to_mb(&total);
-               }
-             else
-               unit = 'K';
+static void
+_analyze_summary(const recording_t *rec, analyze_stat_t *stats, int count, size_t lo,
+                 size_t hi, int histogram)
+{
+   analyze_stat_t *stat;
+   const double *values;
+   double value, width;
+   size_t i;
+   int j, k;
 
-             printf(" [MEM]: %lu/%lu%c", used, total, unit);
-          }
+   for (j = 0; j < count; j++)
+     {
+        stats[j].min = INFINITY;
+        stats[j].max = -INFINITY;
+     }
 
-        if (flags & RESULTS_NET)
+   for (i = lo; i < hi; i++)
+     {
+        values = _recording_values(rec, i);
+        for (j = 0; j < count; j++)
           {
-             const char *unit = "B/s";
-             double incoming = results->incoming;
-             double outgoing = results->outgoing;
-
-             if ((incoming > 1048576) || (outgoing > 1048576))
-               {
-                  incoming = incoming / 1048576;
-                  outgoing = outgoing / 1048576;
-                  unit = "MB/s";
-               }
-             else if (((incoming > 1024) && (incoming < 1048576)) ||
-                      ((outgoing > 1024) && (outgoing < 1048576)))
-               {
-                  incoming /= 1024;
-                  outgoing /= 1024;
-                  unit = "KB/s";
-               }
-             printf(" [NET] %.2f/%.2f %s", incoming, outgoing, unit);
+             stat = &stats[j];
+             value = values[stat->column];
+             if (isnan(value)) continue;
+             stat->count++;
+             stat->sum += value;
+             if (value < stat->min) stat->min = value;
+             if (value > stat->max) stat->max = value;
           }
+     }
 
-        if (flags & RESULTS_TMP)
+   for (i = lo; i < hi; i++)
+     {
+        values = _recording_values(rec, i);
+        for (j = 0; j < count; j++)
           {
-             if (results->temperature != INVALID_TEMP)
-               printf(" [T]: %dC", results->temperature);
+             stat = &stats[j];
+             value = values[stat->column];
+             if (isnan(value)) continue;
+             stat->bins[_analyze_bin(stat, value, ANALYZE_BINS)]++;
+             if (histogram)
+               stat->histogram[_analyze_bin(stat, value, histogram)]++;
           }
+     }
 
-        if (flags & RESULTS_AUD)
+   /* field count min avg max p50 p90 p95 p99 */
+   for (j = 0; j < count; j++)
+     {
+        stat = &stats[j];
+        printf("%s %lu", _recording_name(rec, stat->column), stat->count);
+        if (!stat->count)
           {
-             if (results->mixer.enabled)
-               {
-                  uint8_t level =
-                    results->mixer.volume_right >
-                    results->mixer.volume_left ? results->mixer.
-                    volume_right : results->mixer.volume_left;
-#if defined(__MacOS__) || defined(__linux__) || defined(__FreeBSD__) || defined(__DragonFly__)
-                  uint8_t perc = percentage(level, 100);
-                  printf(" [VOL]: %d%%", perc);
-#elif defined(__OpenBSD__) || defined(__NetBSD__)
-                  uint8_t perc = percentage(level, 255);
-                  printf(" [VOL]: %d%%", perc);
-#endif
-               }
+             printf(" - - - - - - -\n");
+             continue;
           }
+        printf(" %.2f %.2f %.2f %.2f %.2f %.2f %.2f\n", stat->min, stat->sum / stat->count,
+               stat->max, _analyze_percentile(stat, 0.50), _analyze_percentile(stat, 0.90),
+               _analyze_percentile(stat, 0.95), _analyze_percentile(stat, 0.99));
 
-        if (flags & RESULTS_PWR)
+        width = (stat->max - stat->min) / (histogram ? histogram : 1);
+        for (k = 0; k < histogram; k++)
           {
-             if (results->power.have_ac)
-	       printf(" [AC]");
-             else
-	       printf(" [DC]");
-
-	     if (results->power.battery_count != 0)
-	       printf(":");
-
-             for (int i = 0; i < results->power.battery_count; i++)
-               {
-                  printf(" %d%%", results->power.batteries[i]->percent);
-               }
+             printf("%s %.2f %.2f %lu\n", _recording_name(rec, stat->column),
+                    stat->min + width * k, stat->min + width * (k + 1), stat->histogram[k]);
           }
+     }
+}
+
+static void
+_analyze_bucket_print(analyze_stat_t *stats, int count, int64_t start, unsigned long samples)
+{
+   analyze_stat_t *stat;
+   int j;
 
+   _analyze_time_print(start);
+   printf(" %lu", samples);
+   for (j = 0; j < count; j++)
+     {
+        stat = &stats[j];
+        if (stat->count)
+          printf(" %.2f %.2f %.2f", stat->min, stat->sum / stat->count, stat->max);
+        else
+          printf(" - - -");
+        stat->count = 0;
+        stat->sum = 0;
+        stat->min = INFINITY;
+        stat->max = -INFINITY;
      }
    printf("\n");
 }
 
-static void
-results_cpu(cpu_core_t **cores, int cpu_count, int flags)
+/* Local time's offset from UTC at a time in ms, in ms. */
+static int64_t
+_analyze_offset(int64_t ms)
 {
-   int i;
+   struct tm tm;
+   time_t t = ms / 1000;
 
-   if (flags & RESULTS_CPU_CORES)
+   localtime_r(&t, &tm);
+
+   return (int64_t) tm.tm_gmtoff * 1000;
+}
+
+/* time samples, then per field min avg max, per bucket of every ms
+ * aligned to local time. Each bucket starts and ends at the offset in
+ * force at those times, so they stay on the wall clock across DST. */
+static void
+_analyze_series(const recording_t *rec, analyze_stat_t *stats, int count, size_t lo,
+                size_t hi, int64_t every)
+{
+   analyze_stat_t *stat;
+   const double *values;
+   int64_t t, offset, wall, bucket = 0, next = 0, current = 0;
+   unsigned long samples = 0;
+   double value;
+   size_t i;
+   int j;
+
+   for (j = 0; j < count; j++)
      {
-        for (i = 0; i < cpu_count; i++)
-          printf("%.2f ", cores[i]->percent);
+        stats[j].min = INFINITY;
+        stats[j].max = -INFINITY;
      }
-   else
+
+   for (i = lo; i < hi; i++)
      {
-        double total = 0;
-        for (i = 0; i < cpu_count; i++)
-          total += cores[i]->percent;
-        printf("%.2f", total / cpu_count);
+        t = _recording_time(rec, i);
+        if (!samples || t >= next || t < bucket)
+          {
+             offset = _analyze_offset(t);
+             wall = (t + offset) / every * every;
+             bucket = wall - _analyze_offset(wall - offset);
+             next = wall + every - _analyze_offset(wall + every - offset);
+          }
+        if (samples && bucket != current)
+          {
+             _analyze_bucket_print(stats, count, current, samples);
+             samples = 0;
+          }
+        current = bucket;
+        samples++;
+
+        values = _recording_values(rec, i);
+        for (j = 0; j < count; j++)
+          {
+             stat = &stats[j];
+             value = values[stat->column];
+             if (isnan(value)) continue;
+             stat->count++;
+             stat->sum += value;
+             if (value < stat->min) stat->min = value;
+             if (value > stat->max) stat->max = value;
+          }
      }
 
-   printf("\n");
+   if (samples)
+     _analyze_bucket_print(stats, count, current, samples);
 }
 
-static void
-results_mem(meminfo_t *mem, int flags)
+static int
+analyze_run(const char *path, analyze_query_t *query)
 {
-   unsigned long total, used, cached, buffered;
-   unsigned long shared, swap_total, swap_used;
+   const record_header_t *header;
+   recording_t rec;
+   analyze_stat_t *stats = NULL;
+   struct timespec ts;
+   struct stat st;
+   void *map = MAP_FAILED;
+   int64_t now, from = INT64_MIN, to = INT64_MAX;
+   size_t lo, hi, header_size;
+   int i, count = 0, fd, ret = EXIT_FAILURE;
+
+   fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd == -1 || fstat(fd, &st) == -1)
+     {
+        fprintf(stderr, "Error: unable to open %s: %s\n", path, strerror(errno));
+        goto out;
+     }
 
-   total = mem->total;
-   used = mem->used;
-   cached = mem->cached;
-   buffered = mem->buffered;
-   shared = mem->shared;
-   swap_total = mem->swap_total;
-   swap_used = mem->swap_used;
+   if (st.st_size >= RECORD_HEADER)
+     map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (map == MAP_FAILED)
+     {
+        fprintf(stderr, "Error: %s is not a recording\n", path);
+        goto out;
+     }
 
-   if (flags & RESULTS_MEM_MB)
+   header = map;
+   header_size = RECORD_HEADER + (size_t) header->count * RECORD_NAME_MAX;
+   if (!memcmp(header->magic, RECORD_MAGIC, 4) && header->order != RECORD_ORDER)
      {
-        _memsize_kb_to_mb(&total);
-        _memsize_kb_to_mb(&used);
-        _memsize_kb_to_mb(&cached);
-        _memsize_kb_to_mb(&buffered);
-        _memsize_kb_to_mb(&shared);
-        _memsize_kb_to_mb(&swap_total);
-        _memsize_kb_to_mb(&swap_used);
+        fprintf(stderr, "Error: %s was recorded with a different byte order\n", path);
+        goto out;
      }
-   else if (flags & RESULTS_MEM_GB)
+   if (memcmp(header->magic, RECORD_MAGIC, 4) || header->count > 4096 ||
+       header->size != sizeof(int64_t) + header->count * sizeof(double) ||
+       (size_t) st.st_size < header_size)
      {
-        _memsize_kb_to_gb(&total);
-        _memsize_kb_to_gb(&used);
-        _memsize_kb_to_gb(&cached);
-        _memsize_kb_to_gb(&buffered);
-        _memsize_kb_to_gb(&shared);
-        _memsize_kb_to_gb(&swap_total);
-        _memsize_kb_to_gb(&swap_used);
+        fprintf(stderr, "Error: %s is not a recording\n", path);
+        goto out;
      }
 
-   printf("%lu %lu %lu %lu %lu %lu %lu\n",
-          total, used, cached, buffered, shared, swap_total, swap_used);
-}
+   rec.base = (const uint8_t *) map + header_size;
+   rec.size = header->size;
+   rec.count = (st.st_size - header_size) / header->size;
+   rec.columns = header->count;
+   rec.names = (const char *) map + RECORD_HEADER;
 
-static void
-results_power(power_t *power)
-{
-   printf("%d", power->have_ac);
-   for (int i = 0; i < power->battery_count; i++)
+   clock_gettime(CLOCK_REALTIME, &ts);
+   now = (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+   if (query->from && !_analyze_time(query->from, now, &from))
+     {
+        fprintf(stderr, "Error: invalid time '%s'\n", query->from);
+        goto out;
+     }
+   if (query->to && !_analyze_time(query->to, now, &to))
+     {
+        fprintf(stderr, "Error: invalid time '%s'\n", query->to);
+        goto out;
+     }
+
+   count = query->field_count ? query->field_count : (int) rec.columns;
+   stats = calloc(count, sizeof(analyze_stat_t));
+   if (!stats)
+     {
+        fprintf(stderr, "Error: out of memory\n");
+        goto out;
+     }
+
+   for (i = 0; i < count; i++)
+     {
+        stats[i].column = query->field_count ? _recording_column(&rec, query->fields[i]) : i;
+        if (stats[i].column == -1)
+          {
+             fprintf(stderr, "Error: %s is not in %s\n", query->fields[i], path);
+             goto out;
+          }
+        if (query->every) continue;
+        stats[i].bins = calloc(ANALYZE_BINS, sizeof(unsigned long));
+        stats[i].histogram = calloc(query->histogram + 1, sizeof(unsigned long));
+        if (!stats[i].bins || !stats[i].histogram)
+          {
+             fprintf(stderr, "Error: out of memory\n");
+             goto out;
+          }
+     }
+
+   lo = _recording_search(&rec, from, false);
+   hi = _recording_search(&rec, to, true);
+   if (hi < lo) hi = lo;
+
+#if defined(MADV_SEQUENTIAL)
+   if (hi > lo)
      {
-        printf(" %d", power->batteries[i]->percent);
+        uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t) (rec.base + lo * rec.size) & ~(page - 1);
+        madvise((void *) start, (uintptr_t) (rec.base + hi * rec.size) - start, MADV_SEQUENTIAL);
      }
+#endif
 
+   printf("%zu samples", hi - lo);
+   if (hi > lo)
+     {
+        printf(" from ");
+        _analyze_time_print(_recording_time(&rec, lo));
+        printf(" to ");
+        _analyze_time_print(_recording_time(&rec, hi - 1));
+     }
    printf("\n");
-}
 
-static void
-results_temperature(int temp)
-{
-   printf("%d\n", temp);
-}
+   if (query->every)
+     _analyze_series(&rec, stats, count, lo, hi, query->every < 0.001 ? 1 : (int64_t) (query->every * 1000));
+   else
+     _analyze_summary(&rec, stats, count, lo, hi, query->histogram);
 
-static void
-results_network(results_t *results)
-{
-   printf("%lu %lu\n", results->incoming, results->outgoing);
+   ret = EXIT_SUCCESS;
+out:
+   if (stats)
+     {
+        for (i = 0; i < count; i++)
+          {
+             free(stats[i].bins);
+             free(stats[i].histogram);
+          }
+        free(stats);
+     }
+   if (map != MAP_FAILED)
+     munmap(map, st.st_size);
+   if (fd != -1)
+     close(fd);
+
+   return ret;
 }
 
-static void
-results_mixer(mixer_t *mixer)
+/* One state file per set of collectors, so status line segments
+ * showing different things don't overwrite each other's state. */
+static bool
+_state_path(char *path, size_t size, int flags)
 {
-   if (!mixer->enabled)
-     return;
+   const char *dir = getenv("XDG_RUNTIME_DIR");
 
-   printf("%d %d\n", mixer->volume_left, mixer->volume_right);
-}
+   if (!dir || !dir[0]) return false;
 
-static void
-results_verbose(results_t *results, int *order, int count)
-{
-   int i, flags;
-   for (i = 0; i < count; i++) {
-        flags = order[i];
-        if (flags & RESULTS_CPU)
-          results_cpu(results->cores, results->cpu_count, flags);
-        else if (flags & RESULTS_MEM)
-          results_mem(&results->memory, flags);
-        else if (flags & RESULTS_PWR)
-          results_power(&results->power);
-        else if (flags & RESULTS_TMP)
-          results_temperature(results->temperature);
-        else if (flags & RESULTS_NET)
-          results_network(results);
-        else if (flags & RESULTS_AUD)
-          results_mixer(&results->mixer);
-     }
+   return snprintf(path, size, "%s/tingle-%x.state", dir, flags) < (int) size;
 }
 
-static void *_network_transfer_get_thread_cb(void *arg)
+/* Intervals are milliseconds, up to a day. */
+static unsigned int
+_interval_parse(const char *option, const char *text)
 {
-   results_t *results = arg;
+   char *end;
+   long value;
+
+   if (!text)
+     {
+        fprintf(stderr, "Error: %s needs an interval\n", option);
+        exit(1 << 1);
+     }
 
-   _network_transfer_get(results);
+   errno = 0;
+   value = strtol(text, &end, 10);
+   if (errno || end == text || *end || value <= 0 || value > 86400000)
+     {
+        fprintf(stderr, "Error: invalid interval %s\n", text);
+        exit(1 << 1);
+     }
 
-   return ((void *) 0);
+   return value;
 }
 
 int
 main(int argc, char **argv)
 {
-   void *ret = NULL;
-   results_t results;
-   bool have_battery, status_line = false;
-   int i, j = 0, flags = 0, error = 0;
+   tingle_t *tingle;
+   tingle_options_t options;
+   rules_t rules;
+   format_t format;
+   sinks_t sinks;
+   server_t server;
+   recorder_t recorder;
+   analyze_query_t query;
+   watch_t watch;
+   const char *error, *template = NULL, *listen_spec = NULL, *hosts = NULL;
+   const char *record_path = NULL, *analyze_path = NULL;
+   bool status_line = false, state = false;
+   char state_path[PATH_MAX];
+   int i, j = 0, flags = 0, ret = EXIT_SUCCESS;
+   unsigned int interval = 0, interval_max = 0;
    int order[argc];
-   pthread_t tid;
 
    memset(&order, 0, sizeof(int) * (argc));
+   tingle_options_init(&options);
+   memset(&rules, 0, sizeof(rules_t));
+   memset(&sinks, 0, sizeof(sinks_t));
+   memset(&query, 0, sizeof(analyze_query_t));
+   memset(&watch, 0, sizeof(watch_t));
 
    for (i = 1; i < argc; i++) {
         if ((!strcmp(argv[i], "-h")) ||
@@ -1575,21 +3941,129 @@ main(int argc, char **argv)
                     "        Show average CPU usage.\n"
                     "      -C\n"
                     "        Show all CPU cores and usage.\n"
+                    "      -F\n"
+                    "        Show CPU frequency per core (package, current, min\n"
+                    "        and max MHz), averaged per package in the status bar.\n"
+                    "      -l\n"
+                    "        Show load averages and scheduler activity (running,\n"
+                    "        blocked, runnable and total tasks, context switches,\n"
+                    "        interrupts and forks per second).\n"
+                    "      -q\n"
+                    "        Show run queue latency from /proc/schedstat: time\n"
+                    "        runnable tasks waited for a CPU, in ms per second\n"
+                    "        and average us per timeslice, overall and per CPU.\n"
+                    "      -I [percent]\n"
+                    "        Show interrupt and softirq rates per CPU. Types where\n"
+                    "        one CPU takes more than percent (default 90) of a\n"
+                    "        busy type are flagged.\n"
                     "      -k (KB) -m (MB) -g (GB)\n"
                     "        Show memory usage (unit).\n"
-                    "      -n\n"
+                    "      -n [filter]\n"
                     "        Show network usage.\n"
+                    "      -i [filter]\n"
+                    "        Show network usage and link utilisation per interface.\n"
+                    "        The filter is a comma separated list of glob patterns,\n"
+                    "        those starting with ! exclude, e.g. 'eth*,wl*,!veth*'.\n"
+                    "      -u\n"
+                    "        Show CPU and memory usage per NUMA node.\n"
+                    "      -d\n"
+                    "        Show kernel network stack counters per second (TCP\n"
+                    "        retransmits, listen drops, resets, UDP errors) and\n"
+                    "        socket usage.\n"
+                    "      -f [filter]\n"
+                    "        Show filesystem usage per mount: size, used and\n"
+                    "        available bytes and inodes. The filter takes mount\n"
+                    "        points in the same form as -i, e.g. '/,/home'.\n"
                     "      -p\n"
                     "        Show power status (ac and battery percentage).\n"
+                    "      -P <pid>[,<pid>...]\n"
+                    "        Show per-process usage: pid, name, alive, CPU%%, RSS\n"
+                    "        and PSS (KB), threads, voluntary and involuntary\n"
+                    "        context switches and read/write bytes per second.\n"
                     "      -t\n"
                     "        Show temperature sensors (temperature in celcius).\n"
+                    "      -E\n"
+                    "        Show power drawn by the CPU packages and their core,\n"
+                    "        uncore and DRAM domains in watts, from the RAPL\n"
+                    "        energy counters (usually readable by root only).\n"
+                    "      -H\n"
+                    "        Show every hwmon sensor: temperatures, fans and\n"
+                    "        voltages with their labels and max and critical\n"
+                    "        thresholds (flagged ! when reached). With -C, per\n"
+                    "        core temperatures are shown next to each core.\n"
                     "      -a\n"
                     "        Display mixer values (system values).\n"
                     "      -s\n"
                     "        Show all in a nicely formatted status bar format.\n"
                     "        This is the default behaviour with no arguments.\n"
                     "        With other flags specify (in any order) which\n"
-                    "        components to display in the status bar.\n"
+                    "        components to display in the status bar.\n");
+             printf("      -e '<rule>'\n"
+                    "        Alert rule, may be repeated. Conditions on fields\n"
+                    "        (cpu, mem, swap, temp, battery, ac, load, disk,\n"
+                    "        net in, net out or any library field name) joined\n"
+                    "        by and, then optional 'for <time>', 'cooldown <time>'\n"
+                    "        and 'hyst <margin>', then ': <command>'. Events are\n"
+                    "        written to stderr. mem and swap take sizes (1.5G)\n"
+                    "        or a share of the total (90%%), e.g.\n"
+                    "        -e 'cpu > 90 for 10s hyst 5 : notify-send busy'\n"
+                    "        -e 'battery < 10 and not ac'\n"
+                    "      --format '<template>'\n"
+                    "        Print one line per sample from a template instead.\n"
+                    "        {field} or {field:spec} is replaced by a field value,\n"
+                    "        spec is an optional unit K, M or G then .decimals,\n"
+                    "        {{ and }} are literal braces, e.g.\n"
+                    "        --format 'C:{cpu:.0}%% M:{mem.used:M}/{mem.total:M} {temp}C'\n"
+                    "      -o <fifo|fd>[=<template>]\n"
+                    "        Also write lines to a named pipe (created if\n"
+                    "        missing) or an inherited descriptor, may be repeated.\n"
+                    "        Each has its own template (default --format or CPU,\n"
+                    "        memory and network) and only gets a line when its\n"
+                    "        text changes. Writes never block; a slow reader gets\n"
+                    "        the latest line. e.g. -o /tmp/bar='{cpu:.0}%%'\n"
+                    "      -r\n"
+                    "        Keep CPU and network counters between runs in\n"
+                    "        $XDG_RUNTIME_DIR so a single run reports rates\n"
+                    "        at once rather than sampling for a second.\n"
+                    "      -w <ms>\n"
+                    "        Keep running, sampling every <ms> milliseconds.\n"
+                    "        SIGHUP re-reads devices, SIGINT or SIGTERM exits.\n"
+                    "      -A <ms>\n"
+                    "        With -w, adapt the interval: double it up to <ms>\n"
+                    "        while nothing changes, return to the -w interval on\n"
+                    "        change or SIGUSR1. Runs at idle priority and reports\n"
+                    "        its own wakeups per second, CPU use and interval\n"
+                    "        (on stderr with --format or -o alone).\n");
+             printf("      --listen [<host>:]<port>\n"
+                    "        Keep running (every second unless -w is given) and\n"
+                    "        answer TCP requests with a compact binary snapshot\n"
+                    "        of CPU, memory, network, load, temperature and disk\n"
+                    "        usage. A request resets -A to the -w interval.\n"
+                    "      --aggregate <host>:<port>[,...]\n"
+                    "        Poll many --listen tingles over persistent\n"
+                    "        connections, every -w (default 1000) milliseconds.\n"
+                    "        Prints each host (up or down, CPU%%, used and total\n"
+                    "        memory MB, net in and out KB/s, load, temperature,\n"
+                    "        disk%%) then fleet sum, max and 95th percentile, or\n"
+                    "        one summary line with -s.\n"
+                    "      --record <file>\n"
+                    "        Append every sample to a binary recording: the time\n"
+                    "        and each field of the collectors in use. With no\n"
+                    "        collector flags the defaults are recorded quietly.\n"
+                    "      --analyze <file> [query]\n"
+                    "        Query a recording without loading it. Prints, per\n"
+                    "        field: samples, min, avg, max, p50, p90, p95, p99.\n"
+                    "        The query is any of\n"
+                    "          --from <time> --to <time>\n"
+                    "            Limit to a time range: now, -<duration> (e.g. -2h,\n"
+                    "            -7d), @<epoch>, YYYY-MM-DD [HH:MM[:SS]] or HH:MM.\n"
+                    "          --field <name>\n"
+                    "            A field to report on, may be repeated (default all).\n"
+                    "          --histogram <bins>\n"
+                    "            Also print bins (field low high samples).\n"
+                    "          --every <duration>\n"
+                    "            Instead print one line per interval: start time,\n"
+                    "            samples, then min, avg and max for each field.\n"
                     "      -v | -version | --version\n"
                     "        Version information.\n"
                     "      -h | -help | --help\n" "        This help.\n");
@@ -1600,7 +4074,7 @@ main(int argc, char **argv)
             (!strcmp(argv[i], "-version")) || (!strcmp(argv[i], "--version")))
           {
              printf("(c) Copyright 2017-2019. Alastair Poole (see COPYING for details)\n");
-             printf("Tingle version %s\n", VERSION);
+             printf("Tingle version %s\n", tingle_version());
              exit(0);
           }
 
@@ -1614,93 +4088,289 @@ main(int argc, char **argv)
           order[j] |= RESULTS_MEM | RESULTS_MEM_MB;
         else if (!strcasecmp(argv[i], "-g"))
           order[j] |= RESULTS_MEM | RESULTS_MEM_GB;
-        else if (!strcasecmp(argv[i], "-p"))
+        else if (!strcmp(argv[i], "-p"))
           order[j] |= RESULTS_PWR;
+        else if (!strcmp(argv[i], "-P") && i + 1 < argc)
+          {
+             order[j] |= RESULTS_PROCS;
+             options.pids = argv[++i];
+          }
         else if (!strcasecmp(argv[i], "-t"))
           order[j] |= RESULTS_TMP;
-        else if (!strcasecmp(argv[i], "-a"))
+        else if (!strcmp(argv[i], "-a"))
           order[j] |= RESULTS_AUD;
-        else if (!strcasecmp(argv[i], "-n"))
-          order[j] |= RESULTS_NET;
+        else if (!strcasecmp(argv[i], "-n") || !strcmp(argv[i], "-i"))
+          {
+             order[j] |= RESULTS_NET;
+             if (!strcmp(argv[i], "-i"))
+               order[j] |= RESULTS_NET_IFACES;
+             if (i + 1 < argc && argv[i + 1][0] != '-')
+               options.network_filter = argv[++i];
+          }
+        else if (!strcmp(argv[i], "-f"))
+          {
+             order[j] |= RESULTS_FS;
+             if (i + 1 < argc && argv[i + 1][0] != '-')
+               options.fs_filter = argv[++i];
+          }
+        else if (!strcmp(argv[i], "-H"))
+          order[j] |= RESULTS_HWMON;
+        else if (!strcmp(argv[i], "-E"))
+          order[j] |= RESULTS_ENERGY;
+        else if (!strcmp(argv[i], "-q"))
+          order[j] |= RESULTS_RUNQ;
+        else if (!strcmp(argv[i], "-u"))
+          order[j] |= RESULTS_NUMA;
+        else if (!strcmp(argv[i], "-F"))
+          order[j] |= RESULTS_FREQ;
+        else if (!strcmp(argv[i], "-l"))
+          order[j] |= RESULTS_SCHED;
+        else if (!strcmp(argv[i], "-d"))
+          order[j] |= RESULTS_NETSTAT;
+        else if (!strcmp(argv[i], "-I"))
+          {
+             order[j] |= RESULTS_IRQS;
+             if (i + 1 < argc && isdigit(argv[i + 1][0]))
+               options.irqs_threshold = atoi(argv[++i]);
+          }
         else if (!strcasecmp(argv[i], "-s"))
           {
              status_line = true;
              continue;
           }
+        else if (!strcmp(argv[i], "-e") && i + 1 < argc)
+          {
+             if (!rules_add(&rules, argv[++i], &error))
+               {
+                  fprintf(stderr, "Error: invalid rule '%s': %s\n", argv[i], error ? error : "out of memory");
+                  exit(1 << 1);
+               }
+             continue;
+          }
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+          {
+             if (!sinks_add(&sinks, argv[++i]))
+               {
+                  fprintf(stderr, "Error: out of memory\n");
+                  exit(1 << 1);
+               }
+             continue;
+          }
+        else if (!strcmp(argv[i], "--format") && i + 1 < argc)
+          {
+             template = argv[++i];
+             continue;
+          }
+        else if (!strcmp(argv[i], "--listen") && i + 1 < argc)
+          {
+             listen_spec = argv[++i];
+             continue;
+          }
+        else if (!strcmp(argv[i], "--aggregate") && i + 1 < argc)
+          {
+             hosts = argv[++i];
+             continue;
+          }
+        else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+          {
+             record_path = argv[++i];
+             continue;
+          }
+        else if (!strcmp(argv[i], "--analyze") && i + 1 < argc)
+          {
+             analyze_path = argv[++i];
+             continue;
+          }
+        else if (!strcmp(argv[i], "--from") && i + 1 < argc)
+          {
+             query.from = argv[++i];
+             continue;
+          }
+        else if (!strcmp(argv[i], "--to") && i + 1 < argc)
+          {
+             query.to = argv[++i];
+             continue;
+          }
+        else if (!strcmp(argv[i], "--field") && i + 1 < argc)
+          {
+             if (query.field_count == ANALYZE_FIELDS_MAX)
+               {
+                  fprintf(stderr, "Error: too many fields\n");
+                  exit(1 << 1);
+               }
+             query.fields[query.field_count++] = argv[++i];
+             continue;
+          }
+        else if (!strcmp(argv[i], "--every") && i + 1 < argc)
+          {
+             if (!_rule_duration(argv[++i], &query.every) || query.every <= 0)
+               {
+                  fprintf(stderr, "Error: invalid duration %s\n", argv[i]);
+                  exit(1 << 1);
+               }
+             continue;
+          }
+        else if (!strcmp(argv[i], "--histogram") && i + 1 < argc)
+          {
+             query.histogram = atoi(argv[++i]);
+             if (query.histogram <= 0 || query.histogram > ANALYZE_BINS)
+               {
+                  fprintf(stderr, "Error: invalid histogram size %s\n", argv[i]);
+                  exit(1 << 1);
+               }
+             continue;
+          }
+        else if (!strcmp(argv[i], "-A"))
+          {
+             interval_max = _interval_parse("-A", i + 1 < argc ? argv[++i] : NULL);
+             continue;
+          }
+        else if (!strcmp(argv[i], "-r"))
+          {
+             state = true;
+             continue;
+          }
+        else if (!strcmp(argv[i], "-w"))
+          {
+             interval = _interval_parse("-w", i + 1 < argc ? argv[++i] : NULL);
+             continue;
+          }
         flags |= order[j++];
      }
 
-   if (flags == 0)
+   if (interval_max && (!interval || interval_max <= interval))
      {
-        flags |= RESULTS_DEFAULT;
-        order[0] |= RESULTS_DEFAULT | RESULTS_MEM_MB;
-        status_line = true;
+        fprintf(stderr, "Error: -A needs a -w interval below it\n");
+        exit(1 << 1);
      }
 
-   memset(&results, 0, sizeof(results_t));
+   /* The analyzer and aggregator collect nothing locally. */
+   if (analyze_path)
+     return analyze_run(analyze_path, &query);
+   if (hosts)
+     return aggregate_run(hosts, interval ? interval : 1000, status_line);
 
-   if (flags & RESULTS_NET)
-    {
-       error = pthread_create(&tid, NULL, _network_transfer_get_thread_cb, &results);
-       if (error)
-         _network_transfer_get(&results);
-    }
-
-   if (flags & RESULTS_CPU)
+   memset(&format, 0, sizeof(format_t));
+   if (template && !format_compile(&format, template, &error))
      {
-        results.cores = _cpu_cores_state_get(&results.cpu_count);
+        fprintf(stderr, "Error: invalid format '%s': %s\n", template, error ? error : "out of memory");
+        exit(1 << 1);
      }
 
-   if (flags & RESULTS_MEM)
+   if (!sinks_compile(&sinks, template, &error))
      {
-        _memory_usage_get(&results.memory);
+        fprintf(stderr, "Error: invalid output: %s\n", error ? error : "out of memory");
+        exit(1 << 1);
      }
 
-   if (flags & RESULTS_PWR)
-     {
-        have_battery = _power_battery_count_get(&results.power);
-        if (have_battery)
-          _power_state_get(&results.power);
-     }
+   /* Record the defaults quietly when nothing is shown. */
+   if (flags == 0 && record_path && !template && !sinks.count && !listen_spec)
+     flags |= RESULTS_DEFAULT & tingle_collectors();
 
-   if (flags & RESULTS_TMP)
+   if (flags == 0 && !template && !sinks.count && !listen_spec)
      {
-        _temperature_cpu_get(&results.temperature);
+        flags |= RESULTS_DEFAULT & tingle_collectors();
+        order[0] |= (RESULTS_DEFAULT & tingle_collectors()) | RESULTS_MEM_MB;
+        status_line = true;
      }
 
-   if (flags & RESULTS_AUD)
+   /* Rules may watch fields that aren't displayed. */
+   if (!rules_compile(&rules))
      {
-        _mixer_master_volume_get(&results.mixer);
+        fprintf(stderr, "Error: out of memory\n");
+        return EXIT_FAILURE;
      }
 
-   if (flags & RESULTS_NET && !error)
+   /* Collectors left out of the build can't be asked for, whether shown,
+    * formatted, sent or watched. */
+   if ((flags | rules.flags | format.flags | sinks.flags) & ~tingle_collectors())
      {
-        pthread_join(tid, ret);
+        fprintf(stderr, "Error: collector not built in\n");
+        exit(1 << 1);
      }
 
-   if (status_line)
+   /* Worker threads inherit the scheduling policy. */
+   if (interval && interval_max > interval)
+     _watch_priority_lower();
+
+   /* A listener serves from the sampling loop. */
+   if (listen_spec)
      {
-        results_pretty(&results, order, j ? j : 1);
+        flags |= SNAPSHOT_FLAGS;
+        if (!interval)
+          interval = 1000;
      }
-   else
+
+   tingle = tingle_new(flags | rules.flags | format.flags | sinks.flags, &options);
+   if (!tingle)
      {
-        results_verbose(&results, order, j);
+        fprintf(stderr, "Error: out of memory\n");
+        return EXIT_FAILURE;
      }
 
-   if (flags & RESULTS_PWR)
+   if (listen_spec && !server_init(&server, listen_spec, tingle))
      {
-	for (i = 0; i < results.power.battery_count; i++)
-          free(results.power.batteries[i]);
+        fprintf(stderr, "Error: unable to listen on %s: %s\n", listen_spec, strerror(errno));
+        exit(1 << 1);
      }
 
-   if (flags & RESULTS_CPU)
+   if (record_path && !recorder_open(&recorder, record_path, tingle))
+     exit(1 << 1);
+
+   watch.tingle = tingle;
+   watch.rules = &rules;
+   watch.format = template ? &format : NULL;
+   watch.sinks = &sinks;
+   watch.server = listen_spec ? &server : NULL;
+   watch.recorder = record_path ? &recorder : NULL;
+   watch.order = order;
+   watch.count = j;
+   watch.status_line = status_line;
+
+   if (interval)
+     ret = watch_run(&watch, interval, interval_max);
+   else
      {
-        for (i = 0; i < results.cpu_count; i++)
+        /* Rate collectors need a baseline one second before the sample,
+         * unless the last run left one behind. */
+        if (state)
+          state = _state_path(state_path, sizeof(state_path), tingle_flags(tingle));
+        if (state)
+          tingle_state_load(tingle, state_path);
+
+        if (tingle_rates(tingle))
+          {
+             tingle_baseline(tingle);
+             usleep(1000000);
+          }
+
+        tingle_sample(tingle);
+        rules_eval(&rules, tingle);
+
+        sinks_write(&sinks, NULL, tingle);
+        recorder_write(watch.recorder, tingle);
+
+        if (template)
+          format_write(&format, tingle, STDOUT_FILENO);
+        else if (j || status_line)
           {
-             free(results.cores[i]);
+             _results_output(tingle_results(tingle), order, j, status_line);
+             if (status_line)
+               printf("\n");
           }
-        free(results.cores);
+
+        if (state)
+          tingle_state_save(tingle, state_path);
      }
 
-   return EXIT_SUCCESS;
+   tingle_free(tingle);
+   rules_shutdown(&rules);
+   format_shutdown(&format);
+   sinks_shutdown(&sinks, NULL);
+   if (listen_spec)
+     server_shutdown(&server);
+   if (record_path)
+     recorder_close(&recorder);
+
+   return ret;
 }
@@ -0,0 +1,574 @@
+/*
+   Copyright (c) 2017, Alastair Poole <netstar@gmail.com>
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TINGLE_H
+#define TINGLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <net/if.h>
+
+#define TINGLE_VERSION "0.9.0"
+
+#define MAX_BATTERIES     5
+#define INVALID_TEMP      -999
+
+/* Filter requests and results */
+#define RESULTS_CPU       0x01
+#define RESULTS_MEM       0x02
+#define RESULTS_PWR       0x04
+#define RESULTS_TMP       0x08
+#define RESULTS_AUD       0x10
+#define RESULTS_NET       0x20
+#define RESULTS_DEFAULT   0x3f
+#define RESULTS_MEM_MB    0x40
+#define RESULTS_MEM_GB    0x80
+#define RESULTS_CPU_CORES 0x100
+#define RESULTS_NET_IFACES 0x200
+#define RESULTS_NUMA      0x400
+#define RESULTS_FREQ      0x800
+#define RESULTS_SCHED     0x1000
+#define RESULTS_IRQS      0x2000
+#define RESULTS_NETSTAT   0x4000
+#define RESULTS_PROCS     0x8000
+#define RESULTS_FS        0x10000
+#define RESULTS_HWMON     0x20000
+#define RESULTS_ENERGY    0x40000
+#define RESULTS_RUNQ      0x80000
+
+/* Pseudo files the collectors hold open; the library reads all of them
+ * together before each sample. */
+typedef struct reader_t reader_t;
+typedef struct reader_file_t reader_file_t;
+
+/* Per-core figures are parallel arrays carved from one allocation made
+ * when the collector starts, so sampling never allocates and averages
+ * run over contiguous memory. */
+typedef struct
+{
+   unsigned long *total;
+   unsigned long *idle;
+   float         *percent;
+   void          *arena;
+   reader_file_t *stat;
+} cpu_cores_t;
+
+typedef struct
+{
+   unsigned long total;
+   unsigned long used;
+   unsigned long cached;
+   unsigned long buffered;
+   unsigned long shared;
+   unsigned long swap_total;
+   unsigned long swap_used;
+} meminfo_t;
+
+enum
+{
+   RAPL_PACKAGE,
+   RAPL_CORE,
+   RAPL_UNCORE,
+   RAPL_DRAM,
+   RAPL_PSYS,
+   RAPL_OTHER,
+};
+
+/* A RAPL zone from powercap, e.g. package-0 or its core, uncore and
+ * dram subzones (named core-0 and so on). energy is the raw counter in
+ * microjoules, wrapping after range; watts is the average over the
+ * last sampling window. */
+typedef struct
+{
+   char           name[32];
+   int            type;
+   uint64_t       energy;
+   uint64_t       range;
+   double         watts;
+   bool           valid;
+   reader_file_t *file;
+} rapl_zone_t;
+
+typedef struct
+{
+   rapl_zone_t    *zones;
+   int             count;
+   uint64_t        stamp;
+} rapl_t;
+
+typedef struct
+{
+   bool         have_ac;
+   int          battery_count;
+
+   /* Per-battery arrays, carved like the CPU cores. */
+   double      *charge_full;
+   double      *charge_current;
+   uint8_t     *percent;
+   const char **naming;
+   reader_file_t **files;
+   void        *arena;
+
+   reader_file_t *ac_file;
+
+   char         battery_names[256];
+   int         *bat_mibs[MAX_BATTERIES];
+   int          ac_mibs[5];
+} power_t;
+
+typedef struct
+{
+   bool    enabled;
+   uint8_t volume_left;
+   uint8_t volume_right;
+} mixer_t;
+
+typedef struct
+{
+   char          name[IF_NAMESIZE];
+   unsigned int  ifindex;
+   unsigned int  seen;
+   bool          included;
+   bool          valid;
+   unsigned long in;
+   unsigned long out;
+   unsigned long incoming;
+   unsigned long outgoing;
+   unsigned long speed;
+} net_iface_t;
+
+/* Interfaces are kept in a dense array addressed through an open
+ * addressing table keyed by ifindex. order holds the interfaces of the
+ * current sample in the order the system listed them and prev those of
+ * the last one, which lets most lookups hit without hashing or a
+ * syscall. Storage only grows when interfaces appear. */
+typedef struct
+{
+   uint64_t        stamp;
+   const char     *filter;
+   char          **patterns;
+   int             pattern_count;
+
+   net_iface_t    *ifaces;
+   int             iface_size;
+   int            *unused;
+   int             unused_count;
+   int            *slots;
+   int             slot_size;
+   int            *order;
+   int             order_count;
+   int            *prev;
+   int             prev_count;
+   int             hint;
+   unsigned int    generation;
+
+   reader_file_t  *dev;
+} network_t;
+
+/* Scheduler activity. The /proc/stat counters come from the CPU
+ * collector's read of the file. */
+typedef struct
+{
+   bool            enabled;
+   unsigned long   ctxt;
+   unsigned long   intr;
+   unsigned long   forks;
+   unsigned long   ctxt_rate;
+   unsigned long   intr_rate;
+   unsigned long   fork_rate;
+   unsigned int    running;
+   unsigned int    blocked;
+   unsigned int    runnable;
+   unsigned int    tasks;
+   double          load[3];
+   uint64_t        stamp;
+   reader_file_t  *loadavg;
+} sched_t;
+
+/* Run queue latency from /proc/schedstat: how long tasks that were
+ * ready to run waited for a CPU. wait is milliseconds waited per second
+ * (1000 is one task always waiting), delay the average wait in
+ * microseconds per timeslice run. */
+typedef struct
+{
+   int             cpu;
+   uint64_t        run_ns;
+   uint64_t        wait_ns;
+   uint64_t        slices;
+   double          wait;
+   double          delay;
+} runq_cpu_t;
+
+typedef struct
+{
+   runq_cpu_t     *cpus;
+   int             count;
+   int             size;
+   double          wait;
+   double          delay;
+   bool            valid;
+   uint64_t        stamp;
+   reader_file_t  *file;
+} runq_t;
+
+typedef struct
+{
+   pid_t          pid;
+   bool           alive;
+   char           comm[16];
+   int            pidfd;
+   int            stat_fd;
+   int            status_fd;
+   int            smaps_fd;
+   int            io_fd;
+   unsigned long  ticks;
+   unsigned long  voluntary;
+   unsigned long  involuntary;
+   uint64_t       read_bytes;
+   uint64_t       write_bytes;
+   float          percent;
+   unsigned long  rss;
+   unsigned long  pss;
+   unsigned int   threads;
+   unsigned long  voluntary_rate;
+   unsigned long  involuntary_rate;
+   unsigned long  read_rate;
+   unsigned long  write_rate;
+} proc_t;
+
+/* Processes watched with -P. Their /proc files are opened once and
+ * re-read with pread(); a pidfd tells us when a process has exited so a
+ * recycled PID is never picked up. */
+typedef struct
+{
+   const char     *pids;
+   proc_t         *procs;
+   int             count;
+   long            hz;
+   uint64_t        stamp;
+} procs_t;
+
+/* Sizes in bytes. dev identifies the filesystem where the system
+ * tells us (Linux), so bind mounts of it are listed once. */
+typedef struct
+{
+   char      mount[256];
+   char      source[128];
+   char      type[32];
+   uint64_t  dev;
+   bool      bind;
+   bool      valid;
+   uint64_t  total;
+   uint64_t  used;
+   uint64_t  avail;
+   uint64_t  inodes;
+   uint64_t  inodes_used;
+   uint64_t  inodes_free;
+   float     percent;
+   float     inodes_percent;
+} fs_mount_t;
+
+/* Mounted filesystems (-f), filtered by mount point. On Linux the
+ * mount table is only parsed again when the kernel flags a change with
+ * POLLPRI on /proc/self/mountinfo; other systems list it each sample.
+ * Pseudo filesystems are left out. */
+typedef struct
+{
+   const char     *filter;
+   char          **patterns;
+   int             pattern_count;
+   int             fd;
+   bool            changed;
+   fs_mount_t     *mounts;
+   int             count;
+   int             size;
+   char           *buf;
+   size_t          buf_size;
+} filesystems_t;
+
+enum
+{
+   HWMON_TEMP,
+   HWMON_FAN,
+   HWMON_IN,
+   HWMON_TYPES,
+};
+
+/* One hwmon input: temperatures in millidegrees C, fans in RPM and
+ * voltages in millivolts. max and crit are 0 where the chip has none;
+ * core is the coretemp core a temperature belongs to, or -1. */
+typedef struct
+{
+   char           chip[32];
+   char           label[32];
+   int            hwmon;
+   int            type;
+   int            index;
+   int            package;
+   int            core;
+   long           value;
+   long           max;
+   long           crit;
+   bool           valid;
+   reader_file_t *input;
+} hwmon_sensor_t;
+
+/* cpus maps each CPU to its per-core temperature sensor, -1 if none. */
+typedef struct
+{
+   hwmon_sensor_t *sensors;
+   int             count;
+   int            *cpus;
+   int             cpu_count;
+} hwmon_t;
+
+/* Kernel network stack counters from /proc/net/snmp and
+ * /proc/net/netstat. Both files come in header/value line pairs; the
+ * position of every counter is looked up once from the headers. */
+enum
+{
+   NETSTAT_TCP_ACTIVE_OPENS,
+   NETSTAT_TCP_PASSIVE_OPENS,
+   NETSTAT_TCP_ATTEMPT_FAILS,
+   NETSTAT_TCP_ESTAB_RESETS,
+   NETSTAT_TCP_CURR_ESTAB,
+   NETSTAT_TCP_IN_SEGS,
+   NETSTAT_TCP_OUT_SEGS,
+   NETSTAT_TCP_RETRANS_SEGS,
+   NETSTAT_TCP_IN_ERRS,
+   NETSTAT_TCP_OUT_RSTS,
+   NETSTAT_TCP_LISTEN_OVERFLOWS,
+   NETSTAT_TCP_LISTEN_DROPS,
+   NETSTAT_TCP_TIMEOUTS,
+   NETSTAT_TCP_BACKLOG_DROP,
+   NETSTAT_UDP_IN_DATAGRAMS,
+   NETSTAT_UDP_OUT_DATAGRAMS,
+   NETSTAT_UDP_NO_PORTS,
+   NETSTAT_UDP_IN_ERRORS,
+   NETSTAT_UDP_RCVBUF_ERRORS,
+   NETSTAT_UDP_SNDBUF_ERRORS,
+   NETSTAT_COUNTERS,
+};
+
+typedef struct
+{
+   const char *section;
+   const char *name;
+   bool        gauge;
+} netstat_counter_t;
+
+extern const netstat_counter_t tingle_netstat_counters[NETSTAT_COUNTERS];
+
+typedef struct
+{
+   int  file;
+   int  column;
+} netstat_index_t;
+
+typedef struct
+{
+   netstat_index_t index[NETSTAT_COUNTERS];
+   uint64_t        values[NETSTAT_COUNTERS];
+   unsigned long   rates[NETSTAT_COUNTERS];
+   unsigned long   sockets;
+   unsigned long   tcp_inuse;
+   unsigned long   tcp_orphan;
+   unsigned long   tcp_tw;
+   unsigned long   tcp_alloc;
+   unsigned long   udp_inuse;
+   uint64_t       *row;
+   int             row_size;
+   uint64_t        stamp;
+   reader_file_t  *files[2];
+   reader_file_t  *sockstat;
+   char           *buf;
+   size_t          buf_size;
+} netstat_t;
+
+typedef struct
+{
+   char           name[16];
+   uint64_t      *prev;
+   unsigned long *rates;
+   unsigned long  total;
+   int            busiest;
+   int            share;
+   bool           imbalanced;
+} irq_type_t;
+
+/* Softirq types from /proc/softirqs plus an "IRQ" row summing every
+ * line of /proc/interrupts. Columns are the online CPUs listed in the
+ * header; rates are per column. */
+typedef struct
+{
+   int             threshold;
+   int            *cpus;
+   int             columns;
+   irq_type_t     *types;
+   int             type_count;
+   uint64_t       *row;
+   uint64_t       *sum;
+   uint64_t        stamp;
+   reader_file_t  *softirqs;
+   reader_file_t  *interrupts;
+   char           *buf;
+   size_t          buf_size;
+} irqs_t;
+
+typedef struct
+{
+   reader_file_t *cur_file;
+   int            package;
+   unsigned long  cur;
+   unsigned long  min;
+   unsigned long  max;
+} cpu_freq_t;
+
+/* Frequencies are in kHz. Only scaling_cur_freq is held open per core;
+ * the policy limits are read when the collector starts. */
+typedef struct
+{
+   cpu_freq_t    *cores;
+   int            count;
+   int            packages;
+   char          *buf;
+   size_t         buf_size;
+} cpufreq_t;
+
+typedef struct
+{
+   int            id;
+   int           *cpus;
+   int            cpu_count;
+   unsigned long  mem_total;
+   unsigned long  mem_used;
+   unsigned long  mem_free;
+   unsigned long  numa_hit;
+   unsigned long  numa_miss;
+   unsigned long  numa_foreign;
+   unsigned long  hit;
+   unsigned long  miss;
+   unsigned long  foreign;
+} numa_node_t;
+
+typedef struct
+{
+   numa_node_t    *nodes;
+   int             node_count;
+   uint64_t        stamp;
+   char           *buf;
+   size_t          buf_size;
+} numa_t;
+
+typedef struct results_t results_t;
+struct results_t
+{
+   int           cpu_count;
+   cpu_cores_t   cores;
+
+   meminfo_t     memory;
+   reader_file_t *memory_file;
+
+   power_t       power;
+   /* Host energy use (RESULTS_ENERGY), power's other half. It has its
+    * own collector, so it lives beside power_t rather than in it. */
+   rapl_t        rapl;
+
+   mixer_t       mixer;
+
+   numa_t        numa;
+
+   cpufreq_t     cpufreq;
+
+   sched_t       sched;
+
+   runq_t        runq;
+
+   irqs_t        irqs;
+
+   netstat_t     netstat;
+
+   procs_t       procs;
+
+   filesystems_t filesystems;
+
+   hwmon_t       hwmon;
+
+   network_t     network;
+   unsigned long incoming;
+   unsigned long outgoing;
+
+   int           temperature;
+   reader_file_t *temperature_file;
+
+   reader_t     *reader;
+};
+
+/* Library interface. A handle owns the collectors selected by flags and
+ * keeps their state between samples; rate collectors report against the
+ * previous call, so the first sample of a handle only takes a baseline.
+ * Named fields (tingle_field_find()) are the stable way to read results.
+ * The layout of results_t may change between versions. Options carry
+ * their size so new ones can be appended: start from
+ * tingle_options_init() and set what's needed. */
+typedef struct tingle_t tingle_t;
+
+typedef struct
+{
+   size_t      size;
+   const char *network_filter;
+   int         irqs_threshold;
+   const char *pids;
+   const char *fs_filter;
+} tingle_options_t;
+
+void        tingle_options_init(tingle_options_t *options);
+tingle_t   *tingle_new(int flags, const tingle_options_t *options);
+void        tingle_free(tingle_t *tingle);
+
+void        tingle_sample(tingle_t *tingle);
+void        tingle_baseline(tingle_t *tingle);
+bool        tingle_rates(const tingle_t *tingle);
+void        tingle_reload(tingle_t *tingle);
+
+bool        tingle_state_load(tingle_t *tingle, const char *path);
+bool        tingle_state_save(tingle_t *tingle, const char *path);
+
+int         tingle_flags(const tingle_t *tingle);
+results_t  *tingle_results(tingle_t *tingle);
+
+int         tingle_field_count(void);
+const char *tingle_field_name(int field);
+int         tingle_field_find(const char *name);
+int         tingle_field_flag(int field);
+bool        tingle_field_get(const tingle_t *tingle, int field, double *value);
+
+float       tingle_percent_avg(const float *percent, int count);
+
+const char *tingle_version(void);
+int         tingle_collectors(void);
+
+#endif